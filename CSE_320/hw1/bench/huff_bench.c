@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "block.h"
+#include "io.h"
+
+/*
+ * Benchmark of the block codec. Every input of the corpus, the files named
+ * on the command line and generated data, is compressed block by block
+ * with compress_data() and decompressed with decompress_data(), at every
+ * block size of block_sizes, and checked to round-trip. The results are
+ * written to standard output as one JSON object:
+ *     {"results": [{"input": NAME, "size": BYTES, "block_size": BYTES,
+ *                   "compressed_size": BYTES, "ratio": RAW/COMPRESSED,
+ *                   "compress_mbps": MB/S, "decompress_mbps": MB/S,
+ *                   "phase_ms": {"histogram": MS, "tree_build": MS,
+ *                                "tree_emit": MS, "encode": MS,
+ *                                "decode": MS}}, ...]}
+ * Every measurement is repeated for at least MIN_SECONDS; the times are
+ * those of one repetition, and a MB is 10^6 bytes.
+ */
+#define MIN_SECONDS 0.25
+
+static const unsigned block_sizes[] = { 1024, 16384, 65536 };
+static const size_t gen_sizes[] = { 64 << 10, 1 << 20, 4 << 20 };
+
+/* Kinds of generated data */
+#define GEN_RANDOM  0   // Uniform bytes
+#define GEN_SKEWED  1   // Low byte values far more frequent than high ones
+#define GEN_RUNS    2   // Runs of 1 to 64 copies of a random byte
+#define NUM_GEN     3
+
+static const char *gen_names[NUM_GEN] = { "random", "skewed", "runs" };
+
+/* Names of the phases in the report, by PHASE_* number */
+static const char *phase_names[NUM_PHASES] = {
+    "histogram", "tree_build", "tree_emit", "encode", "decode"
+};
+
+static int nresults;    // Number of results written so far
+
+/*
+ * @brief Reads the monotonic clock.
+ *
+ * @return The time in seconds
+*/
+static double
+now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * @brief Steps a xorshift64 generator.
+ *
+ * @param state State of the generator, not 0
+ * @return The next 64 random bits
+*/
+static uint64_t
+next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/*
+ * @brief Generates data of one kind, the same on every run.
+ *
+ * @param kind GEN_RANDOM, GEN_SKEWED or GEN_RUNS
+ * @param buf Buffer receiving the data
+ * @param n Number of bytes
+*/
+static void
+generate(int kind, unsigned char *buf, size_t n) {
+    uint64_t state = 0x9E3779B97F4A7C15ULL + kind;
+
+    for(size_t i = 0; i < n;) {
+        uint64_t r = next_random(&state);
+        if(kind == GEN_RANDOM) {
+            *(buf+i++) = r;
+        } else if(kind == GEN_SKEWED) {
+            /* Groups of 8 byte values, each half as frequent as the last:
+               about 5 bits per byte */
+            int group = __builtin_ctz((uint32_t)r | 0x80000000);
+            *(buf+i++) = group * 8 + ((r >> 32) & 7);
+        } else {
+            size_t len = 1 + ((r >> 8) & 63);
+            for(; len && i < n; --len) *(buf+i++) = r;
+        }
+    }
+}
+
+/*
+ * @brief Reads a whole file.
+ *
+ * @param path Name of the file
+ * @param n Set to the number of bytes
+ * @return The contents, allocated with malloc(), or NULL on error
+*/
+static unsigned char *
+read_file(const char *path, size_t *n) {
+    unsigned char *buf = NULL;
+    struct stat st;
+    int fd;
+
+    if((fd = open(path, O_RDONLY)) < 0) return NULL;
+    if(!fstat(fd, &st) && (buf = malloc(st.st_size ? st.st_size : 1)) != NULL
+       && read_full(fd, buf, st.st_size, 0)) {
+        free(buf);
+        buf = NULL;
+    }
+    *n = buf ? st.st_size : 0;
+    close(fd);
+
+    return buf;
+}
+
+/*
+ * @brief Compresses data block by block.
+ *
+ * @param b Block state, whose data buffer is replaced by the data
+ * @param data Raw data
+ * @param n Number of raw bytes
+ * @param bsize Block size
+ * @param cbuf Set to the compressed blocks
+ * @return 0 on success, 1 on error
+*/
+static int
+compress_all(BLOCK *b, unsigned char *data, size_t n, unsigned bsize, OUTBUF *cbuf) {
+    cbuf->len = 0;
+    b->has_prev = 0;
+
+    for(size_t off = 0; off < n; off += bsize) {
+        b->data = data + off;
+        b->size = n - off < bsize ? n - off : bsize;
+        if(compress_data(b) || out_reserve(cbuf, b->out.len)) return 1;
+        for(size_t i = 0; i < b->out.len; ++i) *(cbuf->buf+cbuf->len+i) = *(b->out.buf+i);
+        cbuf->len += b->out.len;
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Decompresses the blocks written by compress_all().
+ *
+ * @param b Block state
+ * @param cbuf Compressed blocks
+ * @param dst Buffer receiving the raw data
+ * @param n Number of raw bytes
+ * @return 0 on success, 1 if the blocks do not decompress to n bytes
+*/
+static int
+decompress_all(BLOCK *b, const OUTBUF *cbuf, unsigned char *dst, size_t n) {
+    INBUF in = { cbuf->buf, 0, cbuf->len, NULL, 0 };
+    size_t off = 0;
+
+    b->has_prev = 0;
+    while(in.pos < in.len) {
+        if(decompress_data(b, &in) || b->out.len > n - off) return 1;
+        for(size_t i = 0; i < b->out.len; ++i) *(dst+off+i) = *(b->out.buf+i);
+        off += b->out.len;
+    }
+
+    return off != n;
+}
+
+/*
+ * @brief Writes a string as a JSON string.
+ *
+ * @param str The string
+*/
+static void
+put_json_string(const char *str) {
+    putchar('"');
+    for(; *str; ++str) {
+        unsigned char c = *str;
+        if(c == '"' || c == '\\') printf("\\%c", c);
+        else if(c < 0x20) printf("\\u%04x", c);
+        else putchar(c);
+    }
+    putchar('"');
+}
+
+/*
+ * @brief Benchmarks one input at one block size and writes the result.
+ *
+ * @param name Name of the input
+ * @param data Raw data
+ * @param n Number of raw bytes, at least 1
+ * @param bsize Block size
+ * @return 0 on success, 1 if the data does not round-trip or on error
+*/
+static int
+bench(const char *name, unsigned char *data, size_t n, unsigned bsize) {
+    BLOCK *enc = block_init(), *dec = block_init();
+    unsigned char *own = enc ? enc->data : NULL;    // Data buffer of enc
+    unsigned char *dst = malloc(n);
+    BLOCK_TIMES ctimes = {{0}}, dtimes = {{0}};
+    OUTBUF cbuf = {0};
+    double ctime = 0, dtime = 0, t;
+    unsigned creps = 0, dreps = 0;
+    int ret = 1;
+
+    if(enc == NULL || dec == NULL || dst == NULL) goto cleanup;
+    enc->times = &ctimes;
+    dec->times = &dtimes;
+
+    do {
+        t = now();
+        if(compress_all(enc, data, n, bsize, &cbuf)) goto cleanup;
+        ctime += now() - t;
+        creps++;
+    } while(ctime < MIN_SECONDS);
+
+    do {
+        t = now();
+        if(decompress_all(dec, &cbuf, dst, n)) goto cleanup;
+        dtime += now() - t;
+        dreps++;
+    } while(dtime < MIN_SECONDS);
+
+    for(size_t i = 0; i < n; ++i) {
+        if(*(dst+i) != *(data+i)) goto cleanup;
+    }
+
+    printf("%s\n    {\"input\": ", nresults++ ? "," : "");
+    put_json_string(name);
+    printf(", \"size\": %zu, \"block_size\": %u, \"compressed_size\": %zu, \"ratio\": %.4f,\n"
+           "     \"compress_mbps\": %.3f, \"decompress_mbps\": %.3f,\n"
+           "     \"phase_ms\": {",
+           n, bsize, cbuf.len, (double)n / cbuf.len,
+           n * creps / ctime / 1e6, n * dreps / dtime / 1e6);
+    for(int p = 0; p < NUM_PHASES; ++p) {
+        const BLOCK_TIMES *bt = (p == PHASE_DECODE) ? &dtimes : &ctimes;
+        const unsigned reps = (p == PHASE_DECODE) ? dreps : creps;
+        printf("%s\"%s\": %.4f", p ? ", " : "", *(phase_names+p),
+               *(bt->ns+p) / 1e6 / reps);
+    }
+    printf("}}");
+    fflush(stdout);
+    ret = 0;
+
+cleanup:
+    if(enc) {
+        enc->data = own;
+        block_fini(enc);
+    }
+    if(dec) block_fini(dec);
+    free(dst);
+    free(cbuf.buf);
+    if(ret) fprintf(stderr, "huff_bench: %s (block size %u) failed\n", name, bsize);
+
+    return ret;
+}
+
+/*
+ * @brief Benchmarks one input at every block size.
+ *
+ * @return 0 on success, 1 on error
+*/
+static int
+bench_sizes(const char *name, unsigned char *data, size_t n) {
+    int ret = 0;
+
+    for(size_t i = 0; i < sizeof(block_sizes) / sizeof(*block_sizes); ++i) {
+        ret |= bench(name, data, n, *(block_sizes+i));
+    }
+
+    return ret;
+}
+
+int
+main(int argc, char **argv) {
+    char name[64];
+    size_t n;
+    int ret = 0;
+
+    printf("{\"results\": [");
+
+    /* Corpus files */
+    for(int i = 1; i < argc; ++i) {
+        unsigned char *data = read_file(*(argv+i), &n);
+        if(data == NULL || !n) {
+            fprintf(stderr, "huff_bench: cannot read %s\n", *(argv+i));
+            ret = 1;
+        } else {
+            ret |= bench_sizes(*(argv+i), data, n);
+        }
+        free(data);
+    }
+
+    /* Generated data */
+    for(int kind = 0; kind < NUM_GEN; ++kind) {
+        for(size_t i = 0; i < sizeof(gen_sizes) / sizeof(*gen_sizes); ++i) {
+            unsigned char *data = malloc(*(gen_sizes+i));
+            if(data == NULL) return 1;
+            generate(kind, data, *(gen_sizes+i));
+            snprintf(name, sizeof(name), "%s-%zu", *(gen_names+kind), *(gen_sizes+i));
+            ret |= bench_sizes(name, data, *(gen_sizes+i));
+            free(data);
+        }
+    }
+
+    printf("\n]}\n");
+
+    return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,29 @@
+#ifndef ADAPT_H
+#define ADAPT_H
+
+#include <stddef.h>
+#include "block.h"
+
+/*
+ * Adaptive block sizing. The raw data is cut into windows of the block
+ * size; a block starts with one window and takes in the following ones
+ * for as long as coding them with one code is estimated to be no larger
+ * than coding them apart. A block thus grows over data whose byte
+ * statistics stay the same and ends where they change, up to
+ * MAX_ADAPTIVE_BLOCK bytes.
+ */
+
+/*
+ * Find the length of the block starting at the beginning of a buffer.
+ *
+ * @param data  Raw data, starting at the block.
+ * @param n  Number of bytes of raw data.
+ * @param window  Window size, at most MAX_BLOCK_SIZE.
+ * @param final  Set if no raw data follows the buffer.
+ * @return  the length of the block, or 0 if more data is needed to
+ * decide it (only when "final" is not set, or when n is 0). The length
+ * is always decided when n is at least MAX_ADAPTIVE_BLOCK + window.
+ */
+size_t adapt_split(const unsigned char *data, size_t n, size_t window, int final);
+
+#endif
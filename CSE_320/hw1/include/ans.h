@@ -0,0 +1,91 @@
+#ifndef ANS_H
+#define ANS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Table-based asymmetric numeral systems (tANS) coder, the second entropy
+ * coder of a block (see BLOCK_ANS). The probability of every byte value
+ * is normalized to a count out of 2^lg, the table log, and the counts are
+ * spread over a table of 2^lg states. Every byte coded moves the coder
+ * from one state to another, emitting or consuming the bits that tell
+ * them apart; a byte costs a fraction of a bit more or less than a whole
+ * number of bits, as its probability asks, unlike a Huffman code.
+ *
+ * The data is encoded last byte first, so that it is decoded first byte
+ * first, by reading the bit stream forward.
+ */
+#define ANS_MIN_LOG     5
+#define ANS_MAX_LOG     12
+
+/*
+ * Decode table entry of a state.
+ */
+typedef struct ans_entry {
+    uint16_t base;          // First next state
+    unsigned char sym;      // Decoded byte value
+    unsigned char nbits;    // Number of bits read to find the next state
+} ANS_ENTRY;
+
+/*
+ * Choose the table log for a block.
+ *
+ * @param size  Number of bytes of the block, at least 1.
+ * @param nsym  Number of byte values in use, at least 1.
+ * @return  the table log, ANS_MIN_LOG to ANS_MAX_LOG.
+ */
+int ans_table_log(unsigned size, int nsym);
+
+/*
+ * Normalize a histogram to counts out of 2^lg. Every byte value in use
+ * gets a count of at least 1.
+ *
+ * @param hist  Number of occurrences of every byte value.
+ * @param lg  Table log, with 2^lg at least the number of byte values in use.
+ * @param norm  Set to the count of every byte value.
+ */
+void ans_normalize(const uint32_t *hist, int lg, uint16_t *norm);
+
+/*
+ * Estimate the number of bits of the data of a histogram coded with
+ * normalized counts.
+ *
+ * @param hist  Number of occurrences of every byte value.
+ * @param lg  Table log.
+ * @param norm  Normalized count of every byte value.
+ * @return  the estimated number of bits.
+ */
+uint64_t ans_cost(const uint32_t *hist, int lg, const uint16_t *norm);
+
+/*
+ * Build the decode table of normalized counts.
+ *
+ * @param norm  Normalized count of every byte value, adding up to 2^lg.
+ * @param lg  Table log.
+ * @param tab  Set to the 2^lg entries of the decode table.
+ */
+void ans_decode_table(const uint16_t *norm, int lg, ANS_ENTRY *tab);
+
+/*
+ * Encode data with normalized counts.
+ *
+ * The bit stream starts with zero to seven zero bits and a one bit, which
+ * align its end to a whole byte, followed by the lg bits of the first
+ * state of the decoder, then by the bits read after every byte decoded.
+ * The last state of the decoder is 0.
+ *
+ * @param norm  Normalized count of every byte value, at least 1 for every
+ * byte value in the data.
+ * @param lg  Table log.
+ * @param data  Bytes to encode.
+ * @param n  Number of bytes.
+ * @param buf  Output, with room for ANS_BOUND(n, lg) bytes.
+ * @return  the number of bytes of the bit stream, which starts at buf.
+ */
+size_t ans_encode(const uint16_t *norm, int lg, const unsigned char *data, unsigned n,
+                  unsigned char *buf);
+
+#define ANS_BOUND(n, lg)    (((uint64_t)(n) * (lg) + (lg) + 1) / 8 + 2 + 8)
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "huff_ctx.h"
+
+/*
+ * An archive holds any number of files, each compressed as its own member,
+ * a complete compressed stream as compress() writes it:
+ *     1. The member of every file, in increasing byte order of the names
+ *     2. Central directory: for every member, in the same order, offset
+ *        of the member from the start of the archive (eight bytes),
+ *        compressed size (eight bytes), raw size (eight bytes), length of
+ *        the name (two bytes) and the name, big-endian
+ *     3. Number of members (four bytes) and offset of the central
+ *        directory (eight bytes), big-endian
+ *     4. The four bytes of ARCHIVE_MAGIC
+ * A member is found by reading the central directory from the end of the
+ * archive, without reading any other member.
+ */
+#define ARCHIVE_MAGIC       "HUFA"
+#define ARCHIVE_ENTRY_SIZE  26
+#define ARCHIVE_FOOTER_SIZE 16
+#define ARCHIVE_MAX_NAME    0xFFFF
+
+/*
+ * One member of an archive.
+ */
+typedef struct archive_member {
+    const char *name;       // Name of the member, not NUL-terminated
+    size_t name_len;        // Length of the name
+    uint64_t offset;        // Offset of the member in the archive
+    uint64_t comp_size;     // Size of the compressed stream
+    uint64_t raw_size;      // Number of raw bytes
+} ARCHIVE_MEMBER;
+
+/*
+ * Central directory of an archive.
+ */
+typedef struct archive_dir {
+    ARCHIVE_MEMBER *members;    // Members, sorted by name
+    size_t count;               // Number of members
+    char *names;                // Storage of the names
+    off_t base;                 // File offset of the start of the archive
+} ARCHIVE_DIR;
+
+/*
+ * Reads a list of file names, one per line, from standard input and writes
+ * an archive of the files to standard output. The files are compressed by
+ * nthreads worker threads, one file per thread at a time, and written in
+ * the order of the central directory.
+ *
+ * @param nthreads  Number of worker threads, 0 for one.
+ * @param params  Compression parameters of every member.
+ * @return  0 on success, 1 if a name is listed twice, a file cannot be
+ * read or an error occurs.
+ */
+int archive_pack(int nthreads, const HUFF_PARAMS *params);
+
+/*
+ * Read the central directory of an archive from a seekable file. The
+ * archive starts at the current offset of the file and ends at the end of
+ * the file. The offset of the file is not changed.
+ *
+ * @param fd  The file descriptor.
+ * @param dir  Set to the central directory.
+ * @return  0 on success, 1 if the file is not seekable or does not end
+ * in a valid central directory.
+ */
+int archive_read(int fd, ARCHIVE_DIR *dir);
+
+/*
+ * Find a member of an archive by name.
+ *
+ * @param dir  The central directory.
+ * @param name  Name of the member.
+ * @return  the member, or NULL if the archive has no member of that name.
+ */
+ARCHIVE_MEMBER *archive_find(ARCHIVE_DIR *dir, const char *name);
+
+/*
+ * Free a central directory.
+ *
+ * @param dir  The central directory.
+ */
+void archive_fini(ARCHIVE_DIR *dir);
+
+/*
+ * Reads an archive from standard input, which must be seekable, and writes
+ * the raw bytes of one member to standard output.
+ *
+ * @param name  Name of the member.
+ * @param nthreads  Threads decoding blocks with sync points.
+ * @return  0 on success, 1 if the archive has no member of that name or an
+ * error occurs.
+ */
+int archive_extract(const char *name, int nthreads);
+
+#endif
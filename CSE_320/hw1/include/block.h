@@ -0,0 +1,416 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "huff.h"
+
+/*
+ * Symbol value used for the END leaf in the code and decode tables.
+ */
+#define END_SYMBOL  (MAX_SYMBOLS - 1)
+
+/*
+ * First byte of a block in canonical format. The first byte of a block in
+ * the format of emit_huffman_tree() is the high byte of the node count,
+ * which is at most 2, so bytes from 0x80 up are free to mark other kinds
+ * of blocks.
+ *
+ * A canonical block transmits only the code length of every symbol:
+ *     1. BLOCK_CANONICAL
+ *     2. Two-byte big-endian mask of the groups of 16 byte values in use,
+ *        MSb first, followed by a two-byte mask of the symbols in use for
+ *        every group in use
+ *     3. The code lengths of the symbols in use, in increasing order with
+ *        END last: the first length in 5 bits, then for every symbol "10"
+ *        to add one, "11" to subtract one and "0" to move to the next
+ *        symbol, zero-padded to a whole byte
+ * Codes are assigned in order of length, then symbol value.
+ */
+#define BLOCK_CANONICAL 0x80
+
+/*
+ * First byte of a stored block, which holds the raw data of a block that
+ * coding would not make smaller:
+ *     1. BLOCK_STORED
+ *     2. Number of raw bytes: four bytes in big-endian order
+ *     3. The raw bytes
+ */
+#define BLOCK_STORED        0x81
+#define STORED_HEADER_SIZE  5
+
+/*
+ * First byte of a block whose data is coded in INTERLEAVE_STREAMS
+ * independent bit streams, so that they can be decoded side by side:
+ *     1. BLOCK_INTERLEAVED
+ *     2. The code lengths, as items 2 and 3 of BLOCK_CANONICAL
+ *     3. Number of raw bytes: four bytes in big-endian order
+ *     4. Jump table: the size of every stream, four bytes in big-endian order
+ *     5. The streams, each zero-padded to a whole byte
+ * Stream i codes raw bytes [i*q, (i+1)*q) with q = ceil(size / 4); the
+ * last streams may be shorter or empty. The streams do not end in END.
+ * INTERLEAVED_HEADER_SIZE counts items 3 and 4.
+ */
+#define BLOCK_INTERLEAVED       0x82
+#define INTERLEAVE_STREAMS      4
+#define INTERLEAVED_HEADER_SIZE (4 + 4*INTERLEAVE_STREAMS)
+
+/*
+ * First byte of a block coded with a static table (see tables.h):
+ *     1. BLOCK_STATIC
+ *     2. Number of the table
+ *     3. The encoded data, as in a canonical block
+ */
+#define BLOCK_STATIC        0x83
+#define STATIC_HEADER_SIZE  2
+
+/*
+ * First byte of a block coded with the code of the previous block that
+ * had one (not a stored, interleaved, run-coded or LZ block):
+ *     1. BLOCK_REPEAT
+ *     2. The encoded data, as in a block of the previous kind
+ * Such a block depends on the blocks before it, so it is only made when
+ * asked for (-u), with blocks coded in order by one thread and without a
+ * block index. The previous code must have a code for every byte value of
+ * the block. So that it does, a block whose code may be repeated also
+ * gives codes to the byte values seen earlier in the stream that it lacks,
+ * each weighing as 1 against the counts of its bytes scaled by
+ * 2^REPEAT_SHIFT.
+ */
+#define BLOCK_REPEAT        0x84
+#define REPEAT_SHIFT        2
+
+/*
+ * First byte of a block whose runs of a repeated byte are coded with run
+ * symbols, which follow END in the alphabet:
+ *     1. BLOCK_RLE
+ *     2. The masks of the byte values in use, as item 2 of BLOCK_CANONICAL,
+ *        followed by a two-byte mask of the run symbols in use
+ *     3. The code lengths, as item 3 of BLOCK_CANONICAL, with the run
+ *        symbols in use after END
+ *     4. The encoded data, as in a canonical block
+ * Run symbol k is followed by k + RUN_MIN_BITS extra bits x and repeats
+ * the previous byte (RUN_MIN << k) + x times. Runs longer than the last
+ * run symbol can code take several run symbols.
+ */
+#define BLOCK_RLE       0x85
+#define RUN_CODES       16
+#define RUN_MIN_BITS    2
+#define RUN_MIN         (1 << RUN_MIN_BITS)
+#define RUN_SYMBOL(k)   (MAX_SYMBOLS + (k))
+#define NUM_SYMBOLS     (MAX_SYMBOLS + RUN_CODES)
+
+/*
+ * First byte of a block coded as literals and matches, found by the LZ77
+ * matcher of lz.h, with separate codes for the literal/length and the
+ * distance alphabets:
+ *     1. BLOCK_LZ
+ *     2. The masks of the byte values and the run symbols in use, as item
+ *        2 of BLOCK_RLE, followed by a two-byte mask of the distance
+ *        symbols in use
+ *     3. The code lengths, as item 3 of BLOCK_RLE, continued with the
+ *        lengths of the distance symbols in use
+ *     4. The encoded data, as in a canonical block
+ * A run symbol codes the length of a match, as in BLOCK_RLE, and is
+ * followed by a distance symbol. Distance symbol d is followed by d extra
+ * bits x and the match copies the bytes (1 << d) + x bytes back.
+ */
+#define BLOCK_LZ        0x86
+#define DIST_CODES      16
+
+/*
+ * First byte of a block whose bytes are coded with the tANS coder of
+ * ans.h instead of a Huffman code:
+ *     1. BLOCK_ANS
+ *     2. Number of raw bytes: four bytes in big-endian order
+ *     3. Size of the bit stream: four bytes in big-endian order
+ *     4. Table log, ANS_MIN_LOG to ANS_MAX_LOG
+ *     5. The masks of the byte values in use, as item 2 of BLOCK_CANONICAL
+ *     6. The normalized counts of the byte values in use, in increasing
+ *        order: every count but the last, which is what remains of
+ *        2^lg, minus one in as many bits as the largest value it can
+ *        take, zero-padded to a whole byte
+ *     7. The bit stream of ans_encode()
+ * ANS_HEADER_SIZE counts items 2 to 4.
+ */
+#define BLOCK_ANS       0x87
+#define ANS_HEADER_SIZE 9
+
+/*
+ * First byte of a block with sync points, which let threads decode parts
+ * of one large block side by side:
+ *     1. BLOCK_SYNC
+ *     2. Interval K of the sync points in raw bytes: four bytes in
+ *        big-endian order
+ *     3. Number of raw bytes: four bytes in big-endian order
+ *     4. Number of bits of the encoded data, END included: four bytes in
+ *        big-endian order
+ *     5. Number n of sync points, (size - 1) / K: four bytes in
+ *        big-endian order
+ *     6. The bit offset in the encoded data of raw bytes K, 2K, ... nK:
+ *        four bytes each in big-endian order
+ *     7. A BLOCK_CANONICAL, BLOCK_STATIC or BLOCK_REPEAT block
+ * Every byte is one symbol in these blocks, so a sync point is where a
+ * codeword starts. SYNC_HEADER_SIZE counts items 2 to 5.
+ */
+#define BLOCK_SYNC          0x88
+#define SYNC_HEADER_SIZE    16
+
+/*
+ * First byte of a block whose code was built from a sample of its bytes,
+ * every SAMPLE_STRIDE-th one, so byte values may lack a code:
+ *     1. BLOCK_SAMPLED
+ *     2. The masks, as item 2 of BLOCK_RLE
+ *     3. The code lengths, as item 3 of BLOCK_RLE
+ *     4. The encoded data, as in a canonical block
+ * Run symbol 0 is the escape: it is followed by the 8 bits of a byte
+ * value without a code. The other run symbols are not used. Only blocks
+ * of at least SAMPLE_MIN_SIZE bytes are sampled. The stride is odd so that
+ * it does not keep landing on the same field of records whose size is a
+ * power of two.
+ */
+#define BLOCK_SAMPLED       0x89
+#define ESCAPE_SYMBOL       RUN_SYMBOL(0)
+#define SAMPLE_STRIDE       7
+#define SAMPLE_MIN_SIZE     16384
+
+/*
+ * Largest block, made by adaptive block sizing (see adapt.h). Blocks of a
+ * fixed size hold at most MAX_BLOCK_SIZE bytes.
+ */
+#define MAX_ADAPTIVE_BLOCK  (4 << 20)
+
+/*
+ * Longest code length that a canonical block can describe.
+ */
+#define MAX_CODE_LEN    31
+
+/*
+ * Huffman code of a symbol. Codes are right-aligned in "bits".
+ */
+typedef struct code {
+    uint32_t bits;      // Code bits
+    unsigned char len;  // Code length
+} CODE;
+
+/*
+ * Growable buffer that a compressed block is written into.
+ */
+typedef struct outbuf {
+    unsigned char *buf; // Buffered bytes
+    size_t len;         // Number of bytes in the buffer
+    size_t cap;         // Allocated size of the buffer
+} OUTBUF;
+
+/*
+ * Input that a compressed block is read from. When the buffer runs out,
+ * "fill" refills it, keeping at least the last 8 bytes that were read so
+ * that a reader may give them back by moving "pos" back. "fill" is NULL
+ * when the whole input is in the buffer.
+ */
+typedef struct inbuf {
+    const unsigned char *buf;       // Buffered bytes
+    size_t pos;                     // Index of the next byte
+    size_t len;                     // Number of bytes in the buffer
+    int (*fill)(struct inbuf *in);  // Refills the buffer: 0 on success, 1 at EOF
+    int eof;                        // Set when a read ran past the end of the input
+} INBUF;
+
+/*
+ * Decode table: one entry for every possible DTAB_BITS-bit peek at the
+ * compressed bit stream. An entry resolves up to two complete codewords,
+ * or, for codes longer than DTAB_BITS, the subtree in which the remaining
+ * bits are walked one at a time.
+ */
+#define DTAB_BITS   11
+#define DTAB_SIZE   (1 << DTAB_BITS)
+#define DTAB_MASK   (DTAB_SIZE - 1)
+
+typedef struct dtab_entry {
+    short sym[2];          // Decoded symbols (END_SYMBOL for END)
+    unsigned char nsym;    // Number of symbols resolved (0: long code)
+    unsigned char nbits;   // Number of bits consumed by the resolved symbols
+    unsigned char len1;    // Length of the first codeword
+    NODE *node;            // Subtree to continue from when nsym is 0, NULL
+                           // to continue with the canonical code lengths
+} DTAB_ENTRY;
+
+/*
+ * Phases of coding a block, timed when the block has a BLOCK_TIMES.
+ */
+#define PHASE_HISTOGRAM 0   // Histogram, runs and matches
+#define PHASE_TREE      1   // Huffman tree and code construction
+#define PHASE_EMIT      2   // Code description
+#define PHASE_ENCODE    3   // Choice of the block type and encoding
+#define PHASE_DECODE    4   // All of the decompression of a block
+#define NUM_PHASES      5
+
+/*
+ * Time spent in every phase, added up over the blocks coded.
+ */
+typedef struct block_times {
+    uint64_t ns[NUM_PHASES];    // Nanoseconds spent in every phase
+    uint64_t mark;              // End of the last phase, in nanoseconds
+} BLOCK_TIMES;
+
+/*
+ * All the state used to compress or decompress one block. Each thread
+ * owns its own BLOCK, so blocks can be coded independently. The BLOCK used
+ * by compress_block() and decompress_block() works on the global arrays
+ * declared in huff.h.
+ */
+typedef struct block {
+    unsigned char *data;        // Raw block data
+    unsigned size;              // Number of bytes in data
+    uint32_t hist[256];         // Number of occurrences of every byte value
+    NODE *nodes;                // Huffman tree, root at index 0
+    int num_nodes;              // Number of nodes in the tree
+    int used_nodes;             // Nodes set since the nodes were last reset
+    NODE **node_for_symbol;     // Leaf node of every symbol in the block
+    NODE *end;                  // END leaf node
+    CODE codes[NUM_SYMBOLS];    // Code of every symbol, END at END_SYMBOL
+    DTAB_ENTRY *dtab;           // Decode table
+    unsigned short lcount[MAX_CODE_LEN+1]; // Number of canonical codes of every length
+    unsigned short loffs[MAX_CODE_LEN+1];  // Index in "sorted" of the first code of every length
+    uint32_t lfirst[MAX_CODE_LEN+1];       // First canonical code of every length
+    short sorted[NUM_SYMBOLS];  // Symbols in canonical code order
+    OUTBUF out;                 // Compressed block, or decompressed data
+    int max_len;                // Longest code length allowed, 0 for no limit
+    int interleave;             // Set to code the data as a BLOCK_INTERLEAVED block
+    int use_static;             // Set to code the data with a static table when smaller
+    int reuse;                  // Set to repeat the previous code when smaller
+    int has_prev;               // Set when the previous code can be repeated
+    unsigned char seen[256];    // Set for the byte values of the stream so far,
+                                // kept with reuse
+    int rle;                    // Set to code runs with run symbols when smaller
+    int runs;                   // Set while the block is coded with run symbols
+    uint32_t rhist[NUM_SYMBOLS]; // Number of occurrences of every symbol
+                                 // when runs are coded
+    uint64_t rbits;             // Number of extra bits of the run symbols,
+                                // and of the distance symbols of matches
+    int lz;                     // Set to code matches when smaller
+    int matches;                // Set while the block is coded with matches
+    uint32_t dhist[DIST_CODES]; // Number of occurrences of every distance symbol
+    CODE dcodes[DIST_CODES];    // Code of every distance symbol
+    unsigned short dcount[MAX_CODE_LEN+1]; // Number of distance codes of every length
+    unsigned short doffs[MAX_CODE_LEN+1];  // Index in "dsorted" of the first code of every length
+    uint32_t dfirst[MAX_CODE_LEN+1];       // First distance code of every length
+    short dsorted[DIST_CODES];  // Distance symbols in canonical code order
+    uint32_t *tokens;           // Literals and matches found by lz_parse()
+    unsigned ntokens;           // Number of tokens
+    unsigned tokens_cap;        // Allocated number of tokens
+    int32_t *head;              // Hash chain heads of the matcher
+    int32_t *chain;             // Hash chain links of the matcher
+    int ans;                    // Set to code the bytes with tANS when smaller
+    unsigned sync_every;        // Interval of the sync points, 0 for none
+    uint32_t *sync;             // Bit offsets of the sync points, when decompressing
+    unsigned nsync;             // Number of sync points
+    unsigned sync_cap;          // Allocated number of sync points
+    uint32_t sync_len;          // Number of raw bytes of a block with sync points
+    uint32_t sync_bits;         // Number of bits of its encoded data
+    int synced;                 // Set while a block with sync points is decoded
+    int threads;                // Threads decoding a block with sync points
+    int sample;                 // Set to build the code of large blocks from a sample
+    int escapes;                // Set while the block is coded with escapes
+    CODE prev[NUM_SYMBOLS];     // Previous code, when compressing
+    OUTBUF payload;             // Streams of an interleaved block read from a
+                                // refilled input
+    BLOCK_TIMES *times;         // Phase times are added here, or NULL
+    size_t desc_len;            // Number of bytes before the encoded data of the
+                                // block compressed last: its header and code
+} BLOCK;
+
+/*
+ * Make room for n more bytes in an output buffer, growing it as needed.
+ *
+ * @param out  The output buffer.
+ * @param n  Number of bytes that will be appended.
+ * @return  0 on success, 1 if memory could not be allocated.
+ */
+int out_reserve(OUTBUF *out, size_t n);
+
+/*
+ * Count the occurrences of every byte value in a buffer.
+ *
+ * @param data  Bytes to count.
+ * @param n  Number of bytes.
+ * @param hist  Set to the number of occurrences of every byte value.
+ */
+void histogram(const unsigned char *data, unsigned n, uint32_t *hist);
+
+/*
+ * Find the lengths of a Huffman code for all the byte values and END.
+ *
+ * @param weight  Weight of every byte value, at least 1. END weighs less
+ * than any of them.
+ * @param limit  Longest code length allowed, 9 to MAX_CODE_LEN.
+ * @param len  Set to the code length of every byte value, then of END.
+ * @return  0 on success, 1 if memory could not be allocated.
+ */
+int code_lengths(const uint32_t *weight, int limit, unsigned char *len);
+
+/*
+ * Allocate a new BLOCK with room for MAX_BLOCK_SIZE bytes of data.
+ *
+ * @return  the new BLOCK, or NULL if memory could not be allocated.
+ */
+BLOCK *block_init();
+
+/*
+ * Free a BLOCK allocated by block_init().
+ *
+ * @param b  The BLOCK to be freed, which must not be referenced again.
+ */
+void block_fini(BLOCK *b);
+
+/*
+ * Compress the data of a block.
+ *
+ * The Huffman tree description, in the format of emit_huffman_tree() or
+ * as canonical code lengths, whichever is shorter, followed by the encoded
+ * data replaces the contents of b->out, or, when b->interleave is set, the
+ * code lengths followed by the interleaved streams. When b->use_static is
+ * set and a static table codes the block in fewer bytes, it is used
+ * instead, and when b->reuse is set, so is the code of the previous block
+ * compressed with b. When b->rle is set and b->interleave is not, runs
+ * are coded with run symbols (see BLOCK_RLE) if that is estimated to be
+ * smaller, and when b->lz is set, so are the matches of the LZ77 matcher
+ * (see BLOCK_LZ), whichever is the smallest. When b->ans is set and
+ * b->interleave is not, the bytes are coded with tANS (see BLOCK_ANS) if
+ * that is smaller than the Huffman code. When b->sync_every is set, codes
+ * are described by their lengths and a block of more than b->sync_every
+ * bytes coded one symbol per byte records sync points (see BLOCK_SYNC).
+ * When b->sample is set and none of b->interleave, b->rle, b->lz, b->ans
+ * and b->sync_every is, the code of a large block is built from a sample
+ * of its bytes (see BLOCK_SAMPLED).
+ * A block that coding would not make smaller is stored. When the Huffman
+ * tree is deeper than b->max_len, or than MAX_CODE_LEN when b->max_len is
+ * not set, the code lengths are limited and the canonical description is
+ * used. When b->times is set, the time spent in every phase is added to it.
+ * b->desc_len is set to the number of bytes of the header and the code
+ * description of the block.
+ *
+ * @param b  The block, with b->data, b->size (up to MAX_ADAPTIVE_BLOCK),
+ * b->max_len, b->interleave, b->use_static, b->reuse, b->rle, b->lz,
+ * b->ans, b->sync_every and b->sample set.
+ * @return  0 on success, 1 if memory could not be allocated.
+ */
+int compress_data(BLOCK *b);
+
+/*
+ * Decompress one block.
+ *
+ * The block, in the format produced by compress_block(), is read from
+ * "in" and the decompressed data replaces the contents of b->out. Bytes
+ * following the block are left unread. A BLOCK_REPEAT block is decoded
+ * with the code of the previous block decompressed with b. A block with
+ * sync points is decoded by up to b->threads threads. When b->times is
+ * set, the time spent is added to its PHASE_DECODE.
+ *
+ * @param b  The block state.
+ * @param in  The input, positioned at the start of the block.
+ * @return  0 on success, 1 if the block is invalid or truncated.
+ */
+int decompress_data(BLOCK *b, INBUF *in);
+
+#endif
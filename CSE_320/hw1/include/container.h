@@ -0,0 +1,127 @@
+#ifndef CONTAINER_H
+#define CONTAINER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * A compressed stream may end in a block index trailer, which records
+ * where every compressed block starts and how many raw bytes it holds:
+ *     1. Marker byte INDEX_MARKER
+ *     2. Number of blocks: four bytes in big-endian order
+ *     3. For every block: offset of the compressed block from the start of
+ *        the stream (eight bytes) and raw length (four bytes), big-endian
+ *     4. Offset of the marker from the start of the stream (eight bytes)
+ *     5. The four bytes of INDEX_MAGIC
+ * Blocks with a tree description start with the high byte of the node
+ * count, which is never more than 2, so the marker cannot be mistaken for
+ * a block.
+ */
+#define INDEX_MARKER        0xFF
+#define INDEX_MAGIC         "HUFX"
+#define INDEX_HEADER_SIZE   5
+#define INDEX_ENTRY_SIZE    12
+#define INDEX_FOOTER_SIZE   12
+
+/*
+ * Location of one block.
+ */
+typedef struct index_entry {
+    uint64_t offset;        // Offset of the compressed block in the stream
+    uint64_t raw_offset;    // Offset of the block's data in the raw data
+    uint32_t raw_len;       // Number of raw bytes in the block
+} INDEX_ENTRY;
+
+/*
+ * Block index of a compressed stream.
+ */
+typedef struct block_index {
+    INDEX_ENTRY *entries;   // One entry per block, in stream order
+    size_t count;           // Number of blocks
+    size_t cap;             // Allocated number of entries
+    uint64_t end;           // Offset of the end of the last block
+    uint64_t raw_size;      // Total number of raw bytes
+    off_t base;             // File offset of the start of the stream
+} BLOCK_INDEX;
+
+/*
+ * Append a block to a block index. The block follows the previous one
+ * in the stream.
+ *
+ * @param idx  The block index.
+ * @param raw_len  Number of raw bytes in the block.
+ * @param comp_len  Number of bytes in the compressed block.
+ * @return  0 on success, 1 if memory could not be allocated.
+ */
+int index_add(BLOCK_INDEX *idx, uint32_t raw_len, size_t comp_len);
+
+/*
+ * Get the size of the trailer describing a block index.
+ *
+ * @param idx  The block index.
+ * @return  the number of bytes in the trailer.
+ */
+size_t index_size(BLOCK_INDEX *idx);
+
+/*
+ * Store the trailer describing a block index in a buffer.
+ *
+ * @param idx  The block index of the blocks written so far.
+ * @param buf  Buffer of at least index_size(idx) bytes.
+ */
+void index_encode(BLOCK_INDEX *idx, unsigned char *buf);
+
+/*
+ * Write the trailer describing a block index to standard output.
+ *
+ * @param idx  The block index of the blocks written so far.
+ * @return  0 on success, 1 on error.
+ */
+int index_write(BLOCK_INDEX *idx);
+
+/*
+ * Read the block index of a compressed stream from a seekable file.
+ * The stream starts at the current offset of the file and ends at the
+ * end of the file. The offset of the file is not changed.
+ *
+ * @param fd  The file descriptor.
+ * @param idx  Set to the block index.
+ * @return  0 on success, 1 if the file is not seekable or does not end
+ * in a valid block index.
+ */
+int index_read(int fd, BLOCK_INDEX *idx);
+
+/*
+ * Find the block holding a raw byte.
+ *
+ * @param idx  The block index.
+ * @param raw_offset  Offset of the byte in the raw data, less than
+ * idx->raw_size.
+ * @return  the number of the block holding the byte.
+ */
+size_t index_find(BLOCK_INDEX *idx, uint64_t raw_offset);
+
+/*
+ * Read the compressed bytes of one block of a stream whose block index
+ * was read by index_read().
+ *
+ * @param idx  The block index.
+ * @param fd  The file descriptor the block index was read from.
+ * @param i  Number of the block.
+ * @param buf  Buffer for the compressed bytes, grown with realloc() as needed.
+ * @param cap  Allocated size of *buf.
+ * @param len  Set to the number of compressed bytes.
+ * @return  0 on success, 1 on error.
+ */
+int index_read_block(BLOCK_INDEX *idx, int fd, size_t i, unsigned char **buf,
+                     size_t *cap, size_t *len);
+
+/*
+ * Free the entries of a block index.
+ *
+ * @param idx  The block index.
+ */
+void index_fini(BLOCK_INDEX *idx);
+
+#endif
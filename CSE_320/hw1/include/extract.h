@@ -0,0 +1,34 @@
+#ifndef EXTRACT_H
+#define EXTRACT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "container.h"
+
+/*
+ * Decompress a range of the raw data of a compressed stream with a block
+ * index, decoding only the blocks that overlap the range.
+ *
+ * @param fd  The seekable file the block index was read from.
+ * @param idx  The block index, read by index_read().
+ * @param offset  Offset of the first raw byte of the range.
+ * @param len  Number of raw bytes in the range.
+ * @param dst  Buffer of at least len bytes receiving the raw bytes.
+ * @return  the number of bytes stored in dst, which is less than len when
+ * the range extends past the end of the raw data, or -1 on error.
+ */
+ssize_t extract_range(int fd, BLOCK_INDEX *idx, uint64_t offset, size_t len,
+                      unsigned char *dst);
+
+/*
+ * Reads a compressed stream with a block index from standard input and
+ * writes the raw bytes [offset, offset+len) to standard output.
+ *
+ * @param offset  Offset of the first raw byte of the range.
+ * @param len  Number of raw bytes in the range.
+ * @return  0 on success, 1 if standard input is not a seekable stream
+ * with a block index or an error occurs.
+ */
+int extract(uint64_t offset, uint64_t len);
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef HUFF_CTX_H
+#define HUFF_CTX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "huff.h"
+
+/*
+ * Reentrant compression library. All the state of a stream is kept in its
+ * HUFF_CTX, so any number of streams may be compressed or decompressed at
+ * once, each by one thread at a time. The compressed format is the one
+ * produced by compress().
+ */
+
+/*
+ * Direction of a context.
+ */
+#define HUFF_COMPRESS   0
+#define HUFF_DECOMPRESS 1
+
+/*
+ * Block size used when none is given.
+ */
+#define HUFF_DEFAULT_BLOCK_SIZE MAX_BLOCK_SIZE
+
+/*
+ * Statistics of one block, passed to the "stats" hook of HUFF_PARAMS
+ * after the block is coded.
+ */
+typedef struct huff_stats {
+    unsigned long block;    // Number of the block in the stream, from 0
+    int mode;               // HUFF_COMPRESS or HUFF_DECOMPRESS
+    int type;               // First byte of the block, after any sync points
+                            // (see block.h)
+    unsigned sync_points;   // Number of sync points of the block
+    size_t raw_size;        // Number of raw bytes
+    size_t comp_size;       // Number of compressed bytes
+    int symbols;            // Number of distinct byte values
+    double entropy;         // Shannon entropy of the raw bytes, in bits per byte
+    double bits_per_symbol; // Compressed bits per raw byte
+    int max_code_len;       // Longest code, 0 for blocks without a Huffman
+                            // code (compression only)
+    size_t desc_size;       // Bytes of the header and code description
+                            // (compression only)
+    uint64_t hist_ns;       // Nanoseconds spent on the histogram, runs and matches,
+    uint64_t tree_ns;       // building the Huffman tree and code,
+    uint64_t emit_ns;       // emitting the code description,
+    uint64_t encode_ns;     // encoding (and choosing the block type)
+    uint64_t decode_ns;     // and decoding
+} HUFF_STATS;
+
+typedef void (*HUFF_STATS_FN)(const HUFF_STATS *st, void *arg);
+
+/*
+ * Compression parameters. A zero field selects the default.
+ */
+typedef struct huff_params {
+    unsigned block_size;    // Block size, MIN_BLOCK_SIZE to MAX_BLOCK_SIZE
+    int adaptive;           // Set to size blocks adaptively, block_size being
+                            // the window size (see adapt.h)
+    int max_code_len;       // Code length limit, MIN_CODE_LIMIT to MAX_CODE_LEN
+    int interleave;         // Set to code blocks as BLOCK_INTERLEAVED blocks
+                            // (not with rle, lz, ans, sample, reuse or sync_every)
+    int use_static;         // Set to code blocks with static tables where smaller
+    int rle;                // Set to code runs with run symbols where smaller
+    int lz;                 // Set to code LZ77 matches where smaller
+    int ans;                // Set to code blocks with tANS where smaller
+    unsigned sync_every;    // Interval of the sync points in bytes, MIN_SYNC_EVERY
+                            // to MAX_SYNC_EVERY, 0 for none (not with interleave)
+    int sample;             // Set to build the code of large blocks from a sample
+                            // (not with interleave, rle, lz, ans or sync_every)
+    int threads;            // Threads decoding a block with sync points
+    int index;              // Set to append a block index
+    int reuse;              // Set to repeat the code of the previous block
+                            // where smaller (not with interleave or index)
+    HUFF_STATS_FN stats;    // Called with the statistics of every block, or
+                            // NULL; blocks are timed only when it is set
+    void *stats_arg;        // Passed to stats
+} HUFF_PARAMS;
+
+typedef struct huff_ctx HUFF_CTX;
+
+/*
+ * Create a context.
+ *
+ * @param mode  HUFF_COMPRESS or HUFF_DECOMPRESS.
+ * @param params  Compression parameters, or NULL for the defaults. Only
+ * "threads", "stats" and "stats_arg" are used when decompressing.
+ * @return  the new context, or NULL if the parameters are invalid (out of
+ * range, or combined with others that they do not go with, as noted in
+ * HUFF_PARAMS) or memory could not be allocated.
+ */
+HUFF_CTX *huff_ctx_init(int mode, const HUFF_PARAMS *params);
+
+/*
+ * Free a context, which must not be used again.
+ *
+ * @param ctx  The context.
+ */
+void huff_ctx_fini(HUFF_CTX *ctx);
+
+/*
+ * Discard the state of the current stream so that the context can start
+ * a new one with the same parameters.
+ *
+ * @param ctx  The context.
+ */
+void huff_ctx_reset(HUFF_CTX *ctx);
+
+/*
+ * Feed input to a context.
+ *
+ * Input is consumed only while no output is waiting to be pulled, and at
+ * most up to the end of the first block that completes, so output never
+ * piles up. Compressed input is decoded in place when a whole block is
+ * passed in; otherwise it is buffered until the block is complete.
+ *
+ * @param ctx  The context.
+ * @param in  Input bytes.
+ * @param n  Number of input bytes.
+ * @return  the number of bytes consumed, which may be 0 while output is
+ * waiting, or -1 if the input is invalid or memory could not be allocated.
+ */
+ssize_t huff_push(HUFF_CTX *ctx, const unsigned char *in, size_t n);
+
+/*
+ * Compress the input buffered by a compression context now, as short
+ * blocks, instead of waiting for full blocks. They are then available to
+ * huff_pull(), after any output already waiting.
+ *
+ * @param ctx  A compression context.
+ * @return  0 on success, 1 if the context is not compressing or memory
+ * could not be allocated.
+ */
+int huff_flush(HUFF_CTX *ctx);
+
+/*
+ * Signal the end of the input of a context. The last block is then
+ * available to huff_pull().
+ *
+ * @param ctx  The context.
+ * @return  0 on success, 1 if the input ends in the middle of a block or
+ * memory could not be allocated.
+ */
+int huff_finish(HUFF_CTX *ctx);
+
+/*
+ * Take output from a context.
+ *
+ * @param ctx  The context.
+ * @param out  Buffer receiving the output.
+ * @param cap  Size of the buffer.
+ * @return  the number of bytes stored, 0 when no output is waiting, or -1
+ * if an error occurred since the last output.
+ */
+ssize_t huff_pull(HUFF_CTX *ctx, unsigned char *out, size_t cap);
+
+/*
+ * Get the largest compressed size of n bytes.
+ *
+ * @param ctx  A compression context.
+ * @param n  Number of raw bytes.
+ * @return  the bound.
+ */
+size_t huff_compress_bound(HUFF_CTX *ctx, size_t n);
+
+/*
+ * Compress a buffer as a complete stream. The context is reset first.
+ *
+ * @param ctx  A compression context.
+ * @param in  Raw bytes.
+ * @param n  Number of raw bytes.
+ * @param out  Buffer receiving the compressed stream.
+ * @param cap  Size of the buffer; huff_compress_bound() bytes always suffice.
+ * @return  the size of the compressed stream, or -1 on error or if it
+ * does not fit.
+ */
+ssize_t huff_compress_buf(HUFF_CTX *ctx, const unsigned char *in, size_t n,
+                          unsigned char *out, size_t cap);
+
+/*
+ * Decompress a complete stream held in a buffer. The context is reset first.
+ *
+ * @param ctx  A decompression context.
+ * @param in  Compressed stream.
+ * @param n  Size of the compressed stream.
+ * @param out  Buffer receiving the raw bytes.
+ * @param cap  Size of the buffer.
+ * @return  the number of raw bytes, or -1 if the stream is invalid or
+ * does not fit.
+ */
+ssize_t huff_decompress_buf(HUFF_CTX *ctx, const unsigned char *in, size_t n,
+                            unsigned char *out, size_t cap);
+
+#endif
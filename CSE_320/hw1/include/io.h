@@ -0,0 +1,85 @@
+#ifndef IO_H
+#define IO_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "block.h"
+
+/*
+ * Size of the chunks in which standard input is read when it cannot be
+ * mapped, and of the buffer that output is collected in.
+ */
+#define IO_BUF_SIZE     (1 << 20)
+
+/*
+ * Get the INBUF reading standard input.
+ *
+ * On the first call, standard input is mapped into memory when it is a
+ * regular file, and is otherwise set up to be read in chunks of
+ * IO_BUF_SIZE bytes.
+ *
+ * @return  the INBUF of standard input.
+ */
+INBUF *io_stdin();
+
+/*
+ * Read bytes from standard input.
+ *
+ * @param dst  Buffer receiving the bytes.
+ * @param n  Number of bytes to read.
+ * @return  the number of bytes read, less than n only at EOF or on error.
+ */
+size_t io_read(unsigned char *dst, size_t n);
+
+/*
+ * Write bytes to standard output through the output buffer.
+ *
+ * @param buf  Bytes to write.
+ * @param n  Number of bytes.
+ * @return  0 on success, 1 on error.
+ */
+int io_write(const unsigned char *buf, size_t n);
+
+/*
+ * Write the contents of the output buffer to standard output.
+ *
+ * @return  0 on success, 1 on error.
+ */
+int io_flush();
+
+/*
+ * Check whether reading standard input or writing standard output failed.
+ *
+ * @return  1 if an error occurred, 0 otherwise.
+ */
+int io_error();
+
+/*
+ * Release standard input, leaving its file offset after the bytes that
+ * were used.
+ */
+void io_close();
+
+/*
+ * Write all of a buffer to a file, at an offset if one is given.
+ *
+ * @param fd  File descriptor.
+ * @param buf  Bytes to write.
+ * @param n  Number of bytes.
+ * @param offset  Offset to write at, or -1 to write at the current offset.
+ * @return  0 on success, 1 on error.
+ */
+int write_full(int fd, const unsigned char *buf, size_t n, off_t offset);
+
+/*
+ * Read bytes from a file at an offset, failing at the end of the file.
+ *
+ * @param fd  File descriptor.
+ * @param buf  Buffer receiving the bytes.
+ * @param n  Number of bytes.
+ * @param offset  Offset to read at.
+ * @return  0 on success, 1 on error or if the file ends first.
+ */
+int read_full(int fd, unsigned char *buf, size_t n, off_t offset);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdint.h>
+#include "block.h"
+
+/*
+ * LZ77 matcher. The data of a block is parsed greedily into literals and
+ * matches, which repeat bytes found earlier in the same block, so blocks
+ * stay independent. Candidates are found with hash chains of the
+ * positions whose next LZ_MIN_MATCH bytes hash alike; at most
+ * LZ_MAX_CHAIN of them are tried at every position, which bounds the time
+ * spent on highly repetitive data.
+ */
+#define LZ_MIN_MATCH    RUN_MIN
+#define LZ_MAX_MATCH    258
+#define LZ_WINDOW       (1 << 16)   // Distances are less than LZ_WINDOW
+#define LZ_HASH_BITS    15
+#define LZ_MAX_CHAIN    32
+
+/*
+ * A token is a literal byte value, or a match of LZ_MATCH_LEN(t) bytes
+ * LZ_MATCH_DIST(t) bytes back.
+ */
+#define LZ_MATCH(len, dist) (((uint32_t)(len) << 16) | (dist))
+#define LZ_IS_MATCH(t)      ((t) > 0xFF)
+#define LZ_MATCH_LEN(t)     ((t) >> 16)
+#define LZ_MATCH_DIST(t)    ((t) & 0xFFFF)
+
+/*
+ * Parse the data of a block into tokens.
+ *
+ * @param b  The block, with b->data and b->size set.
+ * @return  0 on success, with the tokens in b->tokens and their number in
+ * b->ntokens, 1 if memory could not be allocated.
+ */
+int lz_parse(BLOCK *b);
+
+#endif
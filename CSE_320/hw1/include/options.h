@@ -0,0 +1,178 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+/*
+ * Layout of global_options, set by validargs().
+ *     bit 0      -h
+ *     bit 1      -c
+ *     bit 2      -d
+ *     bit 3      -i
+ *     bit 4      -r (range in global_range_offset and global_range_len)
+ *     bit 5      -a
+ *     bit 6      -m
+ *     bit 7      -t
+ *     (-s and -k are kept in global_use_static and global_table_path)
+ *     (-e, -z, -f and -q are kept in global_rle, global_lz, global_ans
+ *     and global_sample)
+ *     (-l is kept in global_max_code_len, -y in global_sync_every,
+ *     -w in global_flush_ms, -p in global_archive, -x in global_member,
+ *     -v in global_stats_path, -u in global_reuse)
+ *     bits 8-15  Number of threads given with -j (0 if not given)
+ *     bits 16-31 Block size minus one
+ */
+#define G_OP_H  0
+#define G_OP_C  1
+#define G_OP_D  2
+#define G_OP_I  3
+#define G_OP_R  4
+#define G_OP_A  5
+#define G_OP_M  6
+#define G_OP_T  7
+#define G_OP_J  8
+#define G_OP_BS 16
+
+#define G_OP_J_MASK 0xFF
+
+/*
+ * Range of the thread count accepted by -j.
+ */
+#define MIN_THREADS 1
+#define MAX_THREADS 255
+
+/*
+ * Smallest code length limit accepted by -l: 2^9 codes are needed for
+ * all 256 byte values and END. The largest is MAX_CODE_LEN.
+ */
+#define MIN_CODE_LIMIT  9
+
+/*
+ * Range of the sync point interval accepted by -y: from the smallest block
+ * to the largest adaptive block (MAX_ADAPTIVE_BLOCK).
+ */
+#define MIN_SYNC_EVERY  1024
+#define MAX_SYNC_EVERY  (4 << 20)
+
+/*
+ * Range of the idle timeout in milliseconds accepted by -w.
+ */
+#define MIN_FLUSH_MS    1
+#define MAX_FLUSH_MS    3600000
+
+/*
+ * Code length limit given with -l, set by validargs(). 0 if not given.
+ */
+extern int global_max_code_len;
+
+/*
+ * Sync point interval given with -y, set by validargs(). 0 if not given.
+ */
+extern unsigned global_sync_every;
+
+/*
+ * Idle timeout given with -w, set by validargs(). 0 if not given.
+ */
+extern int global_flush_ms;
+
+/*
+ * Set by validargs() when -s is given, or -k with -c.
+ */
+extern int global_use_static;
+
+/*
+ * Table file given with -k, set by validargs(). NULL if not given.
+ */
+extern const char *global_table_path;
+
+/*
+ * Set by validargs() when -e, -z, -f and -q are given.
+ */
+extern int global_rle;
+extern int global_lz;
+extern int global_ans;
+extern int global_sample;
+
+/*
+ * Set by validargs() when -u is given.
+ */
+extern int global_reuse;
+
+/*
+ * Set by validargs() when -p is given.
+ */
+extern int global_archive;
+
+/*
+ * Archive member given with -x, set by validargs(). NULL if not given.
+ */
+extern const char *global_member;
+
+/*
+ * Statistics file given with -v or --stats, set by validargs(). NULL if
+ * not given.
+ */
+extern const char *global_stats_path;
+
+/*
+ * Range of raw bytes given with -r, set by validargs().
+ */
+extern uint64_t global_range_offset;
+extern uint64_t global_range_len;
+
+#define HUFF_USAGE(program_name, retcode) do{ \
+fprintf(stderr, "USAGE: %s %s\n", program_name, \
+"[-h] -c|-d|-t [-b BLOCKSIZE] [-a] [-m] [-s] [-k TABLE] [-e] [-z] [-f]\n" \
+"       [-q] [-j THREADS] [-i] [-l MAXLEN] [-y INTERVAL] [-w TIMEOUT]\n" \
+"       [-r OFFSET:LENGTH] [-p] [-x NAME] [-v FILE] [-u]\n" \
+"    -h       Help: displays this help menu.\n" \
+"    -c       Compress: read raw data, output compressed data\n" \
+"    -d       Decompress: read compressed data, output raw data\n" \
+"    -t       Train: read sample data, output a code table file for -k\n" \
+"    -b       For compression, specify blocksize in bytes (range [1024, 65536])\n" \
+"    -a       For compression, size blocks adaptively: blocks of BLOCKSIZE bytes are\n" \
+"             merged while their statistics agree, up to 4 MiB per block\n" \
+"    -m       For compression, code every block as 4 interleaved streams, which\n" \
+"             decompress faster\n" \
+"    -s       For compression, code blocks with a built-in table where smaller\n" \
+"             (text, GEDCOM or binary)\n" \
+"    -k       Load the code table file TABLE, made with -t. For compression,\n" \
+"             blocks are also coded with it where smaller (implies -s)\n" \
+"    -e       For compression, code runs of a repeated byte as (byte, length)\n" \
+"             pairs where smaller (not with -m)\n" \
+"    -z       For compression, code repeated strings as LZ77 matches where smaller,\n" \
+"             which also codes runs (slower; not with -m)\n" \
+"    -f       For compression, code blocks with tANS instead of a Huffman code\n" \
+"             where smaller (not with -m)\n" \
+"    -q       For compression, build the code of blocks of 16 KiB or more from\n" \
+"             every 7th byte, escaping the byte values it misses (faster; not\n" \
+"             with -m, -e, -z, -f or -y)\n" \
+"    -j       Number of threads compressing or decompressing blocks (range [1, 255])\n" \
+"    -i       For compression, append a block index used by -d -j and -d -r\n" \
+"    -u       For compression, repeat the code of the previous block where smaller;\n" \
+"             codes also cover the byte values seen earlier, so that they can be\n" \
+"             repeated (one thread, so the output differs from -j; not with -m or -i)\n" \
+"    -l       For compression, limit codes to MAXLEN bits (range [9, 31])\n" \
+"    -y       For compression, record a sync point every INTERVAL bytes of a block\n" \
+"             (range [1024, 4194304]), from which -d -j decodes parts of one\n" \
+"             block in parallel; run-coded (-e), LZ (-z) and tANS (-f) blocks get\n" \
+"             none (not with -m)\n" \
+"    -w       For compression, stream: compress the input as it arrives, and cut a\n" \
+"             block short when no input arrives for TIMEOUT milliseconds (range\n" \
+"             [1, 3600000]; one thread)\n" \
+"    -r       For decompression, output only LENGTH raw bytes starting at OFFSET,\n" \
+"             decoding only the blocks holding them (needs a block index)\n" \
+"    -p       For compression, read file names, one per line, and output an archive\n" \
+"             with every file compressed as its own member, by -j threads at once\n" \
+"             (not with -w)\n" \
+"    -x       For decompression, output only the member NAME of an archive made\n" \
+"             with -p, reading no other member (needs a seekable input)\n" \
+"    -v       Also --stats. Write statistics of every block to FILE (\"-\" for\n" \
+"             standard error) as JSON lines: sizes, entropy, code lengths and\n" \
+"             phase times (not with -j above 1, -p, -x or -r)\n"); \
+exit(retcode); \
+} while(0)
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "container.h"
+
+/*
+ * Reads raw data from standard input and writes compressed data to
+ * standard output, compressing blocks in parallel.
+ *
+ * Blocks are read in the same way as compress_block() reads them and each
+ * is compressed by one of nthreads worker threads. The compressed blocks
+ * are written in input order, so the output is identical to the output
+ * of compress().
+ *
+ * @param nthreads  Number of worker threads.
+ * @param idx  If not NULL, every block written is added to this index.
+ * @return  0 if compression completes without error, 1 if an error occurs.
+ */
+int compress_parallel(int nthreads, BLOCK_INDEX *idx);
+
+/*
+ * Decompresses a seekable compressed input in parallel using its block
+ * index, writing the decompressed data to standard output.
+ *
+ * Every block is decompressed independently by one of nthreads worker
+ * threads. When standard output is a regular file, each block is written
+ * at its own offset with pwrite(); otherwise the blocks are written in
+ * order as they become ready.
+ *
+ * @param nthreads  Number of worker threads.
+ * @param idx  Block index read from standard input by index_read().
+ * @return  0 if decompression completes without error, 1 if an error occurs.
+ */
+int decompress_parallel(int nthreads, BLOCK_INDEX *idx);
+
+#endif
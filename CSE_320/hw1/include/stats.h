@@ -0,0 +1,34 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "huff_ctx.h"
+
+/*
+ * With -v, the statistics of every block are written to the statistics
+ * file as one JSON object per line:
+ *     {"block": N, "mode": "compress"|"decompress", "type": TYPE,
+ *      "sync_points": N, "raw_size": BYTES, "compressed_size": BYTES,
+ *      "symbols": N, "entropy": BITS, "bits_per_symbol": BITS,
+ *      "max_code_len": BITS, "desc_size": BYTES,
+ *      "phase_ns": {"histogram": NS, "tree_build": NS, "tree_emit": NS,
+ *                   "encode": NS, "decode": NS}}
+ */
+
+/*
+ * Set the stats hook of the parameters of a context when -v is given,
+ * opening the statistics file, or using standard error when it is "-".
+ *
+ * @param params  The parameters.
+ * @return  0 on success, 1 if the statistics file cannot be opened.
+ */
+int stats_open(HUFF_PARAMS *params);
+
+/*
+ * Close the statistics file opened by stats_open().
+ *
+ * @param params  The parameters.
+ * @return  0 on success, 1 if writing the statistics failed.
+ */
+int stats_close(HUFF_PARAMS *params);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "huff_ctx.h"
+
+/*
+ * Run standard input through a context to standard output, then finish
+ * the context and close standard input.
+ *
+ * @param ctx  The context, compressing or decompressing.
+ * @return  0 on success, 1 on error.
+ */
+int run_ctx(HUFF_CTX *ctx);
+
+/*
+ * Compress standard input as it arrives, cutting a block short when no
+ * input arrives for a while (-w).
+ *
+ * Standard input is made non-blocking and waited on with poll(). Whenever
+ * some input is buffered in the context and none arrives for "timeout"
+ * milliseconds, the context is flushed. Output is written out as soon as
+ * it is made, so the delay of a byte is bounded by the timeout and the
+ * time to fill a block.
+ *
+ * @param ctx  A compression context.
+ * @param timeout  Idle timeout in milliseconds.
+ * @return  0 on success, 1 on error.
+ */
+int run_stream(HUFF_CTX *ctx, int timeout);
+
+#endif
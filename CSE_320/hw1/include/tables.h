@@ -0,0 +1,56 @@
+#ifndef TABLES_H
+#define TABLES_H
+
+#include "block.h"
+
+/*
+ * Static code tables. A block coded with a static table names the table
+ * instead of describing its code (see BLOCK_STATIC), which makes coding
+ * worthwhile for messages of a few hundred bytes. A table is the code
+ * length of every byte value and END, all of them in use, at most
+ * TABLE_MAX_LEN bits; codes are canonical, as in BLOCK_CANONICAL.
+ */
+#define TABLE_TEXT      0   // ASCII text
+#define TABLE_GEDCOM    1   // GEDCOM genealogy records
+#define TABLE_BINARY    2   // Machine code and binary structures
+#define TABLE_CUSTOM    3   // Table loaded with table_load()
+#define NUM_TABLES      4
+
+#define TABLE_MAX_LEN   15
+
+/*
+ * A table file, written by train() and read by table_load():
+ *     1. The four bytes of TABLE_MAGIC
+ *     2. The code length of every byte value, then of END: one byte each
+ */
+#define TABLE_MAGIC     "HUFT"
+#define TABLE_FILE_SIZE (4 + MAX_SYMBOLS)
+
+/*
+ * Get the code lengths of a static table.
+ *
+ * @param id  Table number, as found in a BLOCK_STATIC block.
+ * @return  the MAX_SYMBOLS code lengths of the table, or NULL if there is
+ * no such table or the custom table has not been loaded.
+ */
+const unsigned char *table_lengths(int id);
+
+/*
+ * Load the custom table (TABLE_CUSTOM) from a table file.
+ *
+ * @param path  Path of the table file.
+ * @return  0 on success, 1 if the file cannot be read or is not a valid
+ * table file.
+ */
+int table_load(const char *path);
+
+/*
+ * Reads a sample of data from standard input and writes a table file
+ * for it to standard output. Every byte value gets a code, even when the
+ * sample does not hold it.
+ *
+ * @return  0 on success, 1 if an error occurs.
+ */
+int train();
+
+#endif
@@ -0,0 +1,69 @@
+#include <math.h>
+#include "const.h"
+#include "block.h"
+#include "adapt.h"
+#include "debug.h"
+
+#define BYTE    8
+
+/*
+ * Estimated size in bytes of the code description of a block, for every
+ * symbol in use and for the block as a whole.
+ */
+#define DESC_PER_SYMBOL 0.5
+#define DESC_BASE       8
+
+/*
+ * @brief Estimates the compressed size of data from its histogram.
+ * @details The entropy of the histogram plus the estimated size of the
+ * code description.
+ *
+ * @param hist Number of occurrences of every byte value
+ * @param n Number of bytes counted in hist
+ * @return Estimated number of bytes
+*/
+static double
+block_cost(const uint32_t *hist, size_t n) {
+    double bits = 0;    // Entropy in bits
+    int nsym = 0;       // Number of symbols in use
+
+    for(int s = 0; s < 256; ++s) {
+        uint32_t c = *(hist+s);
+        if(!c) continue;
+        bits += c * log2((double)n / c);
+        nsym++;
+    }
+
+    return bits / BYTE + nsym * DESC_PER_SYMBOL + DESC_BASE;
+}
+
+/*
+ * Find the length of the block starting at the beginning of a buffer.
+ */
+size_t
+adapt_split(const unsigned char *data, size_t n, size_t window, int final) {
+    uint32_t acc[256];  // Histogram of the block so far
+    uint32_t win[256];  // Histogram of the next window
+    uint32_t sum[256];  // Histogram of both
+    size_t len;         // Length of the block so far
+
+    if(n < window) return final ? n : 0;
+
+    histogram(data, window, acc);
+    for(len = window; len + window <= MAX_ADAPTIVE_BLOCK; len += window) {
+        size_t w = window;
+        if(n - len < w) {
+            if(!final || n == len) return final ? len : 0;
+            w = n - len;
+        }
+
+        /* Take the window in if that is no larger than coding it apart */
+        histogram(data+len, w, win);
+        for(int s = 0; s < 256; ++s) *(sum+s) = *(acc+s) + *(win+s);
+        if(block_cost(sum, len+w) > block_cost(acc, len) + block_cost(win, w)) break;
+        for(int s = 0; s < 256; ++s) *(acc+s) = *(sum+s);
+        if(w < window) return len + w;
+    }
+
+    return len;
+}
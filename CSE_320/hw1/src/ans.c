@@ -0,0 +1,204 @@
+#include <math.h>
+#include "const.h"
+#include "ans.h"
+#include "debug.h"
+
+#define BYTE    8
+
+/*
+ * @brief Finds the highest bit set in a value.
+ *
+ * @param v The value, at least 1
+ * @return Number of the bit, 0 for the lowest
+*/
+static inline int
+highbit(uint32_t v) {
+    return 31 - __builtin_clz(v);
+}
+
+/*
+ * @brief Spreads the byte values over the states of a table, every byte
+ * value over as many states as its count, far apart from each other.
+ *
+ * @param norm Normalized count of every byte value
+ * @param lg Table log
+ * @param spread Set to the byte value of every state
+*/
+static void
+spread_symbols(const uint16_t *norm, int lg, unsigned char *spread) {
+    const uint32_t mask = (1u << lg) - 1;
+    const uint32_t step = (1u << lg >> 1) + (1u << lg >> 3) + 3;  // Odd, so every state is visited
+    uint32_t pos = 0;
+
+    for(int s = 0; s < 256; ++s) {
+        for(int i = 0; i < *(norm+s); ++i) {
+            *(spread+pos) = s;
+            pos = (pos + step) & mask;
+        }
+    }
+}
+
+/*
+ * Choose the table log for a block.
+ */
+int
+ans_table_log(unsigned size, int nsym) {
+    int lg = ANS_MAX_LOG;
+    int fit = size > 1 ? highbit(size-1) - 2 : 0;   // Smaller tables for small blocks
+    int least = highbit(nsym) + 2;                  // Room for every byte value in use
+
+    if(fit < lg) lg = fit;
+    if(least > lg) lg = least;
+    if(lg < ANS_MIN_LOG) lg = ANS_MIN_LOG;
+
+    return lg > ANS_MAX_LOG ? ANS_MAX_LOG : lg;
+}
+
+/*
+ * Normalize a histogram to counts out of 2^lg.
+ */
+void
+ans_normalize(const uint32_t *hist, int lg, uint16_t *norm) {
+    const uint32_t total = 1u << lg;
+    uint64_t count = 0;     // Number of bytes counted
+    uint32_t sum = 0;       // Sum of the counts
+    int big = 0;            // Byte value with the largest count
+
+    for(int s = 0; s < 256; ++s) count += *(hist+s);
+    for(int s = 0; s < 256; ++s) {
+        uint32_t c = *(hist+s) ? (uint64_t)*(hist+s) * total / count : 0;
+        if(*(hist+s) && !c) c = 1;
+        *(norm+s) = c;
+        sum += c;
+        if(c > *(norm+big)) big = s;
+    }
+
+    /* The rounding down leaves a remainder for the most frequent byte value;
+       the counts raised to 1 may instead exceed the total, which is taken
+       back from the largest counts */
+    if(sum <= total) {
+        *(norm+big) += total - sum;
+        return;
+    }
+    for(; sum > total; --sum) {
+        for(int s = 0; s < 256; ++s) {
+            if(*(norm+s) > *(norm+big)) big = s;
+        }
+        (*(norm+big))--;
+    }
+}
+
+/*
+ * Estimate the number of bits of the data of a histogram coded with
+ * normalized counts.
+ */
+uint64_t
+ans_cost(const uint32_t *hist, int lg, const uint16_t *norm) {
+    double bits = 0;
+
+    for(int s = 0; s < 256; ++s) {
+        if(*(hist+s)) bits += *(hist+s) * (lg - log2(*(norm+s)));
+    }
+
+    return (uint64_t)bits + 1;
+}
+
+/*
+ * Build the decode table of normalized counts.
+ */
+void
+ans_decode_table(const uint16_t *norm, int lg, ANS_ENTRY *tab) {
+    const uint32_t total = 1u << lg;
+    unsigned char spread[1 << ANS_MAX_LOG];
+    uint32_t next[256];     // Next count of every byte value
+
+    spread_symbols(norm, lg, spread);
+    for(int s = 0; s < 256; ++s) *(next+s) = *(norm+s);
+
+    /* The states of a byte value read enough bits to get back to the full
+       range of states */
+    for(uint32_t u = 0; u < total; ++u) {
+        unsigned char s = *(spread+u);
+        uint32_t ns = (*(next+s))++;
+        int nbits = lg - highbit(ns);
+        (tab+u)->sym = s;
+        (tab+u)->nbits = nbits;
+        (tab+u)->base = (ns << nbits) - total;
+    }
+}
+
+/*
+ * Encode data with normalized counts.
+ */
+size_t
+ans_encode(const uint16_t *norm, int lg, const unsigned char *data, unsigned n,
+           unsigned char *buf) {
+    const uint32_t total = 1u << lg;
+    unsigned char spread[1 << ANS_MAX_LOG];
+    uint16_t next_state[1 << ANS_MAX_LOG];  // Next state, by byte value then state
+    uint32_t delta_bits[256];   // Number of bits out, in the high 16 bits of state + delta
+    int32_t delta_find[256];    // Offset of the next states of every byte value
+    uint32_t cumul[256];        // Index of the next states of every byte value
+    unsigned char *p = buf + ANS_BOUND(n, lg);
+    uint64_t acc = 0;           // Pending bits, the first ones at the top
+    int nacc = 0;               // Number of pending bits
+    uint32_t x = total;         // Encoder state, total to 2*total-1
+
+    spread_symbols(norm, lg, spread);
+    for(uint32_t s = 0, c = 0; s < 256; c += *(norm+s), ++s) {
+        uint32_t k = *(norm+s);
+        *(cumul+s) = c;
+        if(k == 1) {
+            *(delta_bits+s) = ((uint32_t)lg << 16) - total;
+            *(delta_find+s) = c - 1;
+        } else if(k) {
+            uint32_t max_bits = lg - highbit(k-1);
+            *(delta_bits+s) = (max_bits << 16) - (k << max_bits);
+            *(delta_find+s) = c - k;
+        }
+    }
+    for(uint32_t u = 0; u < total; ++u) *(next_state + (*(cumul + *(spread+u)))++) = total + u;
+
+#define ANS_PUT(s) do {                                             \
+        int nb = (x + *(delta_bits+(s))) >> 16;                     \
+        acc |= (uint64_t)(x & ((1u << nb) - 1)) << nacc;            \
+        nacc += nb;                                                 \
+        x = *(next_state + (x >> nb) + *(delta_find+(s)));          \
+    } while(0)
+#define ANS_FLUSH() do {                                            \
+        for(int j = 0; j < BYTE; ++j) *(p-1-j) = acc >> (BYTE*j);  \
+        p -= nacc / BYTE;                                           \
+        acc >>= nacc & ~(BYTE-1);                                   \
+        nacc &= BYTE-1;                                             \
+    } while(0)
+
+    /* The bits are written backward from the end of the buffer. Every
+       four bytes coded, at most 4*ANS_MAX_LOG bits, the eight low bytes
+       of the pending bits are stored and those that are whole are kept. */
+    unsigned i = n;
+    for(; i % 4; --i) {
+        ANS_PUT(*(data+i-1));
+        ANS_FLUSH();
+    }
+    for(; i; i -= 4) {
+        ANS_PUT(*(data+i-1));
+        ANS_PUT(*(data+i-2));
+        ANS_PUT(*(data+i-3));
+        ANS_PUT(*(data+i-4));
+        ANS_FLUSH();
+    }
+
+    /* First state of the decoder, the marker bit, then zero padding */
+    acc |= (uint64_t)(x - total) << nacc;
+    nacc += lg;
+    acc |= (uint64_t)1 << nacc++;
+    ANS_FLUSH();
+    p -= (nacc + BYTE-1) / BYTE;
+#undef ANS_PUT
+#undef ANS_FLUSH
+
+    size_t size = buf + ANS_BOUND(n, lg) - p;
+    for(size_t i = 0; i < size; ++i) *(buf+i) = *(p+i);
+
+    return size;
+}
@@ -0,0 +1,493 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "archive.h"
+#include "huff_ctx.h"
+#include "io.h"
+#include "debug.h"
+
+#define BYTE    8
+
+/* Number of members that can be in flight for every worker thread */
+#define MEMBERS_PER_THREAD 2
+
+/*
+ * State shared by the writer (the calling thread) and the workers. Member
+ * i is kept in slot i % window from the time it is compressed until it is
+ * written.
+ */
+typedef struct pack {
+    ARCHIVE_MEMBER *members;    // Members, sorted by name
+    unsigned char **streams;    // Compressed stream of the member of every slot
+    int *done;                  // Set when the member of a slot is compressed
+    size_t count;               // Number of members
+    size_t window;              // Number of slots
+    size_t next_work;           // Number of members handed to workers so far
+    size_t next_write;          // Number of members written so far
+    int error;                  // Set when a worker or the writer failed
+    const HUFF_PARAMS *params;  // Compression parameters of every member
+    pthread_mutex_t mutex;      // Protects everything above
+    pthread_cond_t work_cond;   // Signalled when a member is written, or on error
+    pthread_cond_t done_cond;   // Signalled when a member is compressed, or on error
+} PACK;
+
+/*
+ * @brief Stores a value as n bytes in big-endian order.
+ *
+ * @param buf Destination
+ * @param v Value
+ * @param n Number of bytes
+*/
+static void
+put_be(unsigned char *buf, uint64_t v, int n) {
+    for(int i = n-1; i >= 0; --i) {
+        *(buf+i) = v & 0xFF;
+        v >>= BYTE;
+    }
+}
+
+/*
+ * @brief Loads a value stored as n bytes in big-endian order.
+ *
+ * @param buf Source
+ * @param n Number of bytes
+ * @return The value
+*/
+static uint64_t
+get_be(const unsigned char *buf, int n) {
+    uint64_t v = 0;
+
+    for(int i = 0; i < n; ++i) v = (v << BYTE) | *(buf+i);
+    return v;
+}
+
+/*
+ * @brief Compares two names in byte order.
+ *
+ * @param a First name
+ * @param alen Length of the first name
+ * @param b Second name
+ * @param blen Length of the second name
+ * @return Less than, equal to or greater than 0 as the first name sorts
+ * before, with or after the second
+*/
+static int
+name_cmp(const char *a, size_t alen, const char *b, size_t blen) {
+    for(size_t i = 0; i < alen && i < blen; ++i) {
+        unsigned char ca = *(a+i), cb = *(b+i);
+        if(ca != cb) return ca - cb;
+    }
+
+    return (alen > blen) - (alen < blen);
+}
+
+/*
+ * @brief Compares two members by name, for qsort().
+*/
+static int
+member_cmp(const void *a, const void *b) {
+    const ARCHIVE_MEMBER *ma = a, *mb = b;
+    return name_cmp(ma->name, ma->name_len, mb->name, mb->name_len);
+}
+
+/*
+ * @brief Reads the list of file names from standard input.
+ * @details Every line names a file; empty lines are skipped. The names are
+ * NUL-terminated in place, so they can be opened, and the members are
+ * sorted by name.
+ *
+ * @param dir Set to the members, with only their names set
+ * @return 0 on success, 1 if a name is too long or listed twice, or on error
+*/
+static int
+read_list(ARCHIVE_DIR *dir) {
+    char *buf = NULL;       // All of standard input
+    size_t len = 0, cap = 0, n;
+    size_t count = 0;
+
+    /* Read all of standard input, leaving room for a final NUL */
+    do {
+        if(cap - len < IO_BUF_SIZE + 1) {
+            char *b = realloc(buf, cap = 2*cap + IO_BUF_SIZE + 1);
+            if(b == NULL) {
+                free(buf);
+                return 1;
+            }
+            buf = b;
+        }
+        n = io_read((unsigned char *)buf + len, IO_BUF_SIZE);
+        len += n;
+    } while(n == IO_BUF_SIZE);
+    *(buf+len) = '\n';
+    dir->names = buf;
+    if(io_error()) return 1;
+
+    /* Count the lines, then cut them into names */
+    for(size_t i = 0; i < len; ++i) {
+        if(*(buf+i) != '\n' && *(buf+i+1) == '\n') ++count;
+    }
+    if((dir->members = malloc((count ? count : 1) * sizeof(ARCHIVE_MEMBER))) == NULL) return 1;
+    for(char *p = buf, *end = buf + len; p < end; ++p) {
+        char *q = p;
+        for(; *q != '\n'; ++q);
+        if(q > p) {
+            ARCHIVE_MEMBER *m = dir->members + dir->count++;
+            m->name = p;
+            m->name_len = q - p;
+            if(m->name_len > ARCHIVE_MAX_NAME) return 1;
+        }
+        *q = '\0';
+        p = q;
+    }
+
+    /* Sort by name; every name once */
+    qsort(dir->members, dir->count, sizeof(ARCHIVE_MEMBER), member_cmp);
+    for(size_t i = 1; i < dir->count; ++i) {
+        if(!member_cmp(dir->members+i-1, dir->members+i)) return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Compresses the file of a member as a complete stream.
+ *
+ * @param ctx The compression context of the thread
+ * @param m The member, whose raw and compressed sizes are set
+ * @param out Set to the compressed stream, allocated with malloc()
+ * @return 0 on success, 1 if the file is not a regular file, cannot be
+ * read, or on error
+*/
+static int
+compress_member(HUFF_CTX *ctx, ARCHIVE_MEMBER *m, unsigned char **out) {
+    unsigned char *raw = NULL;
+    struct stat st;
+    ssize_t n = -1;
+    int fd;
+
+    *out = NULL;
+    if((fd = open(m->name, O_RDONLY)) < 0) return 1;
+    if(!fstat(fd, &st) && S_ISREG(st.st_mode)) {
+        size_t size = st.st_size;
+        size_t cap = huff_compress_bound(ctx, size);
+        raw = malloc(size ? size : 1);
+        *out = malloc(cap);
+        if(raw && *out && !read_full(fd, raw, size, 0)) {
+            m->raw_size = size;
+            n = huff_compress_buf(ctx, raw, size, *out, cap);
+        }
+    }
+    close(fd);
+    free(raw);
+
+    if(n < 0) {
+        free(*out);
+        *out = NULL;
+        return 1;
+    }
+    m->comp_size = n;
+
+    return 0;
+}
+
+/*
+ * @brief Worker thread: compresses members until all have been handed out
+ * or an error occurs.
+ *
+ * @param arg The PACK
+ * @return NULL
+*/
+static void *
+pack_worker(void *arg) {
+    PACK *p = arg;
+    HUFF_CTX *ctx = huff_ctx_init(HUFF_COMPRESS, p->params);
+
+    pthread_mutex_lock(&p->mutex);
+    if(ctx == NULL) {
+        p->error = 1;
+        pthread_cond_broadcast(&p->done_cond);
+    }
+    for(;;) {
+        /* Wait for a free slot */
+        while(!p->error && p->next_work < p->count
+              && p->next_work >= p->next_write + p->window)
+            pthread_cond_wait(&p->work_cond, &p->mutex);
+        if(p->error || p->next_work == p->count) break;
+        size_t i = p->next_work++;
+        pthread_mutex_unlock(&p->mutex);
+
+        unsigned char *out;
+        int err = compress_member(ctx, p->members+i, &out);
+
+        pthread_mutex_lock(&p->mutex);
+        *(p->streams + i % p->window) = out;
+        *(p->done + i % p->window) = 1;
+        if(err) {
+            p->error = 1;
+            pthread_cond_broadcast(&p->work_cond);
+        }
+        pthread_cond_broadcast(&p->done_cond);
+    }
+    pthread_mutex_unlock(&p->mutex);
+
+    if(ctx) huff_ctx_fini(ctx);
+    return NULL;
+}
+
+/*
+ * @brief Writes the central directory and the footer of an archive.
+ *
+ * @param dir The members, with their offsets and sizes set
+ * @param end Offset of the end of the last member
+ * @return 0 on success, 1 on error
+*/
+static int
+write_dir(ARCHIVE_DIR *dir, uint64_t end) {
+    size_t size = ARCHIVE_FOOTER_SIZE;
+    unsigned char *buf, *p;
+    int ret;
+
+    for(size_t i = 0; i < dir->count; ++i) size += ARCHIVE_ENTRY_SIZE + (dir->members+i)->name_len;
+    if((buf = p = malloc(size)) == NULL) return 1;
+
+    for(size_t i = 0; i < dir->count; ++i) {
+        ARCHIVE_MEMBER *m = dir->members+i;
+        put_be(p, m->offset, 8);
+        put_be(p+8, m->comp_size, 8);
+        put_be(p+16, m->raw_size, 8);
+        put_be(p+24, m->name_len, 2);
+        p += ARCHIVE_ENTRY_SIZE;
+        for(size_t j = 0; j < m->name_len; ++j) *p++ = *(m->name+j);
+    }
+
+    /* Footer */
+    put_be(p, dir->count, 4);
+    put_be(p+4, end, 8);
+    for(int i = 0; i < 4; ++i) *(p+12+i) = *(ARCHIVE_MAGIC+i);
+
+    ret = io_write(buf, size);
+    free(buf);
+
+    return ret;
+}
+
+/*
+ * Reads a list of file names from standard input and writes an archive of
+ * the files to standard output.
+ */
+int
+archive_pack(int nthreads, const HUFF_PARAMS *params) {
+    ARCHIVE_DIR dir = {0};
+    pthread_t *threads = NULL;
+    int nstarted = 0;
+    uint64_t offset = 0;    // Offset of the next member
+    PACK p = {0};
+
+    if(nthreads < 1) nthreads = 1;
+    if(read_list(&dir)) {
+        archive_fini(&dir);
+        return 1;
+    }
+
+    p.members = dir.members;
+    p.count = dir.count;
+    p.window = nthreads * MEMBERS_PER_THREAD;
+    p.params = params;
+    p.streams = calloc(p.window, sizeof(unsigned char *));
+    p.done = calloc(p.window, sizeof(int));
+    threads = malloc(nthreads * sizeof(pthread_t));
+    pthread_mutex_init(&p.mutex, NULL);
+    pthread_cond_init(&p.work_cond, NULL);
+    pthread_cond_init(&p.done_cond, NULL);
+    if(p.streams == NULL || p.done == NULL || threads == NULL) p.error = 1;
+
+    for(; !p.error && nstarted < nthreads; ++nstarted) {
+        if(pthread_create(threads+nstarted, NULL, pack_worker, &p)) {
+            pthread_mutex_lock(&p.mutex);
+            p.error = 1;
+            pthread_cond_broadcast(&p.work_cond);
+            pthread_mutex_unlock(&p.mutex);
+            break;
+        }
+    }
+
+    /* Write the members in order as they are compressed */
+    for(size_t i = 0; i < p.count; ++i) {
+        const size_t s = i % p.window;
+        ARCHIVE_MEMBER *m = p.members+i;
+
+        pthread_mutex_lock(&p.mutex);
+        while(!p.error && !*(p.done+s)) pthread_cond_wait(&p.done_cond, &p.mutex);
+        int err = p.error;
+        pthread_mutex_unlock(&p.mutex);
+        if(err) break;
+
+        m->offset = offset;
+        err = io_write(*(p.streams+s), m->comp_size);
+        offset += m->comp_size;
+        free(*(p.streams+s));
+
+        pthread_mutex_lock(&p.mutex);
+        *(p.streams+s) = NULL;
+        *(p.done+s) = 0;
+        p.next_write++;
+        if(err) p.error = 1;
+        pthread_cond_broadcast(&p.work_cond);
+        pthread_mutex_unlock(&p.mutex);
+    }
+
+    for(int i = 0; i < nstarted; ++i) pthread_join(*(threads+i), NULL);
+
+    int ret = p.error;
+    if(!ret && write_dir(&dir, offset)) ret = 1;
+    if(io_flush()) ret = 1;
+
+    for(size_t s = 0; p.streams && s < p.window; ++s) free(*(p.streams+s));
+    free(p.streams);
+    free(p.done);
+    free(threads);
+    pthread_mutex_destroy(&p.mutex);
+    pthread_cond_destroy(&p.work_cond);
+    pthread_cond_destroy(&p.done_cond);
+    archive_fini(&dir);
+
+    return ret;
+}
+
+/*
+ * Read the central directory of an archive from a seekable file.
+ */
+int
+archive_read(int fd, ARCHIVE_DIR *dir) {
+    unsigned char buf[ARCHIVE_FOOTER_SIZE];
+    off_t base, size;
+    uint64_t count, end, len;
+
+    /* Archive extends from the current offset to the end of the file */
+    if((base = lseek(fd, 0, SEEK_CUR)) < 0) return 1;
+    if((size = lseek(fd, 0, SEEK_END)) < 0) return 1;
+    if(lseek(fd, base, SEEK_SET) < 0) return 1;
+    size -= base;
+    if(size < ARCHIVE_FOOTER_SIZE) return 1;
+
+    /* Footer */
+    if(read_full(fd, buf, ARCHIVE_FOOTER_SIZE, base + size - ARCHIVE_FOOTER_SIZE)) return 1;
+    for(int i = 0; i < 4; ++i) {
+        if(*(buf+12+i) != *(ARCHIVE_MAGIC+i)) return 1;
+    }
+    count = get_be(buf, 4);
+    end = get_be(buf+4, 8);
+    if(end > (uint64_t)size - ARCHIVE_FOOTER_SIZE) return 1;
+    len = size - ARCHIVE_FOOTER_SIZE - end;
+    if(count * ARCHIVE_ENTRY_SIZE > len) return 1;
+
+    /* Central directory; the names are left in place */
+    dir->names = malloc(len ? len : 1);
+    dir->members = malloc((count ? count : 1) * sizeof(ARCHIVE_MEMBER));
+    dir->count = 0;
+    dir->base = base;
+    if(dir->names == NULL || dir->members == NULL
+       || read_full(fd, (unsigned char *)dir->names, len, base + end)) {
+        archive_fini(dir);
+        return 1;
+    }
+
+    const unsigned char *p = (unsigned char *)dir->names, *lim = p + len;
+    uint64_t offset = 0;    // Offset of the next member
+    for(; dir->count < count; ++dir->count) {
+        ARCHIVE_MEMBER *m = dir->members + dir->count;
+        if(lim - p < ARCHIVE_ENTRY_SIZE) break;
+        m->offset = get_be(p, 8);
+        m->comp_size = get_be(p+8, 8);
+        m->raw_size = get_be(p+16, 8);
+        m->name_len = get_be(p+24, 2);
+        m->name = (const char *)p + ARCHIVE_ENTRY_SIZE;
+        p += ARCHIVE_ENTRY_SIZE;
+        if((size_t)(lim - p) < m->name_len) break;
+        p += m->name_len;
+
+        /* Members follow each other, sorted by name */
+        if(m->offset != offset || m->comp_size > end - offset) break;
+        if(dir->count && member_cmp(m-1, m) >= 0) break;
+        offset += m->comp_size;
+    }
+    if(dir->count != count || p != lim || offset != end) {
+        archive_fini(dir);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Find a member of an archive by name.
+ */
+ARCHIVE_MEMBER *
+archive_find(ARCHIVE_DIR *dir, const char *name) {
+    size_t lo = 0, hi = dir->count;
+    size_t len = 0;
+
+    for(; *(name+len); ++len);
+
+    /* Binary search of the sorted members */
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        ARCHIVE_MEMBER *m = dir->members+mid;
+        int c = name_cmp(name, len, m->name, m->name_len);
+        if(!c) return m;
+        if(c < 0) hi = mid;
+        else lo = mid + 1;
+    }
+
+    return NULL;
+}
+
+/*
+ * Free a central directory.
+ */
+void
+archive_fini(ARCHIVE_DIR *dir) {
+    free(dir->members);
+    free(dir->names);
+    dir->members = NULL;
+    dir->names = NULL;
+    dir->count = 0;
+}
+
+/*
+ * Reads an archive from standard input and writes the raw bytes of one
+ * member to standard output.
+ */
+int
+archive_extract(const char *name, int nthreads) {
+    HUFF_PARAMS params = { .threads = nthreads };
+    unsigned char *cbuf = NULL, *raw = NULL;
+    ARCHIVE_DIR dir = {0};
+    ARCHIVE_MEMBER *m;
+    HUFF_CTX *ctx = NULL;
+    int fd = fileno(stdin);
+    int ret = 1;
+
+    if(archive_read(fd, &dir)) return 1;
+
+    /* Read and decompress only the member */
+    if((m = archive_find(&dir, name)) != NULL
+       && (cbuf = malloc(m->comp_size ? m->comp_size : 1)) != NULL
+       && (raw = malloc(m->raw_size ? m->raw_size : 1)) != NULL
+       && !read_full(fd, cbuf, m->comp_size, dir.base + m->offset)
+       && (ctx = huff_ctx_init(HUFF_DECOMPRESS, &params)) != NULL
+       && huff_decompress_buf(ctx, cbuf, m->comp_size, raw, m->raw_size) == (ssize_t)m->raw_size) {
+        ret = io_write(raw, m->raw_size);
+    }
+    if(io_flush()) ret = 1;
+
+    if(ctx) huff_ctx_fini(ctx);
+    free(cbuf);
+    free(raw);
+    archive_fini(&dir);
+
+    return ret;
+}
@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "container.h"
+#include "io.h"
+#include "debug.h"
+
+#define BYTE    8
+
+/*
+ * @brief Stores a value as n bytes in big-endian order.
+ *
+ * @param buf Destination
+ * @param v Value
+ * @param n Number of bytes
+*/
+static void
+put_be(unsigned char *buf, uint64_t v, int n) {
+    for(int i = n-1; i >= 0; --i) {
+        *(buf+i) = v & 0xFF;
+        v >>= BYTE;
+    }
+}
+
+/*
+ * @brief Loads a value stored as n bytes in big-endian order.
+ *
+ * @param buf Source
+ * @param n Number of bytes
+ * @return The value
+*/
+static uint64_t
+get_be(const unsigned char *buf, int n) {
+    uint64_t v = 0;
+
+    for(int i = 0; i < n; ++i) v = (v << BYTE) | *(buf+i);
+    return v;
+}
+
+/*
+ * Append a block to a block index.
+ */
+int
+index_add(BLOCK_INDEX *idx, uint32_t raw_len, size_t comp_len) {
+    if(idx->count == idx->cap) {
+        size_t cap = idx->cap ? 2*idx->cap : 64;
+        INDEX_ENTRY *e = realloc(idx->entries, cap * sizeof(INDEX_ENTRY));
+        if(e == NULL) return 1;
+        idx->entries = e;
+        idx->cap = cap;
+    }
+
+    INDEX_ENTRY *e = idx->entries + idx->count++;
+    e->offset = idx->end;
+    e->raw_offset = idx->raw_size;
+    e->raw_len = raw_len;
+    idx->end += comp_len;
+    idx->raw_size += raw_len;
+
+    return 0;
+}
+
+/*
+ * Get the size of the trailer describing a block index.
+ */
+size_t
+index_size(BLOCK_INDEX *idx) {
+    return INDEX_HEADER_SIZE + idx->count * INDEX_ENTRY_SIZE + INDEX_FOOTER_SIZE;
+}
+
+/*
+ * Store the trailer describing a block index in a buffer.
+ */
+void
+index_encode(BLOCK_INDEX *idx, unsigned char *buf) {
+    /* Marker and number of blocks */
+    *buf = INDEX_MARKER;
+    put_be(buf+1, idx->count, 4);
+    buf += INDEX_HEADER_SIZE;
+
+    /* Block locations */
+    for(size_t i = 0; i < idx->count; ++i, buf += INDEX_ENTRY_SIZE) {
+        put_be(buf, (idx->entries+i)->offset, 8);
+        put_be(buf+8, (idx->entries+i)->raw_len, 4);
+    }
+
+    /* Footer */
+    put_be(buf, idx->end, 8);
+    for(int i = 0; i < 4; ++i) *(buf+8+i) = *(INDEX_MAGIC+i);
+}
+
+/*
+ * Write the trailer describing a block index to standard output.
+ */
+int
+index_write(BLOCK_INDEX *idx) {
+    unsigned char *buf = malloc(index_size(idx));
+    int ret;
+
+    if(buf == NULL) return 1;
+    index_encode(idx, buf);
+    ret = io_write(buf, index_size(idx));
+    free(buf);
+
+    return ret;
+}
+
+/*
+ * Read the block index of a compressed stream from a seekable file.
+ */
+int
+index_read(int fd, BLOCK_INDEX *idx) {
+    unsigned char buf[INDEX_FOOTER_SIZE];
+    off_t base, size;
+    uint64_t count;
+
+    /* Stream extends from the current offset to the end of the file */
+    if((base = lseek(fd, 0, SEEK_CUR)) < 0) return 1;
+    if((size = lseek(fd, 0, SEEK_END)) < 0) return 1;
+    if(lseek(fd, base, SEEK_SET) < 0) return 1;
+    size -= base;
+    if(size < INDEX_HEADER_SIZE + INDEX_FOOTER_SIZE) return 1;
+
+    /* Footer */
+    if(read_full(fd, buf, INDEX_FOOTER_SIZE, base + size - INDEX_FOOTER_SIZE)) return 1;
+    for(int i = 0; i < 4; ++i) {
+        if(*(buf+8+i) != *(INDEX_MAGIC+i)) return 1;
+    }
+    idx->end = get_be(buf, 8);
+    if(idx->end > size - INDEX_HEADER_SIZE - INDEX_FOOTER_SIZE) return 1;
+
+    /* Marker and number of blocks */
+    if(read_full(fd, buf, INDEX_HEADER_SIZE, base + idx->end)) return 1;
+    count = get_be(buf+1, 4);
+    if(*buf != INDEX_MARKER
+       || idx->end + INDEX_HEADER_SIZE + count*INDEX_ENTRY_SIZE + INDEX_FOOTER_SIZE != size)
+        return 1;
+
+    /* Block locations */
+    unsigned char *raw = malloc(count ? count*INDEX_ENTRY_SIZE : 1);
+    idx->entries = malloc((count ? count : 1) * sizeof(INDEX_ENTRY));
+    if(raw == NULL || idx->entries == NULL
+       || read_full(fd, raw, count*INDEX_ENTRY_SIZE, base + idx->end + INDEX_HEADER_SIZE)) {
+        free(raw);
+        index_fini(idx);
+        return 1;
+    }
+    idx->count = idx->cap = count;
+    idx->raw_size = 0;
+    idx->base = base;
+    for(size_t i = 0; i < count; ++i) {
+        INDEX_ENTRY *e = idx->entries+i;
+        e->offset = get_be(raw + i*INDEX_ENTRY_SIZE, 8);
+        e->raw_len = get_be(raw + i*INDEX_ENTRY_SIZE + 8, 4);
+        e->raw_offset = idx->raw_size;
+        idx->raw_size += e->raw_len;
+
+        /* Blocks must be in stream order */
+        if(e->offset >= idx->end || (i && e->offset <= (e-1)->offset)) {
+            free(raw);
+            index_fini(idx);
+            return 1;
+        }
+    }
+    free(raw);
+
+    return 0;
+}
+
+/*
+ * Find the block holding a raw byte.
+ */
+size_t
+index_find(BLOCK_INDEX *idx, uint64_t raw_offset) {
+    size_t lo = 0, hi = idx->count - 1;
+
+    /* Binary search for the last block starting at or before raw_offset */
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo + 1) / 2;
+        if((idx->entries+mid)->raw_offset <= raw_offset) lo = mid;
+        else hi = mid - 1;
+    }
+
+    return lo;
+}
+
+/*
+ * Read the compressed bytes of one block of a stream.
+ */
+int
+index_read_block(BLOCK_INDEX *idx, int fd, size_t i, unsigned char **buf,
+                 size_t *cap, size_t *len) {
+    INDEX_ENTRY *e = idx->entries+i;
+    size_t n = ((i+1 < idx->count) ? (e+1)->offset : idx->end) - e->offset;
+
+    if(n > *cap) {
+        unsigned char *b = realloc(*buf, n);
+        if(b == NULL) return 1;
+        *buf = b;
+        *cap = n;
+    }
+    *len = n;
+
+    return read_full(fd, *buf, n, idx->base + e->offset);
+}
+
+/*
+ * Free the entries of a block index.
+ */
+void
+index_fini(BLOCK_INDEX *idx) {
+    free(idx->entries);
+    idx->entries = NULL;
+    idx->count = idx->cap = 0;
+}
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "block.h"
+#include "container.h"
+#include "extract.h"
+#include "io.h"
+#include "debug.h"
+
+/*
+ * Approximate number of raw bytes extract() decompresses per call to
+ * extract_range(). Chunks end on block boundaries, so that no block is
+ * decompressed twice.
+ */
+#define EXTRACT_CHUNK   (1 << 20)
+
+/*
+ * Decompress a range of the raw data of a compressed stream with a block
+ * index, decoding only the blocks that overlap the range.
+ */
+ssize_t
+extract_range(int fd, BLOCK_INDEX *idx, uint64_t offset, size_t len,
+              unsigned char *dst) {
+    unsigned char *cbuf = NULL; // Compressed block
+    size_t ccap = 0, clen;
+    size_t done = 0;            // Number of bytes stored in dst
+    BLOCK *b;
+
+    /* Clip the range to the raw data */
+    if(offset >= idx->raw_size) return 0;
+    if(len > idx->raw_size - offset) len = idx->raw_size - offset;
+
+    if((b = block_init()) == NULL) return -1;
+
+    for(size_t i = index_find(idx, offset); done < len; ++i) {
+        INDEX_ENTRY *e = idx->entries+i;
+
+        /* Decompress the block */
+        if(index_read_block(idx, fd, i, &cbuf, &ccap, &clen)) break;
+        INBUF in = { cbuf, 0, clen, NULL };
+        if(decompress_data(b, &in) || b->out.len != e->raw_len) break;
+
+        /* Copy the part of the block inside the range */
+        const unsigned char *src = b->out.buf + (offset + done - e->raw_offset);
+        size_t n = e->raw_offset + e->raw_len - (offset + done);
+        if(n > len - done) n = len - done;
+        for(size_t j = 0; j < n; ++j) *(dst+done+j) = *(src+j);
+        done += n;
+    }
+
+    free(cbuf);
+    block_fini(b);
+
+    return (done == len) ? (ssize_t)done : -1;
+}
+
+/*
+ * Reads a compressed stream with a block index from standard input and
+ * writes the raw bytes [offset, offset+len) to standard output.
+ */
+int
+extract(uint64_t offset, uint64_t len) {
+    BLOCK_INDEX idx = {0};
+    unsigned char *buf = NULL;
+    size_t cap = 0;
+    int fd = fileno(stdin);
+    int ret = 0;
+
+    if(index_read(fd, &idx)) return 1;
+
+    /* Clip the range to the raw data */
+    if(offset >= idx.raw_size) len = 0;
+    else if(len > idx.raw_size - offset) len = idx.raw_size - offset;
+
+    while(len) {
+        /* Extend the chunk to the end of the block holding its last byte */
+        size_t n = len < EXTRACT_CHUNK ? len : EXTRACT_CHUNK;
+        INDEX_ENTRY *e = idx.entries + index_find(&idx, offset + n - 1);
+        n = e->raw_offset + e->raw_len - offset;
+        if(n > len) n = len;
+
+        if(n > cap) {
+            unsigned char *p = realloc(buf, n);
+            if(p == NULL) {
+                ret = 1;
+                break;
+            }
+            buf = p;
+            cap = n;
+        }
+
+        if(extract_range(fd, &idx, offset, n, buf) != n) {
+            ret = 1;
+            break;
+        }
+        if(io_write(buf, n)) {
+            ret = 1;
+            break;
+        }
+        offset += n;
+        len -= n;
+    }
+
+    free(buf);
+    index_fini(&idx);
+    if(io_flush()) ret = 1;
+
+    return ret;
+}
@@ -1,7 +1,24 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 #include "const.h"
 #include "huff.h"
+#include "block.h"
+#include "container.h"
+#include "options.h"
+#include "parallel.h"
+#include "io.h"
+#include "huff_ctx.h"
+#include "tables.h"
+#include "lz.h"
+#include "stats.h"
+#include "stream.h"
+#include "ans.h"
+#include "archive.h"
 #include "debug.h"
 
 #ifdef _STRING_H
@@ -19,41 +36,173 @@
 #define BYTE    8
 NODE *END; // END leaf node pointer
 
+/*
+ * @brief Reads the monotonic clock.
+ *
+ * @return The time in nanoseconds
+*/
+static uint64_t
+clock_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * @brief Starts timing the phases of a block, when it is timed.
+ *
+ * @param b Block
+*/
+static inline void
+phase_start(BLOCK *b) {
+    if(b->times) b->times->mark = clock_ns();
+}
+
+/*
+ * @brief Adds the time since the last phase ended to a phase of a block,
+ * when it is timed.
+ *
+ * @param b Block
+ * @param phase The phase that ends, PHASE_HISTOGRAM to PHASE_DECODE
+*/
+static inline void
+phase_end(BLOCK *b, int phase) {
+    if(b->times) {
+        uint64_t now = clock_ns();
+        *(b->times->ns+phase) += now - b->times->mark;
+        b->times->mark = now;
+    }
+}
+
+/*
+ * @brief Reads the next byte of compressed input.
+ *
+ * @param in Input
+ * @return Next byte, or EOF
+*/
+static inline int
+next_byte(INBUF *in) {
+    if(in->pos == in->len && (in->fill == NULL || in->fill(in))) {
+        in->eof = 1;
+        return EOF;
+    }
+    return *(in->buf+in->pos++);
+}
+
+/*
+ * Decode table of the BLOCK used by decompress_block().
+ */
+static DTAB_ENTRY serial_dtab[DTAB_SIZE];
+
+/*
+ * Block used by compress_block() and decompress_block(). It works on the
+ * global arrays declared in huff.h.
+ */
+static BLOCK serial_block = {
+    .data = current_block,
+    .nodes = nodes,
+    .node_for_symbol = node_for_symbol,
+    .dtab = serial_dtab,
+};
+
+/*
+ * Make room for n more bytes in an output buffer, growing it as needed.
+ */
+int
+out_reserve(OUTBUF *out, size_t n) {
+    if(out->len + n <= out->cap) return 0;
+
+    size_t cap = out->cap ? out->cap : 1024;
+    while(cap < out->len + n) cap *= 2;
+
+    unsigned char *buf = realloc(out->buf, cap);
+    if(buf == NULL) return 1;
+    out->buf = buf;
+    out->cap = cap;
+
+    return 0;
+}
+
+/*
+ * @brief Appends a byte to an output buffer with room reserved for it.
+ *
+ * @param out Output buffer
+ * @param c Byte to append
+*/
+static inline void
+out_byte(OUTBUF *out, unsigned char c) {
+    *(out->buf+out->len++) = c;
+}
+
+/*
+ * Bit buffer for writing fields that are not whole bytes. Bits are written
+ * MSb first.
+ */
+typedef struct bit_writer {
+    uint64_t acc;   // Pending bits, right-aligned
+    int nbits;      // Number of pending bits
+} BIT_WRITER;
+
+/*
+ * @brief Appends bits to an output buffer with room reserved for them.
+ *
+ * @param out Output buffer
+ * @param bw Bit buffer
+ * @param v Bits to append, right-aligned
+ * @param n Number of bits (at most 24)
+*/
+static inline void
+put_bits(OUTBUF *out, BIT_WRITER *bw, uint32_t v, int n) {
+    bw->acc = (bw->acc << n) | v;
+    bw->nbits += n;
+    while(bw->nbits >= BYTE) {
+        bw->nbits -= BYTE;
+        out_byte(out, bw->acc >> bw->nbits);
+    }
+}
+
+/*
+ * @brief Zero-pads the pending bits to a whole byte and appends it.
+ *
+ * @param out Output buffer
+ * @param bw Bit buffer
+*/
+static void
+flush_bits(OUTBUF *out, BIT_WRITER *bw) {
+    if(bw->nbits) put_bits(out, bw, 0, BYTE - bw->nbits);
+}
+
 /*
  * @brief Post order travesral of Huffman Tree
  * @details Outputs the symbols of the leaves.
  * 
+ * @param b Block being compressed
  * @param n Current node being evaluated
- * @param prev_sym Holds the previously evaluated symbol
 */
 static void
-sym_byte_seq(NODE *n, short prev_sym) {
+sym_byte_seq(BLOCK *b, NODE *n) {
     /* If leaf node (either left or right == NULL) */
     if(n->left == NULL) {
         /* END symbol output */
         if(!n->weight) {
-            END = n; // Point to END leaf node - for use during encoding
+            b->end = n; // Point to END leaf node
             /* END symbol is a two byte symbol: 0xFF00 */
-            putchar(0xFF);
-            putchar(0x00);
-            return;
-        }
-        /* If previous symbol is 255, the byte must be any value that's not 0x00 */
-        if(prev_sym == 0xFF) {
-            putchar(0x01);
+            out_byte(&b->out, 0xFF);
+            out_byte(&b->out, 0x00);
             return;
         }
-
         /* Output symbol */
-        putchar(n->symbol);
-        prev_sym = n->symbol;
+        out_byte(&b->out, n->symbol);
+        /* Symbol 255 is followed by any byte that's not 0x00 */
+        if(n->symbol == 0xFF) out_byte(&b->out, 0x01);
         return;
     } 
     
     /* Go to Left child */
-    sym_byte_seq(n->left, prev_sym);
+    sym_byte_seq(b, n->left);
     /* Go to Right child */
-    sym_byte_seq(n->right, prev_sym);
+    sym_byte_seq(b, n->right);
 }
 
 /*
@@ -61,17 +210,18 @@ sym_byte_seq(NODE *n, short prev_sym) {
  * @details When a leaf is reached the output is 0.
  * Output is 1 when an internal node is reached.
  * 
+ * @param out Output buffer
  * @param n Current node being evaluated
  * @param bit_sequence Holds the bit evaluation results of the nodes
 */
 static void
-bitseq(NODE *n, char *bit_sequence, int *bit_pos, int *bit_count) {
+bitseq(OUTBUF *out, NODE *n, char *bit_sequence, int *bit_pos, int *bit_count) {
     /* If leaf node (either left or right = NULL) */
     if(n->left == NULL) {
         *bit_sequence &= ~(1 << (*bit_pos)--); // Clear next bit 
         /* If full byte filled */
         if(++(*bit_count) == BYTE) {
-            putchar(*bit_sequence);
+            out_byte(out, *bit_sequence);
             *bit_pos = 7;   // Go back to MSb
             *bit_count = 0; // Reset count
         }
@@ -79,633 +229,3031 @@ bitseq(NODE *n, char *bit_sequence, int *bit_pos, int *bit_count) {
     } 
     
     /* Go to Left child */
-    bitseq(n->left, bit_sequence, bit_pos, bit_count);
+    bitseq(out, n->left, bit_sequence, bit_pos, bit_count);
     /* Go to Right child */
-    bitseq(n->right, bit_sequence, bit_pos, bit_count);
+    bitseq(out, n->right, bit_sequence, bit_pos, bit_count);
 
     /* Internal node bit setting */
     *bit_sequence |= 1 << (*bit_pos)--; // Set next bit 
     /* If full byte filled */
     if(++(*bit_count) == BYTE) {
-        putchar(*bit_sequence);
+        out_byte(out, *bit_sequence);
         *bit_pos = 7;   // Go back to MSb
         *bit_count = 0; // Reset count
     } 
 }
 
 /*
- * @brief Emits the description of the Huffman tree used to compress the current block.
- * Huffman Tree Description: 
- *     1. Number of nodes: two-byte sequence in big-endian order
- *     2. Sequence of bits: 0 indicates leaf, 1 indicates internal node
- *     3. Sequence of bytes corresponding to the symbols in the Huffman Tree
+ * @brief Appends the description of the Huffman tree of a block to its
+ * output buffer.
+ *
+ * @param b Block being compressed
+ * @return 0 on success, 1 if memory could not be allocated
  */
-void 
-emit_huffman_tree() {
+static int
+emit_tree(BLOCK *b) {
+    /* Node count, bit sequence, and up to two bytes per leaf symbol */
+    if(out_reserve(&b->out, 2 + (b->num_nodes+BYTE-1)/BYTE + b->num_nodes + 1)) return 1;
+
     /* Emit number of nodes */
-    short nnum = num_nodes;         // Copy of number of nodes
-    putchar((nnum >> BYTE) & 0xFF); // MSB 
-    putchar(nnum & 0xFF);           // LSB
+    short nnum = b->num_nodes;               // Copy of number of nodes
+    out_byte(&b->out, (nnum >> BYTE) & 0xFF); // MSB 
+    out_byte(&b->out, nnum & 0xFF);           // LSB
 
     /* Emit node bit sequence */
     char bit_sequence = 0; // Holds bit sequence to be outputted
     int bit_count = 0;     // Keeps track of number of bits
     int bit_pos = 7;       // Bit Shift amount
     /* Generate the bit sequence */
-    bitseq(nodes, &bit_sequence, &bit_pos, &bit_count);
+    bitseq(&b->out, b->nodes, &bit_sequence, &bit_pos, &bit_count);
     /* Zero-padding the last byte in the bit sequence to make it a multiple of 8 bits */
     if(nnum % BYTE) { // Zero-padding only when not a multiple of 8 bits
         while(nnum % BYTE) {
             bit_sequence &= ~(1 << bit_pos--); // Clear next bit 
             ++nnum;
         }
-        putchar(bit_sequence); // Output last zero-padded byte
+        out_byte(&b->out, bit_sequence); // Output last zero-padded byte
     }
 
     /* Emit symbol byte sequence */
-    sym_byte_seq(nodes, 0);
+    sym_byte_seq(b, b->nodes);
+
+    return 0;
 }
 
 /*
- * @brief Swap two Nodes
- * 
- * @param n1 Index of 1st Node
- * @param n2 Index of 2nd Node
-*/
-static void
-swap(int n1, int n2) {
-    NODE temp_node;
-
-    temp_node = *(nodes+n2);
-    *(nodes+n2) = *(nodes+n1);
-    *(nodes+n1) = temp_node;
+ * @brief Emits the description of the Huffman tree used to compress the current block.
+ * Huffman Tree Description: 
+ *     1. Number of nodes: two-byte sequence in big-endian order
+ *     2. Sequence of bits: 0 indicates leaf, 1 indicates internal node
+ *     3. Sequence of bytes corresponding to the symbols in the Huffman Tree
+ */
+void 
+emit_huffman_tree() {
+    serial_block.num_nodes = num_nodes;
+    serial_block.out.len = 0;
+    if(emit_tree(&serial_block)) return;
+    fwrite(serial_block.out.buf, 1, serial_block.out.len, stdout);
+    END = serial_block.end;
 }
 
 /*
- * @brief Recursively Heapify the subtree at the given nodes array 
- * with root at the given index.
- * 
- * @param i Index of current Node
- * @param heapnum The current size of the min-heap
-*/
-static void 
-min_heapify(int i, const int heapnum) {
-    int l = 2*i+1;    // Left child index
-    int r = 2*i+2;    // Right child index
-    int smallest = i; // Initial smallest value
-    if(l < heapnum && (*(nodes+l)).weight < (*(nodes+i)).weight) 
-        smallest = l;
-    if(r < heapnum && (*(nodes+r)).weight < (*(nodes+smallest)).weight)
-        smallest = r;
-    if(smallest != i) {
-        swap(i, smallest); // Swap the previous smalles with current smallest
-        min_heapify(smallest, heapnum); 
+ * Number of count tables used by histogram().
+ */
+#define HIST_TABLES 4
+
+/*
+ * Count the occurrences of every byte value in a buffer. Consecutive
+ * bytes are counted in different tables, merged at the end, so that a run
+ * of equal bytes does not wait on the increment of the previous byte.
+ */
+void
+histogram(const unsigned char *data, unsigned n, uint32_t *hist) {
+    uint32_t count[HIST_TABLES][256] = {{0}};
+    unsigned i = 0;
+
+    for(; i + HIST_TABLES <= n; i += HIST_TABLES) {
+        (*(*(count+0) + *(data+i)))++;
+        (*(*(count+1) + *(data+i+1)))++;
+        (*(*(count+2) + *(data+i+2)))++;
+        (*(*(count+3) + *(data+i+3)))++;
+    }
+    for(; i < n; ++i) (*(*count + *(data+i)))++;
+
+    for(int s = 0; s < 256; ++s) {
+        *(hist+s) = 0;
+        for(int t = 0; t < HIST_TABLES; ++t) *(hist+s) += *(*(count+t)+s);
     }
 }
 
 /*
- * @brief Removes the 2 minimum-weight nodes of the min-heap in the nodes
- * array. Re-heapifies.
- * 
- * @param *heapnum The current size of the min-heap
- * @param *n The number of nodes
- * @return 0 when Huffman tree constructed, 1 when not
+ * @brief Sorts leaves by increasing weight (LSD radix sort).
+ * @details One counting pass per byte of the largest weight, so small
+ * blocks take one or two passes. Each pass is stable, so leaves of equal
+ * weight keep their order. There are at most NUM_SYMBOLS of them.
+ *
+ * @param weight Leaf weights, not negative
+ * @param sym Leaf symbols, moved along with their weights
+ * @param n Number of leaves
 */
-static int 
-remove_min(int *heapnum, int *n) {
-    NODE *temp_node1, *temp_node2;
-    int p = (*n+1)/2-2; // Parent index of current nodes
+static void
+sort_leaves(int *weight, short *sym, int n) {
+    int wbuf[NUM_SYMBOLS];
+    short sbuf[NUM_SYMBOLS];
+    int *w = weight, *wt = wbuf;        // Leaves before and after a pass
+    short *sy = sym, *st = sbuf;
+    unsigned start[256];                // Position of every digit value
+    int max = 0;
+
+    for(int i = 0; i < n; ++i) {
+        if(*(w+i) > max) max = *(w+i);
+    }
 
-    /* Store the root node at "upper end" of nodes array nodes[*n-1] */
-    temp_node1 = nodes+(*n-1);
-    *temp_node1 = *nodes;
-    /* Replace the root node - 1st min-wieght node - with last node in min-heap */  
-    *nodes = *(nodes+(*heapnum-1)); 
-    *heapnum -= 1; // Decrement size of the min-heap after replacing root node
-    min_heapify(0, *heapnum); // Fix the min-heap
+    for(int shift = 0; shift < 32 && (max >> shift); shift += BYTE) {
+        for(int d = 0; d < 256; ++d) *(start+d) = 0;
+        for(int i = 0; i < n; ++i) (*(start + ((*(w+i) >> shift) & 0xFF)))++;
+        for(unsigned d = 0, pos = 0; d < 256; ++d) {
+            unsigned c = *(start+d);
+            *(start+d) = pos;
+            pos += c;
+        }
+        for(int i = 0; i < n; ++i) {
+            unsigned j = (*(start + ((*(w+i) >> shift) & 0xFF)))++;
+            *(wt+j) = *(w+i);
+            *(st+j) = *(sy+i);
+        }
 
-    /* Replace the root node - 2nd min-weight node - with last node in min-heap*/
-    temp_node2 = nodes+(*n-2);
-    *temp_node2 = *nodes; // Store root at nodes[*n-2]
-    *nodes = *(nodes+(*heapnum-1)); 
+        int *wswap = w;
+        short *sswap = sy;
+        w = wt;
+        wt = wswap;
+        sy = st;
+        st = sswap;
+    }
 
-    /* Create parent for the 2 min-weight nodes */
-    (*(nodes+p)).left = temp_node1;  // Left Child
-    (*(nodes+p)).right = temp_node2; // Right Child
-    (*(nodes+p)).weight = temp_node1->weight + temp_node2->weight; // Parent wight = sum of children weight
-    (*(nodes+p)).symbol = 'P'; // Arbitrary parent symbol
-    *n = *n - 2;               // Reduce temporary size of Huff tree
-    min_heapify(0, *heapnum);  // Fix the min-heap
+    /* An odd number of passes leaves the leaves in the buffers */
+    if(w != weight) {
+        for(int i = 0; i < n; ++i) {
+            *(weight+i) = *(w+i);
+            *(sym+i) = *(sy+i);
+        }
+    }
+}
 
-    if(*heapnum == 1) return 0; // Huffman Tree Complete
+/*
+ * @brief Builds the Huffman tree of a block from its histogram.
+ * @details The leaves are sorted by weight once. Since parents are created
+ * in increasing order of weight, the two lightest nodes are always at the
+ * front of either the sorted leaves or the parents created so far, and each
+ * step takes O(1) (two-queue method). The tree is laid out in the nodes
+ * array with the parents in reverse order of creation, the root first,
+ * followed by the leaves.
+ *
+ * @param b Block being compressed, with its leaves in nodes[0 .. n-1]
+ * @param n Number of leaves (at least 2)
+*/
+static void
+build_tree(BLOCK *b, int n) {
+    int weight[NUM_SYMBOLS];        // Leaf weights, lightest first
+    short sym[NUM_SYMBOLS];         // Leaf symbols
+    int pweight[NUM_SYMBOLS-1];     // Parent weights, in order of creation
+    short child[NUM_SYMBOLS-1][2];  // Children of the parents: leaf i is i,
+                                    // parent j is n+j
+    int leaf = 0;       // Next leaf in the leaf queue
+    int parent = 0;     // Next parent in the parent queue
+
+    for(int i = 0; i < n; ++i) {
+        *(weight+i) = (b->nodes+i)->weight;
+        *(sym+i) = (b->nodes+i)->symbol;
+    }
+    sort_leaves(weight, sym, n);
+
+    /* Merge the two lightest nodes, leaves first on ties */
+    for(int j = 0; j < n-1; ++j) {
+        *(pweight+j) = 0;
+        for(int c = 0; c < 2; ++c) {
+            if(leaf < n && (parent == j || *(weight+leaf) <= *(pweight+parent))) {
+                *(pweight+j) += *(weight+leaf);
+                *(*(child+j)+c) = leaf++;
+            } else {
+                *(pweight+j) += *(pweight+parent);
+                *(*(child+j)+c) = n + parent++;
+            }
+        }
+    }
 
-    return 1; // Continue Huffman Tree construction
+    /* Parent j goes to index n-2-j, leaf i to index n-1+i */
+    for(int i = 0; i < n; ++i) {
+        NODE *nptr = b->nodes+n-1+i;
+        nptr->left = nptr->right = NULL;
+        nptr->weight = *(weight+i);
+        nptr->symbol = *(sym+i);
+    }
+    for(int j = 0; j < n-1; ++j) {
+        NODE *nptr = b->nodes+n-2-j;
+        int l = *(*(child+j)), r = *(*(child+j)+1);
+        nptr->left = b->nodes + ((l < n) ? n-1+l : n-2-(l-n));
+        nptr->right = b->nodes + ((r < n) ? n-1+r : n-2-(r-n));
+        nptr->weight = *(pweight+j);
+        nptr->symbol = 'P'; // Arbitrary parent symbol
+    }
+    b->num_nodes = 2*n - 1;
+    if(b->num_nodes > b->used_nodes) b->used_nodes = b->num_nodes;
 }
 
 /*
- * @brief Sets the parent pointers of the 
- * Nodes with parents in the nodes array. The function
- * also populates the node_for_symbol array.
- * 
- * @param n Address of current node being evaluated
- * @param prnt Address of current node's parent
+ * @brief Pre order traversal of the Huffman Tree assigning the
+ * code of every leaf.
+ * @details Also populates the node_for_symbol array. The END leaf is the
+ * only leaf with a weight of 0.
+ *
+ * @param b Block being compressed
+ * @param n Current node being evaluated
+ * @param code Code bits of the path to n
+ * @param len Depth of n
 */
-NODE **nfsptr = node_for_symbol; // Pointer to node_for_symbol array
 static void
-set_parents(NODE *n, NODE *prnt) {
-    n->parent = prnt; // Assign current node's parent
-
-    /* If leaf node (either left or right = NULL) */
+build_codes(BLOCK *b, NODE *n, uint32_t code, int len) {
+    /* If leaf node (either left or right == NULL) */
     if(n->left == NULL) {
-        /* Set pointer to leaf nodes corresponding to their symbol value. */
-        *(nfsptr+((int)n->symbol)) = n; 
+        int s = n->weight ? n->symbol : END_SYMBOL;
+        (b->codes+s)->bits = code;
+        (b->codes+s)->len = len;
+        if(n->weight) *(b->node_for_symbol+s) = n;
         return;
-    } 
-     
+    }
+
     /* Go to Left child */
-    set_parents(n->left, n);
+    build_codes(b, n->left, code << 1, len+1);
     /* Go to Right child */
-    set_parents(n->right, n);
+    build_codes(b, n->right, (code << 1) | 1, len+1);
 }
 
 /*
- * @brief Output the compressed data representing the 
- * uncompressed data.
- * @details Traverse the Huffman Tree, outputting the code
- * bits for the current symbol pointed to by nptr.
- * The weight fields of the nodes are used to store the directions
- * of the tree edges.
- * 
- * @param nptr: Pointer to current symbol to be encoded
- * @param naddr: Address of the previous node
- * @param bit_pos: Bit shift amount
- * @param bit_count: Number of bits processed
- * @param num_bits: Total number of bits in the encoded data
- * @param bit_sequence: Holds bit sequence to be outputted
+ * @brief Replaces a code with the canonical code of the same lengths.
+ * @details Symbols are ordered by code length, then by symbol value, and
+ * consecutive codes are assigned in that order. The length tables used by
+ * the decoder are filled at the same time.
+ *
+ * @param codes Code of every symbol, with its length set (0 if unused)
+ * @param n Number of symbols
+ * @param lcount Set to the number of codes of every length
+ * @param loffs Set to the index in "sorted" of the first code of every length
+ * @param lfirst Set to the first code of every length
+ * @param sorted Set to the symbols in canonical code order
+ * @return 0 on success, 1 if the lengths do not describe a complete code
 */
-static void
-encode_data(NODE *nptr, NODE *naddr, unsigned *bit_pos, unsigned *bit_count, 
-            unsigned *num_bits, char *bit_sequence) {
-    /* Set-up bit sequence */
-    while(nptr->parent) {
-        naddr = nptr;        // Store current node address
-        nptr = nptr->parent; // Move to parent node
-
-        /* Previous node: left or right child? */
-        if(nptr->left == naddr) {
-            nptr->weight = 0;
-        } else if(nptr->right == naddr){
-            nptr->weight = 1;
-        }
-    }
-
-    /* Output encoded bit sequence for current symbol */ 
-    while(nptr->left || nptr->right) {
-        if(nptr->weight) {                      // If direction is 1, go right
-            *bit_sequence |= 1 << (*bit_pos)--; // Set next bit 
-            (*num_bits)++;
-            /* If full byte filled */
-            if(++(*bit_count) == BYTE) {
-                putchar(*bit_sequence);
-                *bit_pos = 7;   // Go back to MSb
-                *bit_count = 0; // Reset count
-            }
-            nptr = nptr->right;    // Go to next node in the sequence
-        } else if(!nptr->weight) { // If direction is 0, go left
-            *bit_sequence &= ~(1 << (*bit_pos)--); // Clear next bit 
-            (*num_bits)++;
-            /* If full byte filled */
-            if(++(*bit_count) == BYTE) {
-                putchar(*bit_sequence);
-                *bit_pos = 7;   // Go back to MSb
-                *bit_count = 0; // Reset count
-            }
-            nptr = nptr->left;  // Go to next node in the sequence
-        }
+static int
+assign_codes(CODE *codes, int n, unsigned short *lcount, unsigned short *loffs,
+             uint32_t *lfirst, short *sorted) {
+    unsigned short next[MAX_CODE_LEN+1]; // Number of codes assigned per length
+    int64_t left = 1;   // Number of unassigned codes of the current length
+    uint32_t code = 0;  // First code of the current length
+    int len;
+
+    for(len = 0; len <= MAX_CODE_LEN; ++len) *(lcount+len) = 0;
+    for(int s = 0; s < n; ++s) {
+        if((len = (codes+s)->len) > MAX_CODE_LEN) return 1;
+        (*(lcount+len))++;
+    }
+    *lcount = 0;
+
+    /* Every code must be assigned exactly once */
+    for(len = 1; len <= MAX_CODE_LEN; ++len) {
+        left = 2*left - *(lcount+len);
+        if(left < 0) return 1;
+    }
+    if(left) return 1;
+
+    /* First code and first index in "sorted" of every length */
+    *lfirst = 0;
+    *loffs = 0;
+    for(len = 1; len <= MAX_CODE_LEN; ++len) {
+        code = (code + *(lcount+len-1)) << 1;
+        *(lfirst+len) = code;
+        *(loffs+len) = *(loffs+len-1) + *(lcount+len-1);
+        *(next+len) = 0;
+    }
+
+    for(int s = 0; s < n; ++s) {
+        if(!(len = (codes+s)->len)) continue;
+        (codes+s)->bits = *(lfirst+len) + *(next+len);
+        *(sorted + *(loffs+len) + *(next+len)) = s;
+        (*(next+len))++;
     }
+
+    return 0;
 }
 
 /*
- * @brief Output the compressed data representing the 
- * uncompressed data.
- * @details Traverses the Huffman Tree using the current_block array
- * content as the index to the node_for_symbol array to reference the leaf nodes 
- * of the Huffman Tree.
- * 
- * @param bbcnt Size of block
+ * @brief Replaces the codes of a block with the canonical codes of the
+ * same lengths.
+ *
+ * @param b Block, with the code length of every symbol set (0 if unused)
+ * @return 0 on success, 1 if the lengths do not describe a complete code
 */
-static void
-encode(int bbcnt) {
-    unsigned char *cbptr = current_block; // Pointer to current block array
-    char bit_sequence = 0;  // Holds bit sequence to be outputted
-    unsigned num_bits = 0;  // Total number of bits in the sequence
-    unsigned bit_pos = 7;   // Bit Shift amount
-    unsigned bit_count = 0; // Keeps track of number of bits
-    unsigned char s;        // Holds current character being compressed
-    NODE *nptr = NULL;      // Points to the current node used to compress "s"
-    NODE *naddr = NULL;     // Address of the previous node
-
-    /* Encode Characters and output code bits */
-    for(int i = 0; i < bbcnt; ++i) {
-        s = *(cbptr+i);              // Get next character to compress
-        nptr = *(node_for_symbol+s); // Pointer to node of symbol "s"
-        encode_data(nptr, naddr, &bit_pos, &bit_count, &num_bits, &bit_sequence);
-    }
-
-    /* Encode END symbol */
-    encode_data(END, naddr, &bit_pos, &bit_count, &num_bits, &bit_sequence);
+static int
+canonical_codes(BLOCK *b) {
+    return assign_codes(b->codes, NUM_SYMBOLS, b->lcount, b->loffs, b->lfirst, b->sorted);
+}
 
-    /* Zero-padding the last byte in the bit sequence to make it a multiple of 8 bits */
-    if(num_bits % BYTE) { // Zero-padding only when not a multiple of 8 bits
-        while(num_bits % BYTE) {
-            bit_sequence &= ~(1 << bit_pos--); // Clear next bit 
-            ++num_bits;
-        }
-        putchar(bit_sequence);   
-    } 
-    
+/*
+ * @brief Replaces the distance codes of a block with the canonical codes
+ * of the same lengths.
+ *
+ * @param b Block, with the code length of every distance symbol set
+ * @return 0 on success, 1 if the lengths do not describe a complete code
+*/
+static int
+canonical_dist_codes(BLOCK *b) {
+    return assign_codes(b->dcodes, DIST_CODES, b->dcount, b->doffs, b->dfirst, b->dsorted);
 }
 
 /*
- * @brief Resets the number of nodes and the nodes array.
- * @details Sets all the pointers in the NODE structs to NULL and 
- * resets the weight and symbol members to 0.
- */
-void 
-res_nodes(NODE *nptr) {
-    for(int i = 0; i < (2*MAX_SYMBOLS-1); ++i) {
-        nptr->left = NULL;
-        nptr->right = NULL;
-        nptr->parent = NULL;
-        nptr->weight = 0;
-        nptr->symbol = 0;
-        nptr++; // Go to next node
+ * @brief Replaces the code lengths of a block with the optimal lengths
+ * of at most "limit" bits, found with the package-merge algorithm.
+ * @details The leaves sorted by weight form the list of the deepest level.
+ * The list of every level above merges the leaves with packages of pairs
+ * of items of the list below. The 2n-2 lightest items of the top list are
+ * selected, which selects the items of the packages among them in the list
+ * below, and so on; the length of a leaf is the number of lists in which
+ * it is selected. The selected leaves of a list are always the lightest,
+ * so only whether each item is a leaf needs to be recorded.
+ *
+ * @param b Block being compressed, with its Huffman codes built
+ * @param limit Longest code length allowed, with 2^limit >= NUM_SYMBOLS
+*/
+static void
+limit_lengths(BLOCK *b, int limit) {
+    short sym[NUM_SYMBOLS];                 // Leaf symbols, lightest first
+    int weight[NUM_SYMBOLS];                // Leaf weights
+    uint64_t list[2][2*NUM_SYMBOLS];        // Item weights of two levels
+    unsigned char leaf[MAX_CODE_LEN][2*NUM_SYMBOLS]; // Item is a leaf, per level
+    int n = 0;          // Number of leaves
+    int nprev = 0;      // Number of items in the list below
+    int m;              // Number of items selected in the current list
+
+    /* Sort the leaves by weight */
+    for(int s = 0; s < NUM_SYMBOLS; ++s) {
+        if(!(b->codes+s)->len) continue;
+        *(weight+n) = (s == END_SYMBOL) ? 0 : (*(b->node_for_symbol+s))->weight;
+        *(sym+n++) = s;
+    }
+    sort_leaves(weight, sym, n);
+
+    /* Build the lists from the deepest level up */
+    for(int level = limit; level >= 1; --level) {
+        uint64_t *cur = *(list + (level & 1));
+        uint64_t *prev = *(list + !(level & 1));
+        unsigned char *isleaf = *(leaf + level-1);
+        int npkg = nprev / 2, i = 0, k = 0;
+
+        for(m = 0; i < n || k < npkg; ++m) {
+            uint64_t pkg = (k < npkg) ? *(prev+2*k) + *(prev+2*k+1) : 0;
+            if(i < n && (k >= npkg || (uint64_t)*(weight+i) <= pkg)) {
+                *(cur+m) = *(weight+i++);
+                *(isleaf+m) = 1;
+            } else {
+                *(cur+m) = pkg;
+                *(isleaf+m) = 0;
+                k++;
+            }
+        }
+        nprev = m;
     }
 
-    /* Reset node count */
-    num_nodes = 0;
+    /* Count the lists in which every leaf is selected */
+    for(int i = 0; i < n; ++i) (b->codes + *(sym+i))->len = 0;
+    m = 2*n - 2;
+    for(int level = 1; level <= limit && m; ++level) {
+        int nleaves = 0;
+        for(int j = 0; j < m; ++j) nleaves += *(*(leaf + level-1) + j);
+        for(int i = 0; i < nleaves; ++i) (b->codes + *(sym+i))->len++;
+        m = 2 * (m - nleaves);
+    }
 }
 
 /*
- * @brief Reads one block of data from standard input and emits corresponding
- * compressed data to standard output.
- * @details This function reads raw binary data bytes from the standard input
- * until the specified block size has been read or until EOF is reached.
- * It then applies a data compression algorithm to the block and outputs the
- * compressed block to the standard output.  The block size parameter is
- * obtained from the global_options variable.
+ * @brief Appends the lengths of the codes in use as differences.
+ * @details See item 3 of BLOCK_CANONICAL.
  *
- * @return 0 if block compression completes without error, 1 if an error occurs.
- */
-int 
-compress_block() {
-    const unsigned bsz = (unsigned)global_options >> 16; // Current Block Size 
-    unsigned char *cbptr = current_block;                // Pointer to block array
-    int s;              // Holds current character Symbol from stdin
-    int heapnum;        // Number of nodes in the min-heap
-    int done = 0;       // Flag for file compression completion
-    unsigned bbcnt = 0; // Keep track of block byte count
-    
-    NODE *nptr = nodes+1; // Point to 2nd index of nodes array (1st index is END node)
-    num_nodes++;          // Initialize number of nodes to 1 (END node) 
-    
-    /* Read first byte of data to be compressed from standard input */
-    if((s = getchar()) != EOF) { // Get first char from stdin
-        *(cbptr++) = s; // Update current block storage
-        bbcnt++;        // Update Block Byte Count
-    } else {
-        return 1;       // Empty file
+ * @param out Output buffer, with room for the lengths
+ * @param bw Bit buffer
+ * @param cur Previous code length, 0 before the first one
+ * @param codes Code of every symbol
+ * @param n Number of symbols
+ * @return The last code length
+*/
+static int
+put_lengths(OUTBUF *out, BIT_WRITER *bw, int cur, const CODE *codes, int n) {
+    int len;
+
+    for(int s = 0; s < n; ++s) {
+        if(!(len = (codes+s)->len)) continue;
+        if(!cur) put_bits(out, bw, cur = len, 5);
+        for(; cur < len; ++cur) put_bits(out, bw, 0x2, 2);
+        for(; cur > len; --cur) put_bits(out, bw, 0x3, 2);
+        put_bits(out, bw, 0, 1);
     }
 
-    /* Read the remaining data */
-    for(;;) {
-        if((s = getchar()) != EOF) { // Get next char from stdin
-            *(cbptr++) = s; // Update current block storage
-            bbcnt++;        // Update Block Byte Count
-        } 
-        if(bbcnt > bsz || s == EOF) {
-            /* Set "done" flag if End of File reached */
-            if(s == EOF) done = 1;
-            break;
-        }
+    return cur;
+}
+
+/*
+ * @brief Appends a two-byte mask of the codes in use.
+ *
+ * @param out Output buffer, with room for the mask
+ * @param codes Code of every symbol
+ * @param n Number of symbols, at most 16
+*/
+static void
+put_mask(OUTBUF *out, const CODE *codes, int n) {
+    unsigned mask = 0;
+
+    for(int i = 0; i < n; ++i) {
+        if((codes+i)->len) mask |= 0x8000 >> i;
     }
+    out_byte(out, mask >> BYTE);
+    out_byte(out, mask & 0xFF);
+}
 
-    /* Create Symbol Histogram */
-    cbptr = current_block; // Reset pointer to block array
-    for(int i = 0; i < bbcnt; ++i) {
-        s = *(cbptr+i);    // Get the next symbol
-        for(int j = 1; j < (2*MAX_SYMBOLS - 1); ++j) {
-            /* If the symbol already exists in the node array or if it does not */
-            if(nptr->symbol == s || !nptr->symbol) {
-                if(!nptr->symbol)
-                    num_nodes++;  // Increment the node count in the nodes array
-                nptr->symbol = s; // Update Symbol
-                nptr->weight++;   // Incrememnt Symbol occurrence
-                break;
-            }
-            nptr++;     // Go to next node
+/*
+ * @brief Appends the canonical code lengths of a block to its output
+ * buffer.
+ * @details See BLOCK_CANONICAL for the format, and BLOCK_INTERLEAVED,
+ * BLOCK_RLE, BLOCK_LZ and BLOCK_SAMPLED for the blocks that share it.
+ *
+ * @param b Block being compressed
+ * @return 0 on success, 1 if memory could not be allocated
+*/
+static int
+emit_canonical(BLOCK *b) {
+    BIT_WRITER bw = {0, 0};
+    unsigned groups = 0;    // Mask of the groups of 16 byte values in use
+    int cur;                // Previous code length
+
+    /* Marker, masks, and at most 2*MAX_CODE_LEN+1 bits per length */
+    if(out_reserve(&b->out, 7 + 2*16 + (5 + (NUM_SYMBOLS+DIST_CODES)*(2*MAX_CODE_LEN+1))/BYTE + 1))
+        return 1;
+    out_byte(&b->out, b->interleave ? BLOCK_INTERLEAVED : b->matches ? BLOCK_LZ
+                      : b->runs ? BLOCK_RLE : b->escapes ? BLOCK_SAMPLED : BLOCK_CANONICAL);
+
+    /* Emit the masks of the symbols in use */
+    for(int g = 0; g < 16; ++g) {
+        for(int i = 0; i < 16; ++i) {
+            if((b->codes+16*g+i)->len) groups |= 0x8000 >> g;
         }
-        nptr = nodes+1; // Point back to 2nd index
     }
+    out_byte(&b->out, groups >> BYTE);
+    out_byte(&b->out, groups & 0xFF);
+    for(int g = 0; g < 16; ++g) {
+        if(groups & (0x8000 >> g)) put_mask(&b->out, b->codes+16*g, 16);
+    }
+    if(b->runs || b->matches || b->escapes) put_mask(&b->out, b->codes+RUN_SYMBOL(0), RUN_CODES);
+    if(b->matches) put_mask(&b->out, b->dcodes, DIST_CODES);
 
-    heapnum = num_nodes;       // Number of nodes currently in the min-heap
-    num_nodes = 2*num_nodes-1; // Number of nodes to be in Huffman tree of current block
+    /* Emit the code lengths as differences, run symbols after END, then
+       the distance symbols */
+    cur = put_lengths(&b->out, &bw, 0, b->codes, NUM_SYMBOLS);
+    if(b->matches) put_lengths(&b->out, &bw, cur, b->dcodes, DIST_CODES);
+    flush_bits(&b->out, &bw);
+
+    return 0;
+}
 
-    /* Histogram to Min-Heap */
-    for(int i = heapnum/2; i >= 0; i--) {
-        min_heapify(i, heapnum);
+/*
+ * @brief Computes the number of bits of the coded data of a block.
+ *
+ * @param b Block being compressed, with its codes built
+ * @return Number of bits, including the END code
+*/
+static uint64_t
+code_bits(BLOCK *b) {
+    uint64_t total = (b->codes+END_SYMBOL)->len;
+
+    if(b->runs || b->matches) {
+        total += b->rbits;
+        for(int s = 0; s < NUM_SYMBOLS; ++s)
+            total += (uint64_t)*(b->rhist+s) * (b->codes+s)->len;
+        for(int d = 0; b->matches && d < DIST_CODES; ++d)
+            total += (uint64_t)*(b->dhist+d) * (b->dcodes+d)->len;
+        return total;
     }
 
-    /* Huffman Tree Construction */
-    int n = num_nodes; // Copy of the number of nodes 
-    /* Repeatedly remove 2 minimum weight nodes until Huffman Tree Constructed */
-    while(remove_min(&heapnum, &n));
+    for(int s = 0; s < END_SYMBOL; ++s)
+        total += (uint64_t)*(b->hist+s) * (b->codes+s)->len;
 
-    /* Set Parent Node Pointers & populate node_for_symbol array */ 
-    set_parents(nodes, nodes);
-    nodes->parent = NULL; // Root has no parent
-    
-    /* Output the Huffman Tree Description */
-    emit_huffman_tree();
+    return total;
+}
 
-    /* Output compressed data bits */
-    encode(bbcnt);
+/*
+ * @brief Estimates the compressed size of a block from a histogram.
+ * @details The Shannon entropy of the histogram bounds the size of the
+ * coded data from below. A quarter of a byte per symbol in use is added
+ * for the code description and for the rounding of code lengths to whole
+ * bits, which is less than either costs in a block with many symbols.
+ *
+ * @param hist Number of occurrences of every symbol
+ * @param n Number of symbols in hist
+ * @return Estimated number of bytes
+*/
+static uint64_t
+estimate_size(const uint32_t *hist, int n) {
+    double bits = 0;    // Entropy of the block in bits
+    uint64_t total = 0; // Number of symbols counted
+    int nsym = 0;       // Number of symbols in use
+
+    for(int s = 0; s < n; ++s) total += *(hist+s);
+    for(int s = 0; s < n; ++s) {
+        uint32_t c = *(hist+s);
+        if(!c) continue;
+        bits += c * log2((double)total / c);
+        nsym++;
+    }
 
-    return done;
+    return (uint64_t)(bits / BYTE) + nsym/4;
 }
 
 /*
- * @brief Reads raw data from standard input, writes compressed data to
- * standard output.
- * @details This function reads raw binary data bytes from the standard input in
- * blocks of up to a specified maximum number of bytes or until EOF is reached,
- * it applies a data compression algorithm to each block, and it outputs the
- * compressed blocks to standard output.  The block size parameter is obtained
- * from the global_options variable.
+ * @brief Finds the run symbol that codes the start of a run.
  *
- * @return 0 if compression completes without error, 1 if an error occurs.
- */
-int 
-compress() {
-    /* Compress all blocks */
-    do {
-        /* Reset Nodes Array */
-        res_nodes(nodes);
-    } while(!(compress_block()));
+ * @param run Number of repeats left in the run, at least RUN_MIN
+ * @param k Set to the number of the run symbol
+ * @return Number of repeats the run symbol codes
+*/
+static inline unsigned
+run_class(unsigned run, int *k) {
+    for(*k = 0; *k < RUN_CODES-1 && run >= (unsigned)(2*RUN_MIN << *k); ++*k);
+    return run < (unsigned)(2*RUN_MIN << *k) ? run : (2*RUN_MIN << *k) - 1;
+}
 
-    /* Check for IO error */
-    if(ferror(stdin)) return 1;
+/*
+ * @brief Counts the symbols of a block whose runs are coded with run
+ * symbols.
+ * @details A run codes its first byte as a literal and the repeats that
+ * follow with run symbols, down to fewer than RUN_MIN repeats, which are
+ * coded as literals.
+ *
+ * @param b Block being compressed
+*/
+static void
+count_runs(BLOCK *b) {
+    const unsigned char *data = b->data;
+    unsigned i = 0, j, run;
+    int k;
+
+    for(int s = 0; s < NUM_SYMBOLS; ++s) *(b->rhist+s) = 0;
+    b->rbits = 0;
+
+    while(i < b->size) {
+        for(j = i+1; j < b->size && *(data+j) == *(data+i); ++j);
+        run = j - i - 1;
+        while(run >= RUN_MIN) {
+            run -= run_class(run, &k);
+            (*(b->rhist+RUN_SYMBOL(k)))++;
+            b->rbits += k + RUN_MIN_BITS;
+        }
+        *(b->rhist + *(data+i)) += 1 + run;
+        i = j;
+    }
+}
+
+/*
+ * @brief Finds the distance symbol of a match.
+ *
+ * @param dist Distance of the match, at least 1
+ * @return Number of the distance symbol, which is also its number of
+ * extra bits
+*/
+static inline int
+dist_class(unsigned dist) {
+    int d = 0;
 
-    /* Check if EOF is reached */
-    if(feof(stdin)) return 0;
+    while(dist >> (d+1)) d++;
 
-    return 0;
+    return d;
 }
 
 /*
- * @brief Use a stack to rebuild the Huffman Tree
- * according to the bit sequence in the Tree
- * description.
- * @details When the bit_val is 0 a new leaf is created and pushed on the stack.
- * If it is 1 then two nodes are popped and are made children of a new node.
- * 
- * @param bit_val - Scanned bit value used to determine direction of child nodes
- * @param sp - Stack pointer
- * @param nnum - Current number of nodes
+ * @brief Counts the symbols of a block coded as the tokens of lz_parse().
+ * @details The length of a match is coded with a run symbol, as in
+ * count_runs().
+ *
+ * @param b Block being compressed, with its tokens
+ * @return Number of matches
+*/
+static unsigned
+count_matches(BLOCK *b) {
+    unsigned nmatch = 0;
+    int k, d;
+
+    for(int s = 0; s < NUM_SYMBOLS; ++s) *(b->rhist+s) = 0;
+    for(d = 0; d < DIST_CODES; ++d) *(b->dhist+d) = 0;
+    b->rbits = 0;
+
+    for(unsigned i = 0; i < b->ntokens; ++i) {
+        uint32_t t = *(b->tokens+i);
+        if(!LZ_IS_MATCH(t)) {
+            (*(b->rhist+t))++;
+            continue;
+        }
+        run_class(LZ_MATCH_LEN(t), &k);
+        d = dist_class(LZ_MATCH_DIST(t));
+        (*(b->rhist+RUN_SYMBOL(k)))++;
+        (*(b->dhist+d))++;
+        b->rbits += k + RUN_MIN_BITS + d;
+        nmatch++;
+    }
+
+    return nmatch;
+}
+
+/*
+ * @brief Replaces the contents of a block's output buffer with the block
+ * stored raw.
+ *
+ * @param b Block being compressed
+ * @return 0 on success, 1 if memory could not be allocated
+*/
+static int
+emit_stored(BLOCK *b) {
+    b->out.len = 0;
+    if(out_reserve(&b->out, STORED_HEADER_SIZE + b->size)) return 1;
+
+    out_byte(&b->out, BLOCK_STORED);
+    for(int i = 3; i >= 0; --i) out_byte(&b->out, (b->size >> (BYTE*i)) & 0xFF);
+    b->desc_len = b->out.len;
+    for(unsigned i = 0; i < b->size; ++i) *(b->out.buf+b->out.len+i) = *(b->data+i);
+    b->out.len += b->size;
+
+    return 0;
+}
+
+/*
+ * Bit accumulator of the encoders, which write whole 32-bit words.
+ */
+typedef struct word_writer {
+    uint64_t acc;   // Pending bits, right-aligned
+    int nbits;      // Number of pending bits, less than 32
+} WORD_WRITER;
+
+/*
+ * @brief Shifts bits into the accumulator. Whenever 32 or more bits are
+ * pending, a whole 32-bit word is moved to the output.
+ *
+ * @param ww Bit accumulator
+ * @param v Bits, right-aligned
+ * @param n Number of bits (at most 32)
+ * @param optr Output, with room for the word
+ * @return The end of the output
+*/
+static inline unsigned char *
+put_word_bits(WORD_WRITER *ww, uint32_t v, int n, unsigned char *optr) {
+    ww->acc = (ww->acc << n) | v;
+    ww->nbits += n;
+
+    /* Flush a whole word */
+    if(ww->nbits >= 32) {
+        ww->nbits -= 32;
+        uint32_t word = ww->acc >> ww->nbits;
+        *optr++ = word >> 24;
+        *optr++ = word >> 16;
+        *optr++ = word >> 8;
+        *optr++ = word;
+    }
+
+    return optr;
+}
+
+/*
+ * @brief Moves the pending bits to the output, zero-padded to a whole
+ * byte.
+ *
+ * @param ww Bit accumulator
+ * @param optr Output, with room for the bits
+ * @return The end of the output
+*/
+static unsigned char *
+flush_word_bits(WORD_WRITER *ww, unsigned char *optr) {
+    /* Zero-padding the last byte in the bit sequence to make it a multiple of 8 bits */
+    if(ww->nbits % BYTE) {
+        ww->acc <<= BYTE - ww->nbits % BYTE;
+        ww->nbits += BYTE - ww->nbits % BYTE;
+    }
+    while(ww->nbits) {
+        ww->nbits -= BYTE;
+        *optr++ = ww->acc >> ww->nbits;
+    }
+
+    return optr;
+}
+
+/*
+ * @brief Encodes a run of bytes as a zero-padded bit stream.
+ * @details Looks up the code of every byte in the code table and shifts
+ * it into a 64-bit accumulator.
+ *
+ * @param codes Code table
+ * @param data Bytes to encode
+ * @param n Number of bytes
+ * @param end Set to encode the END symbol after the last byte
+ * @param optr Output, with room for all the coded bits
+ * @return The end of the output
+*/
+static unsigned char *
+encode_run(const CODE *codes, const unsigned char *data, unsigned n, int end,
+           unsigned char *optr) {
+    WORD_WRITER ww = {0, 0};
+    const CODE *c;      // Code of the current symbol
+
+    for(unsigned i = 0; i < n + (end != 0); ++i) {
+        /* Encode END symbol after the last character */
+        c = (i < n) ? codes + *(data+i) : codes + END_SYMBOL;
+        optr = put_word_bits(&ww, c->bits, c->len, optr);
+    }
+
+    return flush_word_bits(&ww, optr);
+}
+
+/*
+ * @brief Output the compressed data representing the 
+ * uncompressed data.
+ * @details The output buffer is sized beforehand from the symbol weights.
+ * 
+ * @param b Block being compressed
+ * @return 0 on success, 1 if memory could not be allocated
+*/
+static int
+encode(BLOCK *b) {
+    unsigned char *optr;
+
+    if(out_reserve(&b->out, (code_bits(b)+BYTE-1)/BYTE + 4)) return 1;
+    b->desc_len = b->out.len;
+    optr = encode_run(b->codes, b->data, b->size, 1, b->out.buf + b->out.len);
+    b->out.len = optr - b->out.buf;
+
+    return 0;
+}
+
+/*
+ * @brief Output the compressed data of a block whose runs are coded with
+ * run symbols.
+ * @details Runs are split into symbols as in count_runs().
+ *
+ * @param b Block being compressed
+ * @return 0 on success, 1 if memory could not be allocated
+*/
+static int
+encode_runs(BLOCK *b) {
+    const unsigned char *data = b->data;
+    WORD_WRITER ww = {0, 0};
+    const CODE *lit;    // Code of the byte of the current run
+    const CODE *c;      // Code of a run symbol
+    unsigned char *optr;
+    unsigned i = 0, j, run, len;
+    int k;
+
+    if(out_reserve(&b->out, (code_bits(b)+BYTE-1)/BYTE + 4)) return 1;
+    b->desc_len = b->out.len;
+    optr = b->out.buf + b->out.len;
+
+    while(i < b->size) {
+        for(j = i+1; j < b->size && *(data+j) == *(data+i); ++j);
+        run = j - i - 1;
+        lit = b->codes + *(data+i);
+        optr = put_word_bits(&ww, lit->bits, lit->len, optr);
+        while(run >= RUN_MIN) {
+            run -= len = run_class(run, &k);
+            c = b->codes + RUN_SYMBOL(k);
+            optr = put_word_bits(&ww, c->bits, c->len, optr);
+            optr = put_word_bits(&ww, len - (RUN_MIN << k), k + RUN_MIN_BITS, optr);
+        }
+        for(; run; --run) optr = put_word_bits(&ww, lit->bits, lit->len, optr);
+        i = j;
+    }
+    c = b->codes + END_SYMBOL;
+    optr = put_word_bits(&ww, c->bits, c->len, optr);
+    b->out.len = flush_word_bits(&ww, optr) - b->out.buf;
+
+    return 0;
+}
+
+/*
+ * @brief Output the compressed data of a block coded as the tokens of
+ * lz_parse().
+ *
+ * @param b Block being compressed
+ * @return 0 on success, 1 if memory could not be allocated
+*/
+static int
+encode_matches(BLOCK *b) {
+    WORD_WRITER ww = {0, 0};
+    const CODE *c;      // Code of the current symbol
+    unsigned char *optr;
+    unsigned len, dist;
+    int k, d;
+
+    if(out_reserve(&b->out, (code_bits(b)+BYTE-1)/BYTE + 4)) return 1;
+    b->desc_len = b->out.len;
+    optr = b->out.buf + b->out.len;
+
+    for(unsigned i = 0; i < b->ntokens; ++i) {
+        uint32_t t = *(b->tokens+i);
+        if(!LZ_IS_MATCH(t)) {
+            c = b->codes + t;
+            optr = put_word_bits(&ww, c->bits, c->len, optr);
+            continue;
+        }
+        len = LZ_MATCH_LEN(t);
+        dist = LZ_MATCH_DIST(t);
+        run_class(len, &k);
+        d = dist_class(dist);
+        c = b->codes + RUN_SYMBOL(k);
+        optr = put_word_bits(&ww, c->bits, c->len, optr);
+        optr = put_word_bits(&ww, len - (RUN_MIN << k), k + RUN_MIN_BITS, optr);
+        c = b->dcodes + d;
+        optr = put_word_bits(&ww, c->bits, c->len, optr);
+        optr = put_word_bits(&ww, dist - (1u << d), d, optr);
+    }
+    c = b->codes + END_SYMBOL;
+    optr = put_word_bits(&ww, c->bits, c->len, optr);
+    b->out.len = flush_word_bits(&ww, optr) - b->out.buf;
+
+    return 0;
+}
+
+/*
+ * Number of bytes of a sampled block encoded between checks of the room
+ * left in the output buffer.
+ */
+#define SAMPLE_CHUNK    4096
+
+/*
+ * @brief Output the compressed data of a block whose code was built from
+ * a sample, escaping the bytes without a code.
+ * @details The coded size is not known beforehand, so the output buffer is
+ * grown every SAMPLE_CHUNK bytes for the longest code a byte can take.
+ *
+ * @param b Block being compressed
+ * @return 0 on success, 1 if memory could not be allocated
+*/
+static int
+encode_sampled(BLOCK *b) {
+    const CODE *esc = b->codes + ESCAPE_SYMBOL;
+    WORD_WRITER ww = {0, 0};
+    const CODE *c;      // Code of the current byte
+    unsigned char *optr;
+    int most = esc->len + BYTE; // Longest code of a byte
+
+    for(int s = 0; s < MAX_SYMBOLS; ++s) {
+        if((b->codes+s)->len > most) most = (b->codes+s)->len;
+    }
+
+    b->desc_len = b->out.len;
+    for(unsigned i = 0; i < b->size; i += SAMPLE_CHUNK) {
+        const unsigned end = b->size - i < SAMPLE_CHUNK ? b->size : i + SAMPLE_CHUNK;
+        if(out_reserve(&b->out, (SAMPLE_CHUNK * most + BYTE-1)/BYTE + 8)) return 1;
+        optr = b->out.buf + b->out.len;
+        for(unsigned j = i; j < end; ++j) {
+            c = b->codes + *(b->data+j);
+            if(c->len) {
+                optr = put_word_bits(&ww, c->bits, c->len, optr);
+                continue;
+            }
+            optr = put_word_bits(&ww, esc->bits, esc->len, optr);
+            optr = put_word_bits(&ww, *(b->data+j), BYTE, optr);
+        }
+        b->out.len = optr - b->out.buf;
+    }
+    c = b->codes + END_SYMBOL;
+    optr = put_word_bits(&ww, c->bits, c->len, b->out.buf + b->out.len);
+    b->out.len = flush_word_bits(&ww, optr) - b->out.buf;
+
+    return 0;
+}
+
+/*
+ * @brief Stores a value as four bytes in big-endian order.
+ *
+ * @param buf Destination
+ * @param v Value
+*/
+static void
+put_be32(unsigned char *buf, uint32_t v) {
+    for(int i = 0; i < 4; ++i) *(buf+i) = v >> (BYTE*(3-i));
+}
+
+/*
+ * @brief Output the compressed data of a block as INTERLEAVE_STREAMS
+ * streams, after the raw length and the jump table.
+ * @details See BLOCK_INTERLEAVED for the format.
+ *
+ * @param b Block being compressed, with its code lengths emitted
+ * @return 0 on success, 1 if memory could not be allocated
+*/
+static int
+encode_interleaved(BLOCK *b) {
+    const unsigned q = (b->size + INTERLEAVE_STREAMS-1) / INTERLEAVE_STREAMS; // Bytes per stream
+    unsigned char *jump, *optr, *sptr;
+
+    if(out_reserve(&b->out, INTERLEAVED_HEADER_SIZE + (code_bits(b)+BYTE-1)/BYTE
+                            + INTERLEAVE_STREAMS)) return 1;
+    put_be32(b->out.buf + b->out.len, b->size);
+    b->desc_len = b->out.len + INTERLEAVED_HEADER_SIZE;
+    jump = b->out.buf + b->out.len + 4;
+    optr = b->out.buf + b->out.len + INTERLEAVED_HEADER_SIZE;
+
+    for(int i = 0; i < INTERLEAVE_STREAMS; ++i) {
+        unsigned from = i*q < b->size ? i*q : b->size;
+        unsigned to = from + q < b->size ? from + q : b->size;
+        sptr = optr;
+        optr = encode_run(b->codes, b->data + from, to - from, 0, optr);
+        put_be32(jump + 4*i, optr - sptr);
+    }
+    b->out.len = optr - b->out.buf;
+
+    return 0;
+}
+
+/*
+ * @brief Resets the nodes array.
+ * @details Sets all the pointers in the NODE structs to NULL and 
+ * resets the weight and symbol members to 0, in the nodes used since
+ * the last reset only.
+ */
+void 
+res_nodes(BLOCK *b) {
+    NODE *nptr = b->nodes;
+
+    for(int i = 0; i < b->used_nodes; ++i) {
+        nptr->left = NULL;
+        nptr->right = NULL;
+        nptr->parent = NULL;
+        nptr->weight = 0;
+        nptr->symbol = 0;
+        nptr++; // Go to next node
+    }
+    b->used_nodes = 0;
+}
+
+/*
+ * Allocate a new BLOCK with room for MAX_BLOCK_SIZE bytes of data.
+ */
+BLOCK *
+block_init() {
+    BLOCK *b = calloc(1, sizeof(BLOCK));
+    if(b == NULL) return NULL;
+
+    b->data = malloc(MAX_BLOCK_SIZE);
+    b->nodes = malloc((2*NUM_SYMBOLS-1) * sizeof(NODE));
+    b->node_for_symbol = malloc(NUM_SYMBOLS * sizeof(NODE *));
+    b->dtab = malloc(DTAB_SIZE * sizeof(DTAB_ENTRY));
+    if(b->data == NULL || b->nodes == NULL || b->node_for_symbol == NULL
+       || b->dtab == NULL) {
+        block_fini(b);
+        return NULL;
+    }
+    b->used_nodes = 2*NUM_SYMBOLS-1;    // None of them reset yet
+
+    return b;
+}
+
+/*
+ * Free a BLOCK allocated by block_init().
+ */
+void
+block_fini(BLOCK *b) {
+    free(b->data);
+    free(b->nodes);
+    free(b->node_for_symbol);
+    free(b->dtab);
+    free(b->out.buf);
+    free(b->payload.buf);
+    free(b->tokens);
+    free(b->head);
+    free(b->chain);
+    free(b->sync);
+    free(b);
+}
+
+/*
+ * @brief Finds the static table that codes a block in the fewest bytes.
+ *
+ * @param b Block being compressed, with its histogram built
+ * @param size Set to the size of the block coded with that table
+ * @return Number of the table, or -1 if static tables are not used
+*/
+static int
+best_static(BLOCK *b, uint64_t *size) {
+    const unsigned char *len;
+    int best = -1;
+
+    if(!b->use_static) return -1;
+    for(int id = 0; id < NUM_TABLES; ++id) {
+        if((len = table_lengths(id)) == NULL) continue;
+        uint64_t bits = *(len+END_SYMBOL);
+        for(int s = 0; s < 256; ++s) bits += (uint64_t)*(b->hist+s) * *(len+s);
+        uint64_t bytes = STATIC_HEADER_SIZE + (bits+BYTE-1)/BYTE;
+        if(best < 0 || bytes < *size) {
+            best = id;
+            *size = bytes;
+        }
+    }
+
+    return best;
+}
+
+/*
+ * @brief Replaces the contents of a block's output buffer with the block
+ * coded with a static table.
+ *
+ * @param b Block being compressed
+ * @param id Number of the table
+ * @return 0 on success, 1 if memory could not be allocated
+*/
+static int
+emit_static(BLOCK *b, int id) {
+    const unsigned char *len = table_lengths(id);
+
+    b->runs = b->matches = 0;
+    for(int s = 0; s < NUM_SYMBOLS; ++s) (b->codes+s)->len = s < MAX_SYMBOLS ? *(len+s) : 0;
+    if(canonical_codes(b)) return 1;
+
+    b->out.len = 0;
+    if(out_reserve(&b->out, STATIC_HEADER_SIZE)) return 1;
+    out_byte(&b->out, BLOCK_STATIC);
+    out_byte(&b->out, id);
+
+    return encode(b);
+}
+
+/*
+ * @brief Computes the size of a block coded with the previous code.
+ *
+ * @param b Block being compressed, with its histogram built
+ * @param size Set to the size of the block coded with the previous code
+ * @return 0 on success, 1 if the previous code cannot be repeated or
+ * lacks a symbol of the block
+*/
+static int
+repeat_size(BLOCK *b, uint64_t *size) {
+    uint64_t bits;
+
+    if(!b->reuse || !b->has_prev || b->interleave) return 1;
+
+    bits = (b->prev+END_SYMBOL)->len;
+    for(int s = 0; s < 256; ++s) {
+        if(!*(b->hist+s)) continue;
+        if(!(b->prev+s)->len) return 1;
+        bits += (uint64_t)*(b->hist+s) * (b->prev+s)->len;
+    }
+    *size = 1 + (bits+BYTE-1)/BYTE;
+
+    return 0;
+}
+
+/*
+ * @brief Replaces the contents of a block's output buffer with the block
+ * coded with the previous code.
+ *
+ * @param b Block being compressed
+ * @return 0 on success, 1 if memory could not be allocated
+*/
+static int
+emit_repeat(BLOCK *b) {
+    b->runs = b->matches = 0;
+    for(int s = 0; s < NUM_SYMBOLS; ++s) *(b->codes+s) = *(b->prev+s);
+
+    b->out.len = 0;
+    if(out_reserve(&b->out, 1)) return 1;
+    out_byte(&b->out, BLOCK_REPEAT);
+
+    return encode(b);
+}
+
+/*
+ * @brief Finds the number of bits of a value.
+ *
+ * @param v The value
+ * @return Number of bits up to the highest bit set, 0 for 0
+*/
+static inline int
+bit_length(uint32_t v) {
+    int n = 0;
+
+    for(; v; v >>= 1) n++;
+    return n;
+}
+
+/*
+ * @brief Computes the size of a block coded with tANS.
+ *
+ * @param b Block being compressed, with its histogram built
+ * @param norm Set to the normalized count of every byte value
+ * @param size Set to the size of the block coded with tANS
+ * @return Table log, or 0 if tANS is not used
+*/
+static int
+ans_size(BLOCK *b, uint16_t *norm, uint64_t *size) {
+    unsigned groups = 0;    // Mask of the groups of 16 byte values in use
+    int nsym = 0;           // Number of byte values in use
+    uint64_t bits = 0;      // Bits of the normalized counts
+    uint32_t left;          // Sum of the counts left
+    int lg;
+
+    if(!b->ans || b->interleave || !b->size) return 0;
+
+    for(int s = 0; s < 256; ++s) {
+        if(!*(b->hist+s)) continue;
+        nsym++;
+        groups |= 0x8000 >> (s/16);
+    }
+    lg = ans_table_log(b->size, nsym);
+    ans_normalize(b->hist, lg, norm);
+
+    left = 1u << lg;
+    for(int s = 0, m = nsym; m > 1; ++s) {
+        if(!*(norm+s)) continue;
+        bits += bit_length(left - m);
+        left -= *(norm+s);
+        m--;
+    }
+    *size = 1 + ANS_HEADER_SIZE + 2 + (bits+BYTE-1)/BYTE
+            + (ans_cost(b->hist, lg, norm) + lg + 1 + BYTE-1)/BYTE;
+    for(; groups; groups &= groups - 1) *size += 2;
+
+    return lg;
+}
+
+/*
+ * @brief Replaces the contents of a block's output buffer with the block
+ * coded with tANS.
+ * @details See BLOCK_ANS for the format.
+ *
+ * @param b Block being compressed
+ * @param lg Table log
+ * @param norm Normalized count of every byte value
+ * @return 0 on success, 1 if memory could not be allocated
+*/
+static int
+emit_ans(BLOCK *b, int lg, const uint16_t *norm) {
+    BIT_WRITER bw = {0, 0};
+    unsigned groups = 0;    // Mask of the groups of 16 byte values in use
+    unsigned char *hdr;     // Raw length, stream size and table log
+    uint32_t left = 1u << lg;
+    int nsym = 0;
+    size_t n;
+
+    b->runs = b->matches = 0;
+    b->out.len = 0;
+    if(out_reserve(&b->out, 1 + ANS_HEADER_SIZE + 2 + 2*16 + 256*2 + ANS_BOUND(b->size, lg)))
+        return 1;
+    out_byte(&b->out, BLOCK_ANS);
+    hdr = b->out.buf + b->out.len;
+    b->out.len += ANS_HEADER_SIZE;
+    put_be32(hdr, b->size);
+    *(hdr+8) = lg;
+
+    /* Emit the masks of the byte values in use */
+    for(int s = 0; s < 256; ++s) {
+        if(!*(norm+s)) continue;
+        groups |= 0x8000 >> (s/16);
+        nsym++;
+    }
+    out_byte(&b->out, groups >> BYTE);
+    out_byte(&b->out, groups & 0xFF);
+    for(int g = 0; g < 16; ++g) {
+        unsigned mask = 0;
+        if(!(groups & (0x8000 >> g))) continue;
+        for(int i = 0; i < 16; ++i) {
+            if(*(norm+16*g+i)) mask |= 0x8000 >> i;
+        }
+        out_byte(&b->out, mask >> BYTE);
+        out_byte(&b->out, mask & 0xFF);
+    }
+
+    /* Emit the counts, but the last */
+    for(int s = 0; nsym > 1; ++s) {
+        if(!*(norm+s)) continue;
+        put_bits(&b->out, &bw, *(norm+s) - 1, bit_length(left - nsym));
+        left -= *(norm+s);
+        nsym--;
+    }
+    flush_bits(&b->out, &bw);
+    b->desc_len = b->out.len;
+
+    n = ans_encode(norm, lg, b->data, b->size, b->out.buf + b->out.len);
+    put_be32(hdr+4, n);
+    b->out.len += n;
+
+    return 0;
+}
+
+/*
+ * @brief Gets the size of the sync points that keep_code() puts in front
+ * of a canonical, static or repeat block.
+ *
+ * @param b Block being compressed
+ * @return The size of the sync points, 0 if the block has none
+*/
+static uint64_t
+sync_size(const BLOCK *b) {
+    if(!b->sync_every || b->size <= b->sync_every) return 0;
+
+    return 1 + SYNC_HEADER_SIZE + 4*(uint64_t)((b->size - 1) / b->sync_every);
+}
+
+/*
+ * @brief Codes a block with tANS, the previous code or the best static
+ * table, or stores it, whichever is smallest, if that is smaller than
+ * "size" bytes, counting the sync points of the static and repeat blocks.
+ *
+ * @param b Block being compressed, with its histogram built
+ * @param size Size of the block as coded so far
+ * @return 0 if the block was coded or stored, 1 if memory could not be
+ * allocated, -1 if none of them is smaller
+*/
+static int
+cheaper_block(BLOCK *b, uint64_t size) {
+    const uint64_t stored = STORED_HEADER_SIZE + b->size;
+    uint16_t norm[256];     // Normalized counts of tANS
+    uint64_t tans;          // Size with tANS
+    uint64_t fixed;         // Size with the best static table
+    uint64_t again;         // Size with the previous code
+    int id = best_static(b, &fixed);
+    int rep = !repeat_size(b, &again);
+    int lg = ans_size(b, norm, &tans);
+
+    if(id >= 0) fixed += sync_size(b);
+    if(rep) again += sync_size(b);
+
+    if(lg && tans < size && tans < stored && (id < 0 || tans < fixed)
+       && (!rep || tans < again)) return emit_ans(b, lg, norm);
+    if(rep && again < size && again < stored
+       && (id < 0 || again <= fixed)) return emit_repeat(b);
+    if(id >= 0 && fixed < size && fixed < stored) return emit_static(b, id);
+    if(stored <= size) return emit_stored(b);
+
+    return -1;
+}
+
+/*
+ * @brief Appends the coded data of a block to its code description, or
+ * codes it with a code at hand or stores it if that would be smaller.
+ *
+ * @param b Block being compressed, with its code description emitted
+ * @return 0 on success, 1 if memory could not be allocated
+*/
+static int
+encode_or_store(BLOCK *b) {
+    size_t extra = b->interleave ? INTERLEAVED_HEADER_SIZE : 0; // Jump table
+
+    phase_end(b, PHASE_EMIT);
+
+    /* The histogram of a sampled block is not exact: code it, then see */
+    if(b->escapes) {
+        if(encode_sampled(b)) return 1;
+        return b->out.len < STORED_HEADER_SIZE + b->size ? 0 : emit_stored(b);
+    }
+
+    /* Only blocks of one symbol per byte get sync points */
+    size_t sync = (b->interleave || b->matches || b->runs) ? 0 : sync_size(b);
+    int ret = cheaper_block(b, b->out.len + extra + sync + (code_bits(b)+BYTE-1)/BYTE);
+
+    if(ret >= 0) return ret;
+    if(b->matches) return encode_matches(b);
+    if(b->runs) return encode_runs(b);
+
+    return b->interleave ? encode_interleaved(b) : encode(b);
+}
+
+/*
+ * @brief Builds the histogram of a block from every SAMPLE_STRIDE-th byte.
+ * @details The counts are scaled up to the size of the block. The escape
+ * symbol weighs as much as one byte of the sample, so it always has a code
+ * for the byte values that the sample missed.
+ *
+ * @param b Block being compressed
+*/
+static void
+sample_histogram(BLOCK *b) {
+    for(int s = 0; s < NUM_SYMBOLS; ++s) *(b->rhist+s) = 0;
+    for(unsigned i = 0; i < b->size; i += SAMPLE_STRIDE) (*(b->rhist + *(b->data+i)))++;
+    for(int s = 0; s < 256; ++s) *(b->hist+s) = *(b->rhist+s) *= SAMPLE_STRIDE;
+    *(b->rhist+ESCAPE_SYMBOL) = SAMPLE_STRIDE;
+    b->escapes = 1;
+}
+
+/*
+ * @brief Builds the distance code of a block from its distance histogram.
+ * @details The Huffman tree of the distance symbols is built in the nodes
+ * of the block, which are then reset for the tree of the literal/length
+ * symbols. A code needs two symbols, so a single distance symbol in use
+ * is given a one-bit code along with a neighbour.
+ *
+ * @param b Block being compressed, with its distance histogram built and
+ * at least one match
+ * @param limit Longest code length allowed
+ * @return 0 on success, 1 if the lengths do not describe a complete code
+*/
+static int
+dist_code(BLOCK *b, int limit) {
+    NODE *nptr = b->nodes;
+    int n = 0;          // Number of distance symbols in use
+    int depth = 0;
+
+    for(int d = 0; d < DIST_CODES; ++d) {
+        (b->dcodes+d)->len = 0;
+        if(!*(b->dhist+d)) continue;
+        nptr->symbol = d;
+        nptr->weight = *(b->dhist+d);
+        nptr++;
+        n++;
+    }
+    if(n > b->used_nodes) b->used_nodes = n;
+    if(n == 1) {
+        int d = b->nodes->symbol;
+        (b->dcodes+d)->len = (b->dcodes+(d^1))->len = 1;
+        res_nodes(b);
+        return canonical_dist_codes(b);
+    }
+
+    build_tree(b, n);
+    build_codes(b, b->nodes, 0, 0);
+    for(int d = 0; d < DIST_CODES; ++d) {
+        if((b->codes+d)->len > depth) depth = (b->codes+d)->len;
+    }
+    if(depth > limit) limit_lengths(b, limit);
+
+    /* Move the lengths over and leave the nodes and codes reset */
+    for(int d = 0; d < DIST_CODES; ++d) {
+        (b->dcodes+d)->len = (b->codes+d)->len;
+        (b->codes+d)->len = 0;
+        *(b->node_for_symbol+d) = NULL;
+    }
+    res_nodes(b);
+
+    return canonical_dist_codes(b);
+}
+
+/*
+ * @brief Compresses the data of a block into its output buffer.
+ * @details Builds the symbol histogram and the Huffman tree of the block,
+ * then emits the tree description followed by the encoded data. A block
+ * whose entropy shows that it will not shrink is stored right away,
+ * without building its tree. Runs are coded with run symbols, or the
+ * block as the literals and matches of lz_parse(), when the entropy of
+ * the symbols and their extra bits is the smaller.
+ *
+ * @param b Block, with data and size set
+ * @return 0 on success, 1 if memory could not be allocated
+ */
+static int
+code_block(BLOCK *b) {
+    NODE *nptr = b->nodes+1; // Point to 2nd index of nodes array (1st index is END node)
+
+    /* Reset Nodes Array */
+    res_nodes(b);
+    for(int i = 0; i < MAX_SYMBOLS; ++i) *(b->node_for_symbol+i) = NULL;
+    for(int i = 0; i < NUM_SYMBOLS; ++i) (b->codes+i)->len = 0;
+    b->out.len = 0;
+    b->runs = 0;
+    b->matches = 0;
+    b->escapes = 0;
+
+    /* Create Symbol Histogram, from a sample of a large block */
+    if(b->sample && b->size >= SAMPLE_MIN_SIZE && !b->interleave && !b->rle && !b->lz
+       && !b->ans && !b->sync_every) {
+        sample_histogram(b);
+    } else {
+        histogram(b->data, b->size, b->hist);
+    }
+    uint64_t estimate = estimate_size(b->hist, 256);
+
+    /* Code runs with run symbols, or matches, whichever is the smallest;
+       they take their masks and extra bits. Both count into rhist, so
+       runs are counted again if they win over matches. */
+    if(b->rle && !b->interleave) {
+        count_runs(b);
+        uint64_t rle = estimate_size(b->rhist, NUM_SYMBOLS) + 2 + (b->rbits+BYTE-1)/BYTE;
+        if(rle < estimate) {
+            b->runs = 1;
+            estimate = rle;
+        }
+    }
+    if(b->lz && !b->interleave) {
+        if(lz_parse(b)) return 1;
+        unsigned nmatch = count_matches(b);
+        uint64_t lz = estimate_size(b->rhist, NUM_SYMBOLS) + 4 + (b->rbits+BYTE-1)/BYTE
+                      + estimate_size(b->dhist, DIST_CODES);
+        if(nmatch && lz < estimate) {
+            b->runs = 0;
+            b->matches = 1;
+            estimate = lz;
+        } else if(b->runs) {
+            count_runs(b);
+        }
+    }
+    const int nsym = (b->runs || b->matches || b->escapes) ? NUM_SYMBOLS : 256;
+    const uint32_t *hist = (nsym == NUM_SYMBOLS) ? b->rhist : b->hist;
+    phase_end(b, PHASE_HISTOGRAM);
+
+    /* Incompressible block, unless a code at hand codes it */
+    if(estimate >= STORED_HEADER_SIZE + b->size)
+        return b->escapes ? emit_stored(b) : cheaper_block(b, STORED_HEADER_SIZE + b->size);
+
+    /* Codes longer than the limit: only the canonical description can be used.
+       Only blocks larger than MAX_BLOCK_SIZE can exceed MAX_CODE_LEN. */
+    int limit = b->max_len ? b->max_len : MAX_CODE_LEN;
+    if(b->matches && dist_code(b, limit)) return 1;
+
+    /* With -u, the byte values seen earlier in the stream get codes too, so
+       that the next blocks can repeat the code */
+    const int cover = b->reuse && nsym == 256 && !b->interleave;
+    for(int s = 0; cover && s < 256; ++s) {
+        if(*(hist+s)) *(b->seen+s) = 1;
+    }
+
+    /* One leaf node for every symbol in the block */
+    b->num_nodes = 1;   // Initialize number of nodes to 1 (END node) 
+    for(int s = 0; s < nsym; ++s) {
+        if(s == END_SYMBOL || (!*(hist+s) && !(cover && *(b->seen+s)))) continue;
+        nptr->symbol = s;
+        nptr->weight = cover ? (*(hist+s) << REPEAT_SHIFT) + !*(hist+s) : *(hist+s);
+        nptr++;
+        b->num_nodes++; // Increment the node count in the nodes array
+    }
+
+    /* Huffman Tree Construction */
+    build_tree(b, b->num_nodes);
+
+    /* Build the code table & populate node_for_symbol array */
+    build_codes(b, b->nodes, 0, 0);
+
+    int depth = 0;
+    for(int i = 0; i < NUM_SYMBOLS; ++i) {
+        if((b->codes+i)->len > depth) depth = (b->codes+i)->len;
+    }
+    if(depth > limit) limit_lengths(b, limit);
+    phase_end(b, PHASE_TREE);
+    if(depth > limit) {
+        if(canonical_codes(b) || emit_canonical(b)) return 1;
+        return encode_or_store(b);
+    }
+
+    /* Interleaved streams, run symbols, matches and sync points are
+       described by their code lengths */
+    if(b->interleave || nsym == NUM_SYMBOLS || b->sync_every) {
+        if(canonical_codes(b) || emit_canonical(b)) return 1;
+        return encode_or_store(b);
+    }
+
+    /* Output the code lengths, unless the tree description is shorter */
+    size_t tree_size = 2 + (b->num_nodes+BYTE-1)/BYTE + (b->num_nodes+1)/2 + 1
+                       + (*(b->node_for_symbol+0xFF) != NULL);
+    if(!canonical_codes(b)) {
+        if(emit_canonical(b)) return 1;
+        if(b->out.len <= tree_size) return encode_or_store(b);
+        /* Back to the codes of the tree */
+        b->out.len = 0;
+        build_codes(b, b->nodes, 0, 0);
+    }
+
+    /* Output the Huffman Tree Description */
+    if(emit_tree(b)) return 1;
+
+    /* Output compressed data bits */
+    return encode_or_store(b);
+}
+
+/*
+ * @brief Puts the sync points of a block in front of it.
+ * @details See BLOCK_SYNC for the format. The bit offsets are added up
+ * from the code lengths of the bytes.
+ *
+ * @param b Block compressed as a canonical, static or repeat block of
+ * more than b->sync_every bytes
+ * @return 0 on success, 1 if memory could not be allocated
+*/
+static int
+emit_sync(BLOCK *b) {
+    const unsigned every = b->sync_every;
+    const unsigned n = (b->size - 1) / every;   // Number of sync points
+    const size_t hdr = 1 + SYNC_HEADER_SIZE + 4*(size_t)n;
+    unsigned char *optr;
+    uint64_t bits = 0;
+
+    if(out_reserve(&b->out, hdr)) return 1;
+    for(size_t i = b->out.len; i-- > 0;) *(b->out.buf+hdr+i) = *(b->out.buf+i);
+    b->out.len += hdr;
+    b->desc_len += hdr;
+
+    *b->out.buf = BLOCK_SYNC;
+    optr = b->out.buf + 1 + SYNC_HEADER_SIZE;
+    for(unsigned i = 0; i < b->size; ++i) {
+        if(i && !(i % every)) {
+            put_be32(optr, bits);
+            optr += 4;
+        }
+        bits += (b->codes + *(b->data+i))->len;
+    }
+    put_be32(b->out.buf + 1, every);
+    put_be32(b->out.buf + 5, b->size);
+    put_be32(b->out.buf + 9, bits + (b->codes+END_SYMBOL)->len);
+    put_be32(b->out.buf + 13, n);
+
+    return 0;
+}
+
+/*
+ * @brief Keeps the code of a compressed block for the next block, and puts
+ * its sync points in front of it.
+ *
+ * @param b Block, compressed by code_block()
+ * @return 0 on success, 1 if memory could not be allocated
+*/
+static int
+keep_code(BLOCK *b) {
+    /* Keep the code for the next block; stored blocks have none */
+    if(*b->out.buf == BLOCK_INTERLEAVED || *b->out.buf == BLOCK_RLE
+       || *b->out.buf == BLOCK_LZ || *b->out.buf == BLOCK_ANS
+       || *b->out.buf == BLOCK_SAMPLED) {
+        b->has_prev = 0;
+    } else if(*b->out.buf != BLOCK_STORED && b->reuse) {
+        for(int s = 0; s < NUM_SYMBOLS; ++s) *(b->prev+s) = *(b->codes+s);
+        b->has_prev = 1;
+    }
+
+    /* Blocks of one symbol per byte are split at sync points */
+    if(b->sync_every && b->size > b->sync_every
+       && (*b->out.buf == BLOCK_CANONICAL || *b->out.buf == BLOCK_STATIC
+           || *b->out.buf == BLOCK_REPEAT)) return emit_sync(b);
+
+    return 0;
+}
+
+/*
+ * Compress the data of a block.
+ */
+int
+compress_data(BLOCK *b) {
+    phase_start(b);
+    int ret = code_block(b);
+    if(!ret) ret = keep_code(b);
+    phase_end(b, PHASE_ENCODE);
+
+    return ret;
+}
+
+/*
+ * Find the lengths of a Huffman code for all the byte values and END.
+ */
+int
+code_lengths(const uint32_t *weight, int limit, unsigned char *len) {
+    BLOCK *b = block_init();
+    NODE *nptr;
+    int depth = 0;
+
+    if(b == NULL) return 1;
+
+    /* END leaf first, as in compress_data(), then one leaf per byte value */
+    res_nodes(b);
+    for(int i = 0; i < MAX_SYMBOLS; ++i) *(b->node_for_symbol+i) = NULL;
+    nptr = b->nodes+1;
+    for(int s = 0; s < 256; ++s, ++nptr) {
+        nptr->symbol = s;
+        nptr->weight = *(weight+s);
+    }
+    build_tree(b, MAX_SYMBOLS);
+    build_codes(b, b->nodes, 0, 0);
+
+    for(int i = 0; i < MAX_SYMBOLS; ++i) {
+        if((b->codes+i)->len > depth) depth = (b->codes+i)->len;
+    }
+    if(depth > limit) limit_lengths(b, limit);
+    for(int i = 0; i < MAX_SYMBOLS; ++i) *(len+i) = (b->codes+i)->len;
+
+    block_fini(b);
+
+    return 0;
+}
+
+/*
+ * @brief Reads one block of data from standard input and emits corresponding
+ * compressed data to standard output.
+ * @details This function reads raw binary data bytes from the standard input
+ * until the specified block size has been read or until EOF is reached.
+ * It then applies a data compression algorithm to the block and outputs the
+ * compressed block to the standard output.  The block size parameter is
+ * obtained from the global_options variable.
+ *
+ * @return 0 if block compression completes without error, 1 if an error occurs.
+ */
+int 
+compress_block() {
+    const unsigned bsz = ((unsigned)global_options >> G_OP_BS) + 1; // Current Block Size
+    unsigned bbcnt;     // Block byte count
+
+    /* Read the block from standard input */
+    if(!(bbcnt = io_read(current_block, bsz))) return 1; // Empty file
+
+    /* Compress the block */
+    serial_block.size = bbcnt;
+    serial_block.max_len = global_max_code_len;
+    serial_block.interleave = (global_options >> G_OP_M) & 1;
+    serial_block.use_static = global_use_static;
+    if(compress_data(&serial_block)) return 1;
+    num_nodes = serial_block.num_nodes;
+    END = serial_block.end;
+
+    /* Output the compressed block */
+    if(io_write(serial_block.out.buf, serial_block.out.len)) return 1;
+
+    /* Done if End of File reached */
+    return bbcnt < bsz;
+}
+
+/*
+ * @brief Reads raw data from standard input, writes compressed data to
+ * standard output.
+ * @details This function reads raw binary data bytes from the standard input in
+ * blocks of up to a specified maximum number of bytes or until EOF is reached,
+ * it applies a data compression algorithm to each block, and it outputs the
+ * compressed blocks to standard output.  The block size parameter is obtained
+ * from the global_options variable. The blocks are compressed by a
+ * HUFF_CTX or, with more than one thread selected, in parallel by
+ * compress_parallel(). With -a, the block size is the window size of
+ * adaptive block sizing. With -i, a block index trailer is written after
+ * the last block. With -w, the input is compressed as it arrives by
+ * run_stream(). With -p, the files listed on standard input are packed
+ * into an archive by archive_pack(). With -v, the statistics of every
+ * block are written by the context.
+ *
+ * @return 0 if compression completes without error, 1 if an error occurs.
+ */
+int 
+compress() {
+    const int nthreads = (global_options >> G_OP_J) & G_OP_J_MASK;
+    HUFF_PARAMS params = {
+        .block_size = ((unsigned)global_options >> G_OP_BS) + 1,
+        .adaptive = (global_options >> G_OP_A) & 1,
+        .max_code_len = global_max_code_len,
+        .interleave = (global_options >> G_OP_M) & 1,
+        .use_static = global_use_static,
+        .rle = global_rle,
+        .lz = global_lz,
+        .ans = global_ans,
+        .sync_every = global_sync_every,
+        .sample = global_sample,
+        .index = (global_options >> G_OP_I) & 1,
+        .reuse = global_reuse,
+    };
+    BLOCK_INDEX idx = {0};
+    HUFF_CTX *ctx;
+    int ret;
+
+    if(global_archive) return archive_pack(nthreads, &params);
+    if(nthreads <= 1) {
+        if(stats_open(&params) || (ctx = huff_ctx_init(HUFF_COMPRESS, &params)) == NULL) {
+            stats_close(&params);
+            return 1;
+        }
+        ret = global_flush_ms ? run_stream(ctx, global_flush_ms) : run_ctx(ctx);
+        huff_ctx_fini(ctx);
+        if(stats_close(&params)) ret = 1;
+        return ret;
+    }
+
+    ret = compress_parallel(nthreads, params.index ? &idx : NULL);
+    if(params.index) {
+        if(!ret && index_write(&idx)) ret = 1;
+        index_fini(&idx);
+    }
+
+    /* Check for IO error */
+    if(io_flush()) ret = 1;
+    io_close();
+
+    return ret;
+}
+
+/*
+ * @brief Use a stack to rebuild the Huffman Tree
+ * according to the bit sequence in the Tree
+ * description.
+ * @details When the bit_val is 0 a new leaf is created and pushed on the stack.
+ * If it is 1 then two nodes are popped and are made children of a new node.
+ * 
+ * @param tree - Nodes array
+ * @param bit_val - Scanned bit value used to determine direction of child nodes
+ * @param sp - Stack pointer
+ * @param nnum - Current number of nodes
+ * @return 0 on success, 1 if the bit sequence does not describe a tree
+*/
+static int
+push_pop(NODE *tree, char bit_val, NODE **sp, int *nnum) {
+    /* If 0: create new leaf node and  */
+    if(!bit_val) {
+        /* The stack must stay below the popped nodes */
+        if(*sp - tree >= *nnum) return 1;
+        /* Initialize New Leaf */
+        (*sp)->left = NULL;
+        (*sp)->right = NULL;
+        ++(*sp); // Increment stack pointer ("pushing" new leaf node)
+    } else { 
+    /* If 1: pop two nodes - give them a parent */
+        NODE *R, *L;
+
+        if(*sp - tree < 2) return 1; // Stack underflow
+
+        /* The two popped nodes go to Upper end of nodes array */
+        R = tree+(*nnum-1);
+        L = tree+(*nnum-2);
+
+        --(*sp); // Decrement stack pointer
+        *R = *(*sp); // Store first popped node
+        --(*sp); // Decrement stack pointer
+        *L = *(*sp); // Store second popped node
+
+        /* Create Parent of popped nodes */
+        (*sp)->right = R;
+        (*sp)->left = L;
+        
+        (*sp)++; // Increment stack pointer (pushing new parent node)
+        
+        *nnum -= 2; // Reduce temprary size of Huff Tree
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Decodes the post-order bit sequence 
+ * generated by compress() in order to re-construct the 
+ * Huffman Tree.
+ * 
+ * @param b Block being decompressed
+ * @param in Compressed input
+ * @return 0 on success, 1 on error
+*/
+static int
+decode_bit_seq(BLOCK *b, INBUF *in) {
+    int s; // Current byte being analyzed
+    NODE *sp = b->nodes; // Stack pointer
+
+    /* Get number of nodes in the huffman tree of the current compressed block */
+    if((s = next_byte(in)) != EOF) { // Get first byte
+        b->num_nodes = (s << BYTE); // MSB 
+    } else {
+        return 1; // Empty file 
+    }
+    if((s = next_byte(in)) != EOF) { // Get second byte
+        b->num_nodes |= s; // LSB
+    } else {
+        return 1;
+    }
+    if(b->num_nodes < 1 || b->num_nodes > 2*MAX_SYMBOLS - 1) return 1;
+    if(b->num_nodes > b->used_nodes) b->used_nodes = b->num_nodes;
+
+    /* Decode post-order bit sequence */
+    unsigned bit_count = 0; // Per byte bit counter
+    unsigned n_bits = 0; // Number of bits representing structure of the tree (post order traversal)
+    char bit_val; // Holds Current bit being evaluated 
+    int nnum = b->num_nodes; // Copy of num_nodes used in reconstruct()
+    while(n_bits != b->num_nodes) {
+        if((s = next_byte(in)) != EOF) { // Get next byte
+            while(bit_count != BYTE) {
+                bit_val = (s >> (BYTE - ((bit_count+1) % BYTE)) & 0x01); // Get value of next bit
+
+                if(push_pop(b->nodes, bit_val, &sp, &nnum)) return 1; // Evaluate scanned value
+
+                bit_count++; // Increment number of bits evaluated in current byte
+                n_bits++; // Increment number of nodes decoded
+
+                if(n_bits == b->num_nodes) break; // Skip padding
+
+                if(bit_count == (BYTE - 1)) {
+                    bit_val = s & 0x01; // Get value of last bit
+
+                    if(push_pop(b->nodes, bit_val, &sp, &nnum)) return 1; // Evaluate scanned value
+
+                    bit_count++; // Increment number of bits evaluated in current byte
+                    n_bits++; // Increment number of nodes decoded
+                }
+            }
+
+            /* Reset bit coutner */
+            bit_count = 0;
+        } else return 1; /* Invalid bit sequence - return error */
+    }
+
+    /* Only the root may be left on the stack */
+    if(sp != b->nodes+1) return 1;
+
+    return 0;
+}
+
+/*
+ * @brief Recursive post order travesral of the reconstructed
+ * Huffman Tree.
+ * @details Adds the symbols to the leaves.
+ * 
+ * @param b Block being decompressed
+ * @param in Compressed input
+ * @param n Current node being evaluated
+ * 
+ * @return 1 if EOF reached (error), 0 if successful symbol restoration
+*/
+static int 
+restores_symbols(BLOCK *b, INBUF *in, NODE *n) {
+    int s; // Symbol
+
+    /* If leaf node (either left or right == NULL) */
+    if(n->left == NULL) {
+        if((s = next_byte(in)) != EOF) { 
+            if(s == 0xFF) { 
+                if((s = next_byte(in)) != EOF) {  // Get next byte after 0xFF
+                    if(s == 0x00) { // Check for END node
+                        b->end = n; // Pointer to END node
+                        return 0;
+                    } else {
+                        n->symbol = 0xFF; // Assign 0xFF if next byte != 0x00
+                        return 0;
+                    }
+                } else {
+                    return 1;
+                }
+            }
+            n->symbol = s; // Assign symbol
+        } else {
+            return 1;
+        }
+
+        return 0;
+    } 
+    
+    /* Go to Left child */
+    if(restores_symbols(b, in, n->left)) return 1; // If EOF reached = error
+    /* Go to Right child */
+    if(restores_symbols(b, in, n->right)) return 1; // If EOF reached = error
+
+    return 0;
+}
+
+/*
+ * @brief Reads the description of the Huffman tree of a block and
+ * reconstructs the tree in the block's nodes array.
+ *
+ * @param b Block being decompressed
+ * @param in Compressed input
+ * @return 0 on success, 1 on error
+ */
+static int
+read_tree(BLOCK *b, INBUF *in) {
+    res_nodes(b);
+    b->end = NULL;
+
+    /* Decode post order bit sequence */
+    if(decode_bit_seq(b, in)) return 1;
+
+    /* Restore the symbol values of the leaf nodes */
+    return restores_symbols(b, in, b->nodes);
+}
+
+/*
+ * @brief Reads a description of a Huffman tree and reconstructs the tree from
+ * the description.
+ * @details  This function reads, from the standard input, the description of a
+ * Huffman tree in the format produced by emit_huffman_tree(), and it reconstructs
+ * the tree from the description. 
+ *
+ * @return 0 if the tree is read and reconstructed without error, otherwise 1
+ * if an error occurs.
+ */
+int 
+read_huffman_tree() {
+    int ret = read_tree(&serial_block, io_stdin());
+
+    num_nodes = serial_block.num_nodes;
+    END = serial_block.end;
+
+    return ret;
+}
+
+/*
+ * @brief Pre order traversal of the reconstructed Huffman Tree
+ * filling the decode table.
+ * @details A leaf at depth len fills the 2^(DTAB_BITS-len) entries whose
+ * top len bits equal its code. An internal node at depth DTAB_BITS fills
+ * its single entry with a pointer to itself.
+ *
+ * @param b Block being decompressed
+ * @param n Current node being evaluated
+ * @param code Code bits of the path to n
+ * @param len Depth of n
 */
 static void
-push_pop(char bit_val, NODE **sp, int *nnum) {
-    /* If 0: create new leaf node and  */
-    if(!bit_val) {
-        /* Initialize New Leaf */
-        (*sp)->left = NULL;
-        (*sp)->right = NULL;
-        ++(*sp); // Increment stack pointer ("pushing" new leaf node)
-    } else { 
-    /* If 1: pop two nodes - give them a parent */
-        NODE *R, *L;
+fill_dtab(BLOCK *b, NODE *n, unsigned code, int len) {
+    /* If leaf node (either left or right == NULL) */
+    if(n->left == NULL) {
+        DTAB_ENTRY *e = b->dtab + (code << (DTAB_BITS - len));
+        short sym = (n == b->end) ? END_SYMBOL : n->symbol;
+        for(int i = 0; i < (1 << (DTAB_BITS - len)); ++i, ++e) {
+            e->sym[0] = sym;
+            e->nsym = 1;
+            e->nbits = len;
+            e->len1 = len;
+        }
+        return;
+    }
+
+    /* Code longer than the table: finish with the per-bit walk */
+    if(len == DTAB_BITS) {
+        (b->dtab+code)->nsym = 0;
+        (b->dtab+code)->nbits = DTAB_BITS;
+        (b->dtab+code)->node = n;
+        return;
+    }
+
+    /* Go to Left child */
+    fill_dtab(b, n->left, code << 1, len+1);
+    /* Go to Right child */
+    fill_dtab(b, n->right, (code << 1) | 1, len+1);
+}
+
+/*
+ * @brief Fills the decode table from the canonical codes of a block.
+ * @details The entry of a code longer than the table only records that
+ * the code continues, to be finished with the code length tables.
+ *
+ * @param b Block being decompressed
+*/
+static void
+fill_dtab_canonical(BLOCK *b) {
+    DTAB_ENTRY *e;
+    int len;
+
+    for(int s = 0; s < NUM_SYMBOLS; ++s) {
+        if(!(len = (b->codes+s)->len)) continue;
+        if(len > DTAB_BITS) {
+            e = b->dtab + ((b->codes+s)->bits >> (len - DTAB_BITS));
+            e->nsym = 0;
+            e->nbits = DTAB_BITS;
+            e->len1 = 0;
+            e->node = NULL;
+            continue;
+        }
+        e = b->dtab + ((b->codes+s)->bits << (DTAB_BITS - len));
+        for(int i = 0; i < (1 << (DTAB_BITS - len)); ++i, ++e) {
+            e->sym[0] = s;
+            e->nsym = 1;
+            e->nbits = len;
+            e->len1 = len;
+        }
+    }
+}
+
+/*
+ * @brief Extends every decode table entry whose first codeword leaves
+ * room for a second complete one to resolve both.
+ * @details Run symbols are never paired, since their extra bits follow
+ * them.
+ *
+ * @param b Block being decompressed
+*/
+static void
+pair_dtab(BLOCK *b) {
+    for(int i = 0; i < DTAB_SIZE; ++i) {
+        DTAB_ENTRY *e = b->dtab+i;
+        if(!e->nsym || e->sym[0] >= END_SYMBOL) continue;
+
+        DTAB_ENTRY *e2 = b->dtab + ((i << e->len1) & DTAB_MASK);
+        if(e2->nsym && e2->sym[0] <= END_SYMBOL && e->len1 + e2->len1 <= DTAB_BITS) {
+            e->sym[1] = e2->sym[0];
+            e->nbits = e->len1 + e2->len1;
+            e->nsym = 2;
+        } else {
+            e->nbits = e->len1;
+            e->nsym = 1;
+        }
+    }
+}
+
+/*
+ * @brief Builds the decode table of a block from its Huffman tree.
+ * @details Called once per block after the tree has been read. After the
+ * single codewords are in place, short codewords are paired up.
+ *
+ * @param b Block being decompressed
+ * @return 0 on success, 1 if the tree cannot describe a block
+*/
+static int
+build_dtab(BLOCK *b) {
+    /* A block always holds END plus at least one symbol */
+    if(b->nodes->left == NULL || b->end == NULL) return 1;
+
+    fill_dtab(b, b->nodes, 0, 0);
+    pair_dtab(b);
+
+    return 0;
+}
+
+/*
+ * Bit buffer for the compressed data. The next bit to be decoded is the
+ * MSb of "bits". Past EOF the buffer is padded with zero bytes, which are
+ * counted so that decoding into them is reported as an error.
+ */
+typedef struct bit_reader {
+    uint64_t bits;  // Buffered bits, left-aligned
+    int count;      // Number of buffered bits
+    int padding;    // Number of zero bytes supplied past EOF
+} BIT_READER;
+
+/*
+ * @brief Tops up the bit buffer to at least 57 bits.
+ *
+ * @param br Bit buffer
+ * @param in Compressed input
+*/
+static inline void
+refill(BIT_READER *br, INBUF *in) {
+    int s; // Next input byte
+
+    while(br->count <= 64 - BYTE) {
+        if((s = next_byte(in)) == EOF) {
+            s = 0;
+            br->padding++;
+        }
+        br->bits |= (uint64_t)s << (64 - BYTE - br->count);
+        br->count += BYTE;
+    }
+}
+
+/*
+ * @brief Gives the whole bytes left in the bit buffer back to the input.
+ * @details The bits left over in the current byte are the zero-padding
+ * of the block and are dropped.
+ *
+ * @param br Bit buffer
+ * @param in Compressed input
+*/
+static void
+release_bytes(BIT_READER *br, INBUF *in) {
+    in->pos -= br->count / BYTE - br->padding;
+}
+
+/*
+ * @brief Reads bits from the compressed input.
+ *
+ * @param br Bit buffer
+ * @param in Compressed input
+ * @param n Number of bits (1 to 32)
+ * @return The bits, right-aligned
+*/
+static inline uint32_t
+get_bits(BIT_READER *br, INBUF *in, int n) {
+    if(br->count < n) refill(br, in);
+    uint32_t v = br->bits >> (64 - n);
+    br->bits <<= n;
+    br->count -= n;
+    return v;
+}
+
+/*
+ * @brief Reads a two-byte big-endian mask of a canonical block.
+ *
+ * @param in Compressed input
+ * @return The mask, or -1 at EOF
+*/
+static int
+read_mask(INBUF *in) {
+    int hi, lo;
+
+    if((hi = next_byte(in)) == EOF || (lo = next_byte(in)) == EOF) return -1;
+    return (hi << BYTE) | lo;
+}
+
+/*
+ * @brief Reads the code lengths of a canonical block and assigns its
+ * codes.
+ * @details The marker of the block has already been read.
+ *
+ * @param b Block being decompressed
+ * @param in Compressed input
+ * @param marker Marker of the block: BLOCK_RLE, BLOCK_LZ and BLOCK_SAMPLED
+ * blocks also have run symbols, and BLOCK_LZ blocks distance symbols
+ * @return 0 on success, 1 on error
+*/
+static int
+read_canonical(BLOCK *b, INBUF *in, int marker) {
+    BIT_READER br = {0, 0, 0};
+    int groups, mask;   // Masks of the groups and symbols in use
+    int cur;            // Current code length
+
+    b->num_nodes = 0;
+    b->end = NULL;
+
+    /* Read the masks of the symbols in use */
+    for(int i = 0; i < NUM_SYMBOLS; ++i) (b->codes+i)->len = 0;
+    if((groups = read_mask(in)) < 0) return 1;
+    for(int g = 0; g < 16; ++g) {
+        if(!(groups & (0x8000 >> g))) continue;
+        if((mask = read_mask(in)) < 0) return 1;
+        for(int i = 0; i < 16; ++i) {
+            if(mask & (0x8000 >> i)) (b->codes+16*g+i)->len = 1;
+        }
+    }
+    (b->codes+END_SYMBOL)->len = 1;
+    if(marker == BLOCK_RLE || marker == BLOCK_LZ || marker == BLOCK_SAMPLED) {
+        if((mask = read_mask(in)) < 0) return 1;
+        for(int k = 0; k < RUN_CODES; ++k) {
+            if(mask & (0x8000 >> k)) (b->codes+RUN_SYMBOL(k))->len = 1;
+        }
+    }
+    for(int d = 0; d < DIST_CODES; ++d) (b->dcodes+d)->len = 0;
+    if(marker == BLOCK_LZ) {
+        if((mask = read_mask(in)) < 0) return 1;
+        for(int d = 0; d < DIST_CODES; ++d) {
+            if(mask & (0x8000 >> d)) (b->dcodes+d)->len = 1;
+        }
+    }
+
+    /* Read the code lengths */
+    cur = get_bits(&br, in, 5);
+    for(int s = 0; s < NUM_SYMBOLS; ++s) {
+        if(!(b->codes+s)->len) continue;
+        while(get_bits(&br, in, 1)) {
+            cur += get_bits(&br, in, 1) ? -1 : 1;
+            if(cur < 1 || cur > MAX_CODE_LEN) return 1;
+        }
+        if(cur < 1) return 1;
+        (b->codes+s)->len = cur;
+    }
+    for(int d = 0; d < DIST_CODES; ++d) {
+        if(!(b->dcodes+d)->len) continue;
+        while(get_bits(&br, in, 1)) {
+            cur += get_bits(&br, in, 1) ? -1 : 1;
+            if(cur < 1 || cur > MAX_CODE_LEN) return 1;
+        }
+        (b->dcodes+d)->len = cur;
+    }
+    if(br.count < br.padding * BYTE) return 1;
+    release_bytes(&br, in);
+
+    if(marker == BLOCK_LZ && canonical_dist_codes(b)) return 1;
+
+    return canonical_codes(b);
+}
+
+/*
+ * @brief Reads a four-byte big-endian value.
+ *
+ * @param in Compressed input
+ * @param v Set to the value
+ * @return 0 on success, 1 at EOF
+*/
+static int
+read_be32(INBUF *in, uint32_t *v) {
+    int s;
+
+    *v = 0;
+    for(int i = 0; i < 4; ++i) {
+        if((s = next_byte(in)) == EOF) return 1;
+        *v = (*v << BYTE) | s;
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Appends bytes of the input to a buffer.
+ *
+ * @param in Compressed input
+ * @param dst Buffer receiving the bytes
+ * @param n Number of bytes
+ * @return 0 on success, 1 at EOF or if memory could not be allocated
+*/
+static int
+read_bytes(INBUF *in, OUTBUF *dst, size_t n) {
+    if(out_reserve(dst, n)) return 1;
+    while(n) {
+        if(in->pos == in->len && (in->fill == NULL || in->fill(in))) {
+            in->eof = 1;
+            return 1;
+        }
+        size_t k = in->len - in->pos;
+        if(k > n) k = n;
+        for(size_t i = 0; i < k; ++i) *(dst->buf+dst->len+i) = *(in->buf+in->pos+i);
+        in->pos += k;
+        dst->len += k;
+        n -= k;
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Copies the raw data of a stored block into the block's output
+ * buffer.
+ * @details The BLOCK_STORED marker has already been read.
+ *
+ * @param b Block being decompressed
+ * @param in Compressed input
+ * @return 0 on success, 1 on error
+*/
+static int
+read_stored(BLOCK *b, INBUF *in) {
+    uint32_t len;       // Number of raw bytes
+
+    if(read_be32(in, &len) || len > MAX_ADAPTIVE_BLOCK) return 1;
+
+    b->out.len = 0;
+    return read_bytes(in, &b->out, len);
+}
+
+/*
+ * @brief Decodes the distance of a match with the canonical distance code.
+ *
+ * @param b Block being decompressed
+ * @param br Bit buffer, positioned at the distance symbol
+ * @param in Compressed input
+ * @return The distance, or 0 if the code is invalid
+*/
+static unsigned
+decode_dist(BLOCK *b, BIT_READER *br, INBUF *in) {
+    uint32_t code = 0;
+    int d;
+
+    for(int len = 1; len <= MAX_CODE_LEN; ++len) {
+        code = (code << 1) | get_bits(br, in, 1);
+        if(code - *(b->dfirst+len) < *(b->dcount+len)) {
+            d = *(b->dsorted + *(b->doffs+len) + code - *(b->dfirst+len));
+            return (1u << d) + (d ? get_bits(br, in, d) : 0);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Expands a run symbol into the block's output buffer.
+ * @details Reads the extra bits of the run symbol and repeats the last
+ * byte decoded or, in a BLOCK_LZ block, copies the match whose distance
+ * follows. In a BLOCK_SAMPLED block, run symbol 0 is the escape of the
+ * byte that follows it.
+ *
+ * @param b Block being decompressed
+ * @param br Bit buffer, positioned after the run symbol
+ * @param in Compressed input
+ * @param sym The run symbol
+ * @param optr Next output byte
+ * @return The next output byte, or NULL if the run or match reaches
+ * before the block, makes the block too large or memory could not be
+ * allocated
+*/
+static unsigned char *
+expand_run(BLOCK *b, BIT_READER *br, INBUF *in, int sym, unsigned char *optr) {
+    const int k = sym - RUN_SYMBOL(0);
+
+    /* The escape of a sampled block, with room for the byte */
+    if(b->escapes) {
+        if(k) return NULL;
+        *optr++ = get_bits(br, in, BYTE);
+        return optr;
+    }
 
-        /* The two popped nodes go to Upper end of nodes array */
-        R = nodes+(*nnum-1);
-        L = nodes+(*nnum-2);
+    size_t len = (RUN_MIN << k) + get_bits(br, in, k + RUN_MIN_BITS);
+    size_t dist = b->matches ? decode_dist(b, br, in) : 1;
+    const unsigned char *from;
 
-        --(*sp); // Decrement stack pointer
-        *R = *(*sp); // Store first popped node
-        --(*sp); // Decrement stack pointer
-        *L = *(*sp); // Store second popped node
+    b->out.len = optr - b->out.buf;
+    if(!dist || dist > b->out.len) return NULL;
+    if(b->out.len + len > MAX_ADAPTIVE_BLOCK) return NULL;
+    if(out_reserve(&b->out, len + 2)) return NULL;
 
-        /* Create Parent of popped nodes */
-        (*sp)->right = R;
-        (*sp)->left = L;
-        
-        (*sp)++; // Increment stack pointer (pushing new parent node)
-        
-        *nnum -= 2; // Reduce temprary size of Huff Tree
-    }
+    /* Copied forward, as the match may overlap its copy */
+    optr = b->out.buf + b->out.len;
+    from = optr - dist;
+    for(size_t i = 0; i < len; ++i) *optr++ = *from++;
+
+    return optr;
 }
 
 /*
- * @brief Decodes the post-order bit sequence 
- * generated by compress() in order to re-construct the 
- * Huffman Tree.
- * 
+ * @brief Decode compressed data into the block's output buffer.
+ * @details Peeks DTAB_BITS bits at a time and resolves them with the decode
+ * table. Codes longer than the table are finished bit by bit, by walking
+ * the Huffman Tree from the subtree stored in the table entry or, for a
+ * canonical block, with the code length tables. Run symbols, which
+ * follow END, are expanded by expand_run().
+ *
+ * @param b Block being decompressed
+ * @param in Compressed input
+ * @return 0 if the END symbol was decoded, 1 on error
 */
 static int
-decode_bit_seq() {
-    int s; // Current byte being analyzed
-    NODE *sp = nodes; // Stack pointer
+decode(BLOCK *b, INBUF *in) {
+    BIT_READER br = {0, 0, 0};
+    DTAB_ENTRY *e;    // Table entry for the current peek
+    NODE *nptr;       // Node of the per-bit walk
+    uint32_t code;    // Canonical code of the per-bit walk
+    int len;          // Length of the canonical code
+    short sym;        // Decoded symbol
+    unsigned char *optr = b->out.buf;           // Next output byte
+    unsigned char *oend = b->out.buf + b->out.cap; // End of the output buffer
+
+    b->out.len = 0;
+    for(;;) {
+        refill(&br, in);
+        /* Decoding into the padding means the block was cut short */
+        if(br.count < br.padding * BYTE) return 1;
+
+        /* Room for two more bytes */
+        if(oend - optr < 2) {
+            b->out.len = optr - b->out.buf;
+            if(out_reserve(&b->out, b->out.cap ? b->out.cap : 4096)) return 1;
+            optr = b->out.buf + b->out.len;
+            oend = b->out.buf + b->out.cap;
+        }
 
-    /* Get number of nodes in the huffman tree of the current compressed block */
-    if((s = getchar()) != EOF) { // Get first byte from stdin
-        num_nodes = (s << BYTE); // MSB 
-    } else {
-        return 1; // Empty file 
+        e = b->dtab + (br.bits >> (64 - DTAB_BITS));
+        if(e->nsym) {
+            br.bits <<= e->nbits;
+            br.count -= e->nbits;
+            sym = *(e->sym);
+            if(sym >= END_SYMBOL) {
+                if(sym == END_SYMBOL) break;
+                if((optr = expand_run(b, &br, in, sym, optr)) == NULL) return 1;
+                oend = b->out.buf + b->out.cap;
+                continue;
+            }
+            *optr++ = sym;
+            if(e->nsym == 2) {
+                sym = *(e->sym+1);
+                if(sym == END_SYMBOL) break;
+                *optr++ = sym;
+            }
+        } else {
+            br.bits <<= DTAB_BITS;
+            br.count -= DTAB_BITS;
+            /* Slow path: walk the rest of the code one bit at a time */
+            if((nptr = e->node) != NULL) {
+                while(nptr->left) {
+                    if(!br.count) refill(&br, in);
+                    nptr = (br.bits >> 63) ? nptr->right : nptr->left;
+                    br.bits <<= 1;
+                    br.count--;
+                }
+                if(nptr == b->end) break;
+                *optr++ = nptr->symbol;
+                continue;
+            }
+            code = e - b->dtab;
+            len = DTAB_BITS;
+            do {
+                if(++len > MAX_CODE_LEN) return 1;
+                if(!br.count) refill(&br, in);
+                code = (code << 1) | (br.bits >> 63);
+                br.bits <<= 1;
+                br.count--;
+            } while(code - *(b->lfirst+len) >= *(b->lcount+len));
+            sym = *(b->sorted + *(b->loffs+len) + code - *(b->lfirst+len));
+            if(sym >= END_SYMBOL) {
+                if(sym == END_SYMBOL) break;
+                if((optr = expand_run(b, &br, in, sym, optr)) == NULL) return 1;
+                oend = b->out.buf + b->out.cap;
+                continue;
+            }
+            *optr++ = sym;
+        }
     }
-    if((s = getchar()) != EOF) { // Get second byte from stdin
-        num_nodes |= s; // LSB
-    } else {
-        return 1;
+
+    if(br.count < br.padding * BYTE) return 1;
+    b->out.len = optr - b->out.buf;
+
+    /* Give back the bytes read ahead of the next block */
+    release_bytes(&br, in);
+
+    return 0;
+}
+
+/*
+ * One bit stream of an interleaved block, read from memory like a
+ * BIT_READER, and the part of the output that it decodes into.
+ */
+typedef struct stream {
+    uint64_t bits;              // Buffered bits, left-aligned
+    int count;                  // Number of buffered bits
+    int padding;                // Number of zero bytes supplied past the end
+    const unsigned char *ptr;   // Next byte of the stream
+    const unsigned char *end;   // End of the stream
+    unsigned char *optr;        // Next output byte
+    unsigned char *oend;        // End of the output of the stream
+} STREAM;
+
+/*
+ * @brief Tops up the bit buffer of a stream with at least 8 bytes left to
+ * at least 56 bits.
+ * @details Loads the next eight bytes at once and keeps the whole bytes
+ * that fit, without a loop or a branch. The bits of a partial byte loaded
+ * past "count" are loaded again, at the same place, by the next refill.
+ *
+ * @param st Stream
+*/
+static inline void
+stream_refill_fast(STREAM *st) {
+    const unsigned char *p = st->ptr;
+    uint64_t v = (uint64_t)*p << 56 | (uint64_t)*(p+1) << 48 | (uint64_t)*(p+2) << 40
+                 | (uint64_t)*(p+3) << 32 | (uint64_t)*(p+4) << 24 | (uint64_t)*(p+5) << 16
+                 | (uint64_t)*(p+6) << 8 | (uint64_t)*(p+7);
+
+    st->bits |= v >> st->count;
+    st->ptr += (63 - st->count) >> 3;
+    st->count |= 56;
+}
+
+/*
+ * @brief Tops up the bit buffer of a stream to at least 57 bits.
+ * @details Past the end of the stream the buffer is padded with zero
+ * bytes, which are counted.
+ *
+ * @param st Stream
+*/
+static inline void
+stream_refill(STREAM *st) {
+    if(st->end - st->ptr >= 8) {
+        stream_refill_fast(st);
+        return;
     }
+    while(st->count <= 64 - BYTE) {
+        uint64_t s = 0;
+        if(st->ptr < st->end) s = *st->ptr++;
+        else st->padding++;
+        st->bits |= s << (64 - BYTE - st->count);
+        st->count += BYTE;
+    }
+}
 
-    /* Decode post-order bit sequence */
-    unsigned bit_count = 0; // Per byte bit counter
-    unsigned n_bits = 0; // Number of bits representing structure of the tree (post order traversal)
-    char bit_val; // Holds Current bit being evaluated 
-    int nnum = num_nodes; // Copy of num_nodes used in reconstruct()
-    while(n_bits != num_nodes) {
-        if((s = getchar()) != EOF) { // Get next byte from stdin
-            while(bit_count != BYTE) {
-                bit_val = (s >> (BYTE - ((bit_count+1) % BYTE)) & 0x01); // Get value of next bit
+/*
+ * @brief Decodes a code longer than the decode table, one bit at a time
+ * with the code length tables.
+ *
+ * @param b Block being decompressed
+ * @param st Stream, with at least DTAB_BITS bits buffered
+ * @param e Decode table entry of the first DTAB_BITS bits
+ * @return 0 on success, 1 if the code is END or invalid
+*/
+static int
+stream_long(const BLOCK *b, STREAM *st, const DTAB_ENTRY *e) {
+    uint32_t code = e - b->dtab;    // Code read so far
+    int len = DTAB_BITS;            // Length of the code read so far
 
-                push_pop(bit_val, &sp, &nnum); // Evaluate scanned value
+    /* END has no place in a stream */
+    if(e->len1) return 1;
 
-                bit_count++; // Increment number of bits evaluated in current byte
-                n_bits++; // Increment number of nodes decoded
+    st->bits <<= DTAB_BITS;
+    st->count -= DTAB_BITS;
+    do {
+        if(++len > MAX_CODE_LEN) return 1;
+        if(!st->count) stream_refill(st);
+        code = (code << 1) | (st->bits >> 63);
+        st->bits <<= 1;
+        st->count--;
+    } while(code - *(b->lfirst+len) >= *(b->lcount+len));
+    *st->optr++ = *(b->sorted + *(b->loffs+len) + code - *(b->lfirst+len));
 
-                if(n_bits == num_nodes) break; // Skip padding
+    return 0;
+}
 
-                if(bit_count == (BYTE - 1)) {
-                    bit_val = s & 0x01; // Get value of last bit
+/*
+ * @brief Decodes the codewords resolved by one decode table lookup.
+ * @details Both symbols of the entry are stored, so the stream must have
+ * room for two more bytes; only "nsym" of them are kept.
+ *
+ * @param b Block being decompressed
+ * @param st Stream, with at least DTAB_BITS bits buffered
+ * @return 0 on success, 1 if the stream is invalid
+*/
+static inline int
+stream_step(const BLOCK *b, STREAM *st) {
+    const DTAB_ENTRY *e = b->dtab + (st->bits >> (64 - DTAB_BITS));
 
-                    push_pop(bit_val, &sp, &nnum); // Evaluate scanned value
+    if(!e->nsym) return stream_long(b, st, e);
+    st->bits <<= e->nbits;
+    st->count -= e->nbits;
+    *st->optr = *(e->sym);
+    *(st->optr+1) = *(e->sym+1);
+    st->optr += e->nsym;
 
-                    bit_count++; // Increment number of bits evaluated in current byte
-                    n_bits++; // Increment number of nodes decoded
-                }
-            }
+    return 0;
+}
 
-            /* Reset bit coutner */
-            bit_count = 0;
-        } else return 1; /* Invalid bit sequence - return error */
+/*
+ * @brief Decodes the rest of a stream one codeword at a time.
+ *
+ * @param b Block being decompressed
+ * @param st Stream
+ * @return 0 on success, 1 if the stream is invalid or too short
+*/
+static int
+stream_finish(const BLOCK *b, STREAM *st) {
+    const DTAB_ENTRY *e;
+
+    while(st->optr < st->oend) {
+        stream_refill(st);
+        e = b->dtab + (st->bits >> (64 - DTAB_BITS));
+        if(!e->nsym) {
+            if(stream_long(b, st, e)) return 1;
+            continue;
+        }
+        st->bits <<= e->len1;
+        st->count -= e->len1;
+        *st->optr++ = *(e->sym);
     }
 
-   return 0;
+    /* Decoding into the padding means the stream was cut short */
+    return st->count < st->padding * BYTE;
 }
 
 /*
- * @brief Recursive post order travesral of the reconstructed
- * Huffman Tree.
- * @details Adds the symbols to the leaves.
- * 
- * @param n Current node being evaluated
- * @param s Symbol
- * 
- * @return 1 if EOF reached (error), 0 if successful symbol restoration
+ * @brief Removes END from the decode table of an interleaved block.
+ * @details An entry starting with END is sent to stream_long(), which
+ * rejects it; an entry ending with END resolves only its first codeword.
+ *
+ * @param b Block being decompressed
 */
-static int 
-restores_symbols(NODE *n, int s) {
-    /* If leaf node (either left or right == NULL) */
-    if(n->left == NULL) {
-        if((s = getchar()) != EOF) { 
-            if(s == 0xFF) { 
-                if((s = getchar()) != EOF) {  // Get next byte after 0xFF
-                    if(s == 0x00) { // Check for END node
-                        END = n; // Pointer to END node
-                        return 0;
-                    } else {
-                        n->symbol = 0xFF; // Assign 0xFF if next byte != 0x00
-                    }
-                } else {
-                    return 1;
-                }
-            }
-            n->symbol = s; // Assign symbol
-        } else {
-            return 1;
+static void
+strip_end_dtab(BLOCK *b) {
+    for(int i = 0; i < DTAB_SIZE; ++i) {
+        DTAB_ENTRY *e = b->dtab+i;
+        if(!e->nsym) continue;
+        if(*(e->sym) == END_SYMBOL) {
+            e->nsym = 0;
+        } else if(e->nsym == 2 && *(e->sym+1) == END_SYMBOL) {
+            e->nsym = 1;
+            e->nbits = e->len1;
         }
+    }
+}
 
-        return 0;
-    } 
-    
-    /* Go to Left child */
-    if(restores_symbols(n->left, s)) return 1; // If EOF reached = error
-    /* Go to Right child */
-    if(restores_symbols(n->right, s)) return 1; // If EOF reached = error
+/*
+ * @brief Decodes the streams of an interleaved block into the block's
+ * output buffer.
+ * @details The code lengths have already been read and the decode table
+ * built. The streams are decoded side by side, two table lookups per
+ * stream and round, as long as every stream has 8 bytes of input and 4
+ * bytes of output left; the ends of the streams are then decoded one at
+ * a time.
+ *
+ * @param b Block being decompressed
+ * @param in Compressed input, positioned at the raw length
+ * @return 0 on success, 1 on error
+*/
+static int
+read_interleaved(BLOCK *b, INBUF *in) {
+    STREAM st[INTERLEAVE_STREAMS];
+    uint32_t len;           // Number of raw bytes
+    uint32_t size;          // Size of a stream
+    uint64_t offs[INTERLEAVE_STREAMS+1] = {0}; // Offset of every stream
+    unsigned q;             // Number of raw bytes of a stream
+    const unsigned char *p; // Streams
+    int err = 0;
+
+    /* Raw length and jump table */
+    if(read_be32(in, &len) || len > MAX_ADAPTIVE_BLOCK) return 1;
+    q = (len + INTERLEAVE_STREAMS-1) / INTERLEAVE_STREAMS;
+    b->out.len = 0;
+    if(out_reserve(&b->out, len)) return 1;
+    for(int i = 0; i < INTERLEAVE_STREAMS; ++i) {
+        unsigned from = i*q < len ? i*q : len;
+        unsigned to = from + q < len ? from + q : len;
+        if(read_be32(in, &size)) return 1;
+        (st+i)->bits = 0;
+        (st+i)->count = 0;
+        (st+i)->padding = 0;
+        (st+i)->optr = b->out.buf + from;
+        (st+i)->oend = b->out.buf + to;
+        *(offs+i+1) = *(offs+i) + size;
+    }
+    if(*(offs+INTERLEAVE_STREAMS) > (uint64_t)len * MAX_CODE_LEN / BYTE + INTERLEAVE_STREAMS)
+        return 1;
+
+    /* The streams, in place if they are all in the buffer */
+    if(in->len - in->pos >= *(offs+INTERLEAVE_STREAMS)) {
+        p = in->buf + in->pos;
+        in->pos += *(offs+INTERLEAVE_STREAMS);
+    } else {
+        b->payload.len = 0;
+        if(read_bytes(in, &b->payload, *(offs+INTERLEAVE_STREAMS))) return 1;
+        p = b->payload.buf;
+    }
+    for(int i = 0; i < INTERLEAVE_STREAMS; ++i) {
+        (st+i)->ptr = p + *(offs+i);
+        (st+i)->end = p + *(offs+i+1);
+    }
+
+    /* All the streams at once */
+    for(;;) {
+        int room = 1;
+        for(int i = 0; i < INTERLEAVE_STREAMS; ++i) {
+            room &= ((st+i)->end - (st+i)->ptr >= 8) & ((st+i)->oend - (st+i)->optr >= 4);
+        }
+        if(!room) break;
+
+        stream_refill_fast(st+0);
+        stream_refill_fast(st+1);
+        stream_refill_fast(st+2);
+        stream_refill_fast(st+3);
+        err |= stream_step(b, st+0);
+        err |= stream_step(b, st+1);
+        err |= stream_step(b, st+2);
+        err |= stream_step(b, st+3);
+        err |= stream_step(b, st+0);
+        err |= stream_step(b, st+1);
+        err |= stream_step(b, st+2);
+        err |= stream_step(b, st+3);
+        if(err) return 1;
+    }
+
+    /* One stream at a time */
+    for(int i = 0; i < INTERLEAVE_STREAMS; ++i) {
+        if(stream_finish(b, st+i)) return 1;
+    }
+    b->out.len = len;
 
     return 0;
 }
 
 /*
- * @brief Reads a description of a Huffman tree and reconstructs the tree from
- * the description.
- * @details  This function reads, from the standard input, the description of a
- * Huffman tree in the format produced by emit_huffman_tree(), and it reconstructs
- * the tree from the description. 
+ * @brief Decodes the bytes of a tANS block into the block's output buffer.
+ * @details The BLOCK_ANS marker has already been read. Four bytes are
+ * decoded for every refill of the bit buffer, with one table lookup each
+ * and no branch, as long as the stream has 8 bytes and the output 4 bytes
+ * left; the last bytes are then decoded one at a time.
  *
- * @return 0 if the tree is read and reconstructed without error, otherwise 1
- * if an error occurs.
- */
-int 
-read_huffman_tree() {
-    /* Decode post order bit sequence */
-    if(decode_bit_seq()) return 1;
+ * @param b Block being decompressed
+ * @param in Compressed input, positioned at the raw length
+ * @return 0 on success, 1 on error
+*/
+static int
+read_ans(BLOCK *b, INBUF *in) {
+    ANS_ENTRY tab[1 << ANS_MAX_LOG];
+    uint16_t norm[256] = {0};
+    BIT_READER br = {0, 0, 0};
+    STREAM st = {0, 0, 0, NULL, NULL, NULL, NULL};
+    uint32_t len;           // Number of raw bytes
+    uint32_t size;          // Size of the bit stream
+    uint32_t left;          // Sum of the counts left
+    uint32_t x;             // Decoder state
+    int lg, groups, mask, nsym = 0, last = -1;
+
+    if(read_be32(in, &len) || len > MAX_ADAPTIVE_BLOCK || read_be32(in, &size)) return 1;
+    if((lg = next_byte(in)) == EOF || lg < ANS_MIN_LOG || lg > ANS_MAX_LOG) return 1;
+    if(size > ANS_BOUND(len, lg)) return 1;
+
+    /* Read the masks of the byte values in use */
+    if((groups = read_mask(in)) < 0) return 1;
+    for(int g = 0; g < 16; ++g) {
+        if(!(groups & (0x8000 >> g))) continue;
+        if((mask = read_mask(in)) < 0) return 1;
+        for(int i = 0; i < 16; ++i) {
+            if(!(mask & (0x8000 >> i))) continue;
+            *(norm+16*g+i) = 1;
+            nsym++;
+        }
+    }
+    if(!nsym || nsym > 1 << lg) return 1;
+
+    /* Read the counts; the last one is what remains */
+    left = 1u << lg;
+    for(int s = 0; s < 256; ++s) {
+        if(!*(norm+s)) continue;
+        if(nsym == 1) {
+            last = s;
+            break;
+        }
+        int nb = bit_length(left - nsym);
+        uint32_t c = (nb ? get_bits(&br, in, nb) : 0) + 1;
+        if(c > left - (nsym - 1)) return 1;
+        *(norm+s) = c;
+        left -= c;
+        nsym--;
+    }
+    *(norm+last) = left;
+    if(br.count < br.padding * BYTE) return 1;
+    release_bytes(&br, in);
+    ans_decode_table(norm, lg, tab);
+
+    /* The bit stream, in place if it is in the buffer */
+    if(in->len - in->pos >= size) {
+        st.ptr = in->buf + in->pos;
+        in->pos += size;
+    } else {
+        b->payload.len = 0;
+        if(read_bytes(in, &b->payload, size)) return 1;
+        st.ptr = b->payload.buf;
+    }
+    st.end = st.ptr + size;
+    b->out.len = 0;
+    if(out_reserve(&b->out, len)) return 1;
+    st.optr = b->out.buf;
+    st.oend = b->out.buf + len;
+
+    /* Skip the padding and the marker bit, then read the first state */
+    stream_refill(&st);
+    if(!(st.bits >> (64 - BYTE))) return 1;
+    while(!(st.bits >> 63)) {
+        st.bits <<= 1;
+        st.count--;
+    }
+    x = (st.bits << 1) >> (64 - lg);
+    st.bits <<= lg + 1;
+    st.count -= lg + 1;
+
+#define ANS_STEP(st, x) do {                                        \
+        const ANS_ENTRY *e = tab + (x);                             \
+        *(st).optr++ = e->sym;                                      \
+        (x) = e->base + (uint32_t)(((st).bits >> 1) >> (63 - e->nbits)); \
+        (st).bits <<= e->nbits;                                     \
+        (st).count -= e->nbits;                                     \
+    } while(0)
+
+    /* Four bytes per refill: at most 4*ANS_MAX_LOG bits */
+    while(st.end - st.ptr >= 8 && st.oend - st.optr >= 4) {
+        stream_refill_fast(&st);
+        ANS_STEP(st, x);
+        ANS_STEP(st, x);
+        ANS_STEP(st, x);
+        ANS_STEP(st, x);
+    }
+    while(st.optr < st.oend) {
+        stream_refill(&st);
+        ANS_STEP(st, x);
+    }
+#undef ANS_STEP
 
-    /* Restore the symbol values of the leaf nodes */
-    return restores_symbols(nodes, 0);
+    /* Decoding into the padding means the stream was cut short; the last
+       state is the first state of the encoder */
+    if(st.count < st.padding * BYTE || x) return 1;
+    b->out.len = len;
+
+    return 0;
 }
 
 /*
- * @brief Decode bits using the Huffman Tree. Output the
- * decoded symbols to stdout.
- * 
- * @param nptr pointer to current node being evaluated
- * @param bit_val direction of Huffman Tree traversal
- * 
- * @return 0: continue decoding next bit, 1: error (invalid bit sequence), 2: END node reached
-*/
-static int
-decode_data (NODE **nptr, char bit_val) {
-    /* If bit_val is 1 -> go right. If 0 -> go left */
-    if(bit_val) {
-        if((*(*nptr)).right) {
-            *nptr = (*(*nptr)).right;
-            if(!(*(*nptr)).right) {        // Check if leaf node
-                if(*nptr == END) return 2; // If END node - De-compression complete 
-            
-                putchar((*(*nptr)).symbol); // Output decoded symbol
-                *nptr = nodes;              // Reset pointer back to root of Huffman Tree
-            }
-        } else {
+ * @brief Reads the sync points of a block.
+ * @details The BLOCK_SYNC marker has already been read. Every sync point
+ * must be at or after the one before, within the encoded data.
+ *
+ * @param b Block being decompressed
+ * @param in Compressed input, positioned at the interval
+ * @return 0 on success, 1 on error
+*/
+static int
+read_sync(BLOCK *b, INBUF *in) {
+    uint32_t every, n, prev = 0;
+
+    if(read_be32(in, &every) || read_be32(in, &b->sync_len) || read_be32(in, &b->sync_bits)
+       || read_be32(in, &n)) return 1;
+    if(!every || !b->sync_len || b->sync_len > MAX_ADAPTIVE_BLOCK
+       || n != (b->sync_len - 1) / every
+       || b->sync_bits > ((uint64_t)b->sync_len + 1) * MAX_CODE_LEN) return 1;
+
+    if(n > b->sync_cap) {
+        uint32_t *sync = realloc(b->sync, n * sizeof(uint32_t));
+        if(sync == NULL) return 1;
+        b->sync = sync;
+        b->sync_cap = n;
+    }
+    for(unsigned i = 0; i < n; ++i) {
+        if(read_be32(in, b->sync+i) || *(b->sync+i) < prev || *(b->sync+i) > b->sync_bits)
             return 1;
-        }
+        prev = *(b->sync+i);
+    }
+    b->sync_every = every;
+    b->nsync = n;
+
+    return 0;
+}
+
+/*
+ * Segments of a block with sync points decoded by one thread.
+ */
+typedef struct sync_job {
+    const BLOCK *b;             // Block being decompressed
+    const unsigned char *data;  // Encoded data
+    unsigned first;             // First segment
+    unsigned step;              // Distance to the next segment of the thread
+    int err;                    // Set if a segment is invalid
+} SYNC_JOB;
+
+/*
+ * @brief Decodes the bytes between two sync points.
+ * @details A segment is decoded like a stream of an interleaved block,
+ * and must end exactly at the next sync point, or before END for the last
+ * segment.
+ *
+ * @param b Block being decompressed, with its output buffer reserved
+ * @param data Encoded data, sync_bits long
+ * @param i Number of the segment
+ * @return 0 on success, 1 if the segment is invalid
+*/
+static int
+decode_segment(const BLOCK *b, const unsigned char *data, unsigned i) {
+    const uint32_t from = i ? *(b->sync+i-1) : 0;
+    const uint32_t to = i < b->nsync ? *(b->sync+i)
+                        : b->sync_bits - (b->codes+END_SYMBOL)->len;
+    const unsigned out_to = (i+1) * b->sync_every < b->sync_len ? (i+1) * b->sync_every
+                            : b->sync_len;
+    STREAM st = {0, 0, 0, data + from/BYTE, data + (b->sync_bits+BYTE-1)/BYTE,
+                 b->out.buf + i * b->sync_every, b->out.buf + out_to};
+    int err = 0;
+
+    stream_refill(&st);
+    st.bits <<= from % BYTE;
+    st.count -= from % BYTE;
+    while(st.end - st.ptr >= 8 && st.oend - st.optr >= 4) {
+        stream_refill_fast(&st);
+        err |= stream_step(b, &st);
+        err |= stream_step(b, &st);
+        if(err) return 1;
+    }
+    if(stream_finish(b, &st)) return 1;
+
+    return (st.ptr - data + st.padding) * BYTE - st.count != to;
+}
+
+/*
+ * @brief Decodes the segments of one thread.
+ *
+ * @param arg The SYNC_JOB of the thread
+ * @return NULL
+*/
+static void *
+sync_worker(void *arg) {
+    SYNC_JOB *job = arg;
+
+    for(unsigned i = job->first; i <= job->b->nsync && !job->err; i += job->step)
+        job->err = decode_segment(job->b, job->data, i);
+
+    return NULL;
+}
+
+/*
+ * @brief Decodes the data of a block with sync points into the block's
+ * output buffer.
+ * @details The code has already been read and the decode table built. The
+ * segments between sync points are shared out between up to b->threads
+ * threads, which decode them straight into their place in the output.
+ * They work on a copy of the decode table without END, so that the table
+ * stays in place for a following BLOCK_REPEAT block.
+ *
+ * @param b Block being decompressed
+ * @param in Compressed input, positioned at the encoded data
+ * @return 0 on success, 1 on error
+*/
+static int
+decode_sync(BLOCK *b, INBUF *in) {
+    const size_t size = (b->sync_bits + BYTE-1) / BYTE;
+    const unsigned nseg = b->nsync + 1;
+    const unsigned nthreads = b->threads < 1 ? 1 : (unsigned)b->threads < nseg ? b->threads : nseg;
+    DTAB_ENTRY *dtab = b->dtab;
+    const unsigned char *p;
+    SYNC_JOB *jobs;
+    pthread_t *tids;
+    unsigned nstarted = 0;
+    int err = 0;
+
+    /* Codes longer than the table are decoded with the canonical code */
+    if(b->num_nodes) return 1;
+
+    /* The encoded data, in place if it is in the buffer */
+    if(in->len - in->pos >= size) {
+        p = in->buf + in->pos;
+        in->pos += size;
     } else {
-        if((*(*nptr)).left) {
-            *nptr = (*(*nptr)).left;
-            if(!(*(*nptr)).left) {          // Check if leaf node
-                if(*nptr == END) return 2;  // If END node - De-compression complete 
-                putchar((*(*nptr)).symbol); // Output decoded symbol
-                *nptr = nodes;              // Reset pointer back to root of Huffman Treeo
-            }
-        } else {
-            return 1;
-        }
+        b->payload.len = 0;
+        if(read_bytes(in, &b->payload, size)) return 1;
+        p = b->payload.buf;
+    }
+    b->out.len = 0;
+    if(out_reserve(&b->out, b->sync_len)) return 1;
+
+    jobs = calloc(nthreads, sizeof(SYNC_JOB));
+    tids = calloc(nthreads, sizeof(pthread_t));
+    if(jobs == NULL || tids == NULL || (b->dtab = malloc(DTAB_SIZE * sizeof(DTAB_ENTRY))) == NULL) {
+        b->dtab = dtab;
+        free(jobs);
+        free(tids);
+        return 1;
     }
+    for(int i = 0; i < DTAB_SIZE; ++i) *(b->dtab+i) = *(dtab+i);
+    strip_end_dtab(b);
+
+    /* The calling thread takes the first share */
+    for(unsigned t = 0; t < nthreads; ++t) *(jobs+t) = (SYNC_JOB){b, p, t, nthreads, 0};
+    for(nstarted = 1; nstarted < nthreads; ++nstarted) {
+        if(pthread_create(tids+nstarted, NULL, sync_worker, jobs+nstarted)) break;
+    }
+    /* Threads that did not start leave their share to the calling thread */
+    for(unsigned t = 0; t < nthreads; ++t) {
+        if(t && t < nstarted) continue;
+        sync_worker(jobs+t);
+        err |= (jobs+t)->err;
+    }
+    for(unsigned t = 1; t < nstarted; ++t) {
+        pthread_join(*(tids+t), NULL);
+        err |= (jobs+t)->err;
+    }
+
+    free(b->dtab);
+    b->dtab = dtab;
+    free(jobs);
+    free(tids);
+    if(err) return 1;
+    b->out.len = b->sync_len;
 
     return 0;
 }
 
 /*
- * @brief Decode and output compressed data.
- * @details Go through the bit seqeunce and decode them 
- * to form the original characters of the uncompressed data.
+ * @brief Decompresses one block, for decompress_data().
+ *
+ * @param b Block state
+ * @param in Input, positioned at the start of the block
+ * @return 0 on success, 1 if the block is invalid or truncated
 */
 static int
-decode() {
-    int s;        // Current byte being analyze
-    char bit_val; // Holds Current bit being evaluated 
-    unsigned bit_count = 0; // Per byte bit counter
-    NODE *nptr = nodes;     // Pointer to root of Huffman Tree
+decode_block(BLOCK *b, INBUF *in) {
+    int s = next_byte(in); // First byte of the block
+
+    /* Sync points come before the block they split */
+    b->synced = 0;
+    if(s == BLOCK_SYNC) {
+        if(read_sync(b, in)) return 1;
+        s = next_byte(in);
+        if(s != BLOCK_CANONICAL && s != BLOCK_STATIC && s != BLOCK_REPEAT) return 1;
+        b->synced = 1;
+    }
 
-    for(;;) {
-        if((s = getchar()) != EOF) { // Get next byte from stdin
-            while(bit_count != BYTE) {
-                bit_val = (s >> (BYTE - ((bit_count+1) % BYTE)) & 0x01); // Get value of next bit
-                bit_count++; // Increment number of bits evaluated in current byte
+    /* Run symbols code the lengths of matches, or escapes */
+    b->matches = (s == BLOCK_LZ);
+    b->escapes = (s == BLOCK_SAMPLED);
 
-                /* Evaluate decoding completion */
-                switch(decode_data(&nptr, bit_val)) { // Decode bit
-                    case 0: break;    // Continue decoding next bit
-                    case 1: return 1; // Error
-                    case 2: return 0; // END node reached - De-compression complete
-                }
+    if(s == BLOCK_STORED) return read_stored(b, in);
 
-                if(bit_count == (BYTE - 1)) {
-                    bit_val = s & 0x01; // Get value of last bit
-                    bit_count++;        // Increment number of bits evaluated in current byte
+    if(s == BLOCK_REPEAT) {
+        /* The decode table of the previous code is still in place */
+        if(!b->has_prev) return 1;
+        return b->synced ? decode_sync(b, in) : decode(b, in);
+    }
 
-                    /* Evaluate decoding completion */
-                    switch(decode_data(&nptr, bit_val)) { // Decode bit
-                        case 0: break;    // Continue decoding next bit
-                        case 1: return 1; // Error 
-                        case 2: return 0; // END node reached - De-compression complete
-                    }
-                }
-            }
+    /* The decode table is about to change */
+    b->has_prev = 0;
+
+    if(s == BLOCK_STATIC) {
+        /* Take the code lengths of the table */
+        const unsigned char *len;
+        if((s = next_byte(in)) == EOF || (len = table_lengths(s)) == NULL) return 1;
+        for(int i = 0; i < NUM_SYMBOLS; ++i) (b->codes+i)->len = i < MAX_SYMBOLS ? *(len+i) : 0;
+        b->num_nodes = 0;
+        b->end = NULL;
+        if(canonical_codes(b)) return 1;
+        fill_dtab_canonical(b);
+        pair_dtab(b);
+        b->has_prev = 1;
+        return b->synced ? decode_sync(b, in) : decode(b, in);
+    }
 
-            /* Reset bit coutner */
-            bit_count = 0;
-        } else { return 1; } /* Invalid bit sequence - return error */
+    if(s == BLOCK_ANS) return read_ans(b, in);
+
+    if(s == BLOCK_INTERLEAVED) {
+        if(read_canonical(b, in, s)) return 1;
+        fill_dtab_canonical(b);
+        pair_dtab(b);
+        strip_end_dtab(b);
+        return read_interleaved(b, in);
     }
+
+    if(s == BLOCK_RLE || s == BLOCK_LZ || s == BLOCK_SAMPLED) {
+        /* Run symbols follow END; the code is not repeated */
+        if(read_canonical(b, in, s)) return 1;
+        fill_dtab_canonical(b);
+        pair_dtab(b);
+        return decode(b, in);
+    }
+
+    if(s == BLOCK_CANONICAL) {
+        /* Read the code lengths and build the decode table from them */
+        if(read_canonical(b, in, s)) return 1;
+        fill_dtab_canonical(b);
+        pair_dtab(b);
+    } else {
+        if(s == EOF) return 1;
+        in->pos--;
+
+        /* Read and re-construct the Huffman Tree */
+        if(read_tree(b, in)) return 1;
+
+        /* Build the decode table for the block */
+        if(build_dtab(b)) return 1;
+    }
+    b->has_prev = 1;
+
+    /* De-compress block */
+    return b->synced ? decode_sync(b, in) : decode(b, in);
+}
+
+/*
+ * Decompress one block.
+ */
+int
+decompress_data(BLOCK *b, INBUF *in) {
+    phase_start(b);
+    int ret = decode_block(b, in);
+    phase_end(b, PHASE_DECODE);
+
+    return ret;
 }
 
 /*
@@ -715,19 +3263,27 @@ decode() {
  * input, decompresses the block, and it outputs the uncompressed data to
  * the standard output. The input data blocks are assumed to be in the format
  * produced by compress(). If EOF is encountered before a complete block has
- * been read, it is an error.
+ * been read, it is an error. A block index trailer ends the input like EOF.
  *
  * @return 0 if decompression completes without error, 1 if an error occurs.
  */
 int 
 decompress_block() {
-    /* Read and re-construct the Huffman Tree */
-    if(read_huffman_tree()) return 1;
+    INBUF *in = io_stdin();
+    int s = next_byte(in);
 
-    /* De-compress block */
-    if(decode()) return 1;
+    /* End of the blocks */
+    if(s == EOF || s == INDEX_MARKER) return 1;
+    in->pos--;
 
-    return 0;
+    serial_block.threads = (global_options >> G_OP_J) & G_OP_J_MASK;
+    int ret = decompress_data(&serial_block, in);
+    num_nodes = serial_block.num_nodes;
+    END = serial_block.end;
+    if(ret) return 1;
+
+    /* Output the decompressed block */
+    return io_write(serial_block.out.buf, serial_block.out.len);
 }
 
 /*
@@ -736,23 +3292,39 @@ decompress_block() {
  * @details This function reads blocks of compressed data from the standard
  * input until EOF is reached, it decompresses each block, and it outputs
  * the uncompressed data to the standard output. The input data blocks
- * are assumed to be in the format produced by compress().
+ * are assumed to be in the format produced by compress(). The blocks are
+ * decompressed by a HUFF_CTX or, with more than one thread selected and a
+ * seekable input that ends in a block index, in parallel by
+ * decompress_parallel(). Otherwise the threads share out the segments of
+ * blocks with sync points. With -x, only the member of an archive is
+ * decompressed, by archive_extract(). With -v, the statistics of every
+ * block are written by the context.
  *
  * @return 0 if decompression completes without error, 1 if an error occurs.
  */
 int 
 decompress() {
-    /* Decompress all blocks */
-    do {
-        /* Reset Nodes Array */
-        res_nodes(nodes);
-    } while(!(decompress_block()));
+    const int nthreads = (global_options >> G_OP_J) & G_OP_J_MASK;
+    BLOCK_INDEX idx = {0};
 
-    /* Check for IO error */
-    if(ferror(stdin)) return 1;
+    if(global_member) return archive_extract(global_member, nthreads);
+
+    if(nthreads > 1 && !index_read(fileno(stdin), &idx)) {
+        int ret = decompress_parallel(nthreads, &idx);
+        index_fini(&idx);
+        return ret;
+    }
 
-    /* Check if EOF is reached */    
-    if(feof(stdin)) return 0;
+    /* Decompress all blocks; the threads decode blocks with sync points */
+    HUFF_PARAMS params = { .threads = nthreads };
+    HUFF_CTX *ctx;
+    if(stats_open(&params) || (ctx = huff_ctx_init(HUFF_DECOMPRESS, &params)) == NULL) {
+        stats_close(&params);
+        return 1;
+    }
+    int ret = run_ctx(ctx);
+    huff_ctx_fini(ctx);
+    if(stats_close(&params)) ret = 1;
 
-    return 0;
+    return ret;
 }
@@ -0,0 +1,527 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "huff.h"
+#include "block.h"
+#include "container.h"
+#include "options.h"
+#include "huff_ctx.h"
+#include "adapt.h"
+#include "debug.h"
+
+#define BYTE    8
+
+/*
+ * Results of decoding one block from buffered input.
+ */
+#define DEC_OK      0   // A block was decoded
+#define DEC_ERROR   1   // The block is invalid
+#define DEC_SHORT   2   // The block is not complete yet
+#define DEC_END     3   // The block index trailer was reached
+
+/*
+ * State of one stream.
+ */
+struct huff_ctx {
+    int mode;                   // HUFF_COMPRESS or HUFF_DECOMPRESS
+    HUFF_PARAMS params;         // Compression parameters
+    BLOCK *block;               // Block being coded
+    unsigned char *data;        // Buffer owned by the block for its raw data
+    const unsigned char *pending; // Output waiting for huff_pull()
+    size_t npending;            // Number of bytes waiting
+    OUTBUF raw;                 // Buffered raw input when sizing blocks adaptively
+    size_t raw_pos;             // Index of the next byte of buffered raw input
+    OUTBUF in;                  // Buffered compressed input
+    size_t in_pos;              // Index of the next byte of buffered input
+    size_t retry_len;           // Buffered input to wait for before decoding again
+    BLOCK_INDEX idx;            // Block index being built
+    OUTBUF trailer;             // Block index trailer
+    int finished;               // Set by huff_finish()
+    int flushing;               // Set by huff_flush() until the buffered input is coded
+    int ended;                  // Set once the trailer is reached or queued
+    int error;                  // Set after an error
+    unsigned long nblocks;      // Number of blocks coded in the stream
+    BLOCK_TIMES times;          // Phase times of the block being coded, when
+                                // statistics are reported
+};
+
+/*
+ * Create a context.
+ */
+HUFF_CTX *
+huff_ctx_init(int mode, const HUFF_PARAMS *params) {
+    HUFF_CTX *ctx;
+
+    if(mode != HUFF_COMPRESS && mode != HUFF_DECOMPRESS) return NULL;
+    if((ctx = calloc(1, sizeof(HUFF_CTX))) == NULL) return NULL;
+    ctx->mode = mode;
+    if(params) ctx->params = *params;
+
+    /* Check the parameters */
+    if(!ctx->params.block_size) ctx->params.block_size = HUFF_DEFAULT_BLOCK_SIZE;
+    if(ctx->params.block_size < MIN_BLOCK_SIZE || ctx->params.block_size > MAX_BLOCK_SIZE
+       || (ctx->params.max_code_len && (ctx->params.max_code_len < MIN_CODE_LIMIT
+                                        || ctx->params.max_code_len > MAX_CODE_LEN))) {
+        free(ctx);
+        return NULL;
+    }
+
+    /* Reject the options that would be ignored, as validargs() does */
+    if(mode == HUFF_COMPRESS
+       && ((ctx->params.sync_every && (ctx->params.sync_every < MIN_SYNC_EVERY
+                                       || ctx->params.sync_every > MAX_SYNC_EVERY))
+           || (ctx->params.interleave && (ctx->params.rle || ctx->params.lz || ctx->params.ans
+                                          || ctx->params.sample || ctx->params.reuse
+                                          || ctx->params.sync_every))
+           || (ctx->params.sample && (ctx->params.rle || ctx->params.lz || ctx->params.ans
+                                      || ctx->params.sync_every))
+           || (ctx->params.reuse && ctx->params.index))) {
+        free(ctx);
+        return NULL;
+    }
+
+    if((ctx->block = block_init()) == NULL) {
+        free(ctx);
+        return NULL;
+    }
+    ctx->data = ctx->block->data;
+    ctx->block->max_len = ctx->params.max_code_len;
+    ctx->block->interleave = ctx->params.interleave;
+    ctx->block->use_static = ctx->params.use_static;
+    ctx->block->rle = ctx->params.rle;
+    ctx->block->lz = ctx->params.lz;
+    ctx->block->ans = ctx->params.ans;
+    ctx->block->sync_every = ctx->params.sync_every;
+    ctx->block->sample = ctx->params.sample;
+    ctx->block->threads = ctx->params.threads;
+    if(ctx->params.stats) ctx->block->times = &ctx->times;
+    ctx->block->reuse = ctx->params.reuse;
+
+    /* Room for the longest block and the window that ends it */
+    if(mode == HUFF_COMPRESS && ctx->params.adaptive) {
+        ctx->raw.cap = MAX_ADAPTIVE_BLOCK + ctx->params.block_size;
+        if((ctx->raw.buf = malloc(ctx->raw.cap)) == NULL) {
+            huff_ctx_fini(ctx);
+            return NULL;
+        }
+    }
+
+    return ctx;
+}
+
+/*
+ * Free a context, which must not be used again.
+ */
+void
+huff_ctx_fini(HUFF_CTX *ctx) {
+    ctx->block->data = ctx->data;
+    block_fini(ctx->block);
+    index_fini(&ctx->idx);
+    free(ctx->raw.buf);
+    free(ctx->in.buf);
+    free(ctx->trailer.buf);
+    free(ctx);
+}
+
+/*
+ * Discard the state of the current stream.
+ */
+void
+huff_ctx_reset(HUFF_CTX *ctx) {
+    ctx->block->data = ctx->data;
+    ctx->block->size = 0;
+    ctx->block->has_prev = 0;
+    for(int s = 0; s < 256; ++s) *(ctx->block->seen+s) = 0;
+    ctx->npending = 0;
+    ctx->raw.len = 0;
+    ctx->raw_pos = 0;
+    ctx->in.len = 0;
+    ctx->in_pos = 0;
+    ctx->retry_len = 0;
+    index_fini(&ctx->idx);
+    ctx->idx = (BLOCK_INDEX){0};
+    ctx->finished = 0;
+    ctx->flushing = 0;
+    ctx->ended = 0;
+    ctx->error = 0;
+    ctx->nblocks = 0;
+    ctx->times = (BLOCK_TIMES){{0}};
+}
+
+/*
+ * @brief Passes the statistics of the block just coded to the stats hook
+ * of a context.
+ *
+ * @param ctx The context, with a stats hook
+ * @param comp The compressed block
+ * @param comp_len Number of compressed bytes
+ * @param raw The raw bytes of the block
+ * @param raw_len Number of raw bytes
+*/
+static void
+report_block(HUFF_CTX *ctx, const unsigned char *comp, size_t comp_len,
+             const unsigned char *raw, size_t raw_len) {
+    BLOCK *b = ctx->block;
+    HUFF_STATS st = {0};
+    uint32_t hist[256];
+
+    st.block = ctx->nblocks++;
+    st.mode = ctx->mode;
+    st.raw_size = raw_len;
+    st.comp_size = comp_len;
+    st.bits_per_symbol = raw_len ? (double)BYTE * comp_len / raw_len : 0;
+
+    /* Look past the sync points, whose number ends the sync header */
+    st.type = comp_len ? *comp : BLOCK_STORED;
+    if(st.type == BLOCK_SYNC && comp_len > 1 + SYNC_HEADER_SIZE) {
+        for(int i = 0; i < 4; ++i) st.sync_points = (st.sync_points << BYTE) | *(comp + SYNC_HEADER_SIZE-3 + i);
+        size_t at = 1 + SYNC_HEADER_SIZE + 4*(size_t)st.sync_points;
+        if(at < comp_len) st.type = *(comp+at);
+    }
+
+    histogram(raw, raw_len, hist);
+    for(int s = 0; s < 256; ++s) {
+        if(!*(hist+s)) continue;
+        double p = (double)*(hist+s) / raw_len;
+        st.symbols++;
+        st.entropy -= p * log2(p);
+    }
+
+    /* Only the compressor has the codes at hand */
+    if(ctx->mode == HUFF_COMPRESS) {
+        st.desc_size = b->desc_len;
+        if(st.type != BLOCK_STORED && st.type != BLOCK_ANS) {
+            for(int s = 0; s < NUM_SYMBOLS; ++s) {
+                if((b->codes+s)->len > st.max_code_len) st.max_code_len = (b->codes+s)->len;
+            }
+        }
+    }
+
+    st.hist_ns = *(ctx->times.ns+PHASE_HISTOGRAM);
+    st.tree_ns = *(ctx->times.ns+PHASE_TREE);
+    st.emit_ns = *(ctx->times.ns+PHASE_EMIT);
+    st.encode_ns = *(ctx->times.ns+PHASE_ENCODE);
+    st.decode_ns = *(ctx->times.ns+PHASE_DECODE);
+    ctx->times = (BLOCK_TIMES){{0}};
+
+    ctx->params.stats(&st, ctx->params.stats_arg);
+}
+
+/*
+ * @brief Compresses the block of a context and makes it the pending output.
+ *
+ * @param ctx The context
+ * @return 0 on success, 1 on error
+*/
+static int
+flush_block(HUFF_CTX *ctx) {
+    BLOCK *b = ctx->block;
+
+    if(compress_data(b)) return 1;
+    if(ctx->params.index && index_add(&ctx->idx, b->size, b->out.len)) return 1;
+    if(ctx->params.stats) report_block(ctx, b->out.buf, b->out.len, b->data, b->size);
+
+    ctx->pending = b->out.buf;
+    ctx->npending = b->out.len;
+    b->data = ctx->data;
+    b->size = 0;
+
+    return 0;
+}
+
+/*
+ * @brief Decodes one block of compressed input and makes its data the
+ * pending output.
+ *
+ * @param ctx The context
+ * @param buf Compressed input, starting at a block
+ * @param len Number of bytes of input
+ * @param used Set to the size of the compressed block
+ * @return DEC_OK, DEC_ERROR, DEC_SHORT or DEC_END
+*/
+static int
+decode_block(HUFF_CTX *ctx, const unsigned char *buf, size_t len, size_t *used) {
+    INBUF in = { buf, 0, len, NULL, 0 };
+
+    if(!len) return DEC_SHORT;
+    if(*buf == INDEX_MARKER) return DEC_END;
+    if(decompress_data(ctx->block, &in)) return in.eof ? DEC_SHORT : DEC_ERROR;
+
+    *used = in.pos;
+    ctx->pending = ctx->block->out.buf;
+    ctx->npending = ctx->block->out.len;
+    if(ctx->params.stats) report_block(ctx, buf, in.pos, ctx->pending, ctx->npending);
+
+    return DEC_OK;
+}
+
+/*
+ * @brief Produces the next output of a context from its buffered state,
+ * once the pending output has been taken.
+ *
+ * @param ctx The context
+ * @return 0 on success, 1 on error
+*/
+static int
+advance(HUFF_CTX *ctx) {
+    size_t used;
+
+    if(ctx->npending || ctx->error) return ctx->error;
+
+    if(ctx->mode == HUFF_COMPRESS) {
+        if(!(ctx->finished || ctx->flushing) || ctx->ended) return 0;
+        /* Last blocks, then the block index */
+        if(ctx->block->size) return ctx->error = flush_block(ctx);
+        if(ctx->raw_pos < ctx->raw.len) {
+            size_t len = adapt_split(ctx->raw.buf + ctx->raw_pos, ctx->raw.len - ctx->raw_pos,
+                                     ctx->params.block_size, 1);
+            ctx->block->data = ctx->raw.buf + ctx->raw_pos;
+            ctx->block->size = len;
+            ctx->raw_pos += len;
+            return ctx->error = flush_block(ctx);
+        }
+        /* A flush ends with the buffered input */
+        if(!ctx->finished) return ctx->flushing = 0;
+        ctx->ended = 1;
+        if(!ctx->params.index) return 0;
+        ctx->trailer.len = 0;
+        if(out_reserve(&ctx->trailer, index_size(&ctx->idx))) return ctx->error = 1;
+        index_encode(&ctx->idx, ctx->trailer.buf);
+        ctx->pending = ctx->trailer.buf;
+        ctx->npending = index_size(&ctx->idx);
+        return 0;
+    }
+
+    /* Decode buffered blocks until one has data */
+    while(!ctx->npending && !ctx->ended) {
+        size_t avail = ctx->in.len - ctx->in_pos;
+        if(!avail || (avail < ctx->retry_len && !ctx->finished)) break;
+        switch(decode_block(ctx, ctx->in.buf + ctx->in_pos, avail, &used)) {
+            case DEC_OK:
+                ctx->in_pos += used;
+                ctx->retry_len = 0;
+                break;
+            case DEC_SHORT:
+                if(ctx->finished) return ctx->error = 1;
+                /* Wait for twice as much input before trying again */
+                ctx->retry_len = 2*avail;
+                return 0;
+            case DEC_END:
+                ctx->ended = 1;
+                break;
+            default:
+                return ctx->error = 1;
+        }
+        if(ctx->in_pos == ctx->in.len) ctx->in_pos = ctx->in.len = 0;
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Feeds raw input to a context that sizes blocks adaptively.
+ * @details A block is compressed in place when it ends inside the input.
+ * Otherwise the input is buffered until the buffer holds enough data to
+ * decide the length of the next block.
+ *
+ * @param ctx The context
+ * @param in Raw input
+ * @param n Number of bytes of input, at least 1
+ * @return The number of bytes consumed, or -1 on error
+*/
+static ssize_t
+push_adaptive(HUFF_CTX *ctx, const unsigned char *in, size_t n) {
+    BLOCK *b = ctx->block;
+    OUTBUF *raw = &ctx->raw;
+    size_t k, len;
+
+    /* Compress a whole block in place */
+    if(ctx->raw_pos == raw->len
+       && (len = adapt_split(in, n, ctx->params.block_size, 0))) {
+        b->data = (unsigned char *)in;
+        b->size = len;
+        if((ctx->error = flush_block(ctx))) return -1;
+        return len;
+    }
+
+    /* Move the buffered input to the front to make room */
+    if(raw->len + n > raw->cap && ctx->raw_pos) {
+        raw->len -= ctx->raw_pos;
+        for(size_t i = 0; i < raw->len; ++i) *(raw->buf+i) = *(raw->buf+ctx->raw_pos+i);
+        ctx->raw_pos = 0;
+    }
+
+    /* Gather input */
+    k = raw->cap - raw->len;
+    if(k > n) k = n;
+    for(size_t i = 0; i < k; ++i) *(raw->buf+raw->len+i) = *(in+i);
+    raw->len += k;
+
+    /* Compress the next block once its length is certain */
+    if(raw->len - ctx->raw_pos == raw->cap) {
+        len = adapt_split(raw->buf + ctx->raw_pos, raw->len - ctx->raw_pos,
+                          ctx->params.block_size, 0);
+        b->data = raw->buf + ctx->raw_pos;
+        b->size = len;
+        ctx->raw_pos += len;
+        if((ctx->error = flush_block(ctx))) return -1;
+    }
+
+    return k;
+}
+
+/*
+ * Feed input to a context.
+ */
+ssize_t
+huff_push(HUFF_CTX *ctx, const unsigned char *in, size_t n) {
+    BLOCK *b = ctx->block;
+    size_t k, used;
+
+    if(ctx->error || ctx->finished) return -1;
+    if(ctx->npending || !n) return 0;
+
+    if(ctx->mode == HUFF_COMPRESS) {
+        if(ctx->params.adaptive) return push_adaptive(ctx, in, n);
+
+        /* Compress a whole block in place */
+        if(!b->size && n >= ctx->params.block_size) {
+            b->data = (unsigned char *)in;
+            b->size = ctx->params.block_size;
+            if((ctx->error = flush_block(ctx))) return -1;
+            return ctx->params.block_size;
+        }
+
+        /* Gather a block */
+        k = ctx->params.block_size - b->size;
+        if(k > n) k = n;
+        for(size_t i = 0; i < k; ++i) *(b->data+b->size+i) = *(in+i);
+        b->size += k;
+        if(b->size == ctx->params.block_size && (ctx->error = flush_block(ctx))) return -1;
+
+        return k;
+    }
+
+    if(ctx->ended) return n; // Block index trailer
+
+    /* Decode a whole block in place */
+    if(ctx->in.len == 0) {
+        switch(decode_block(ctx, in, n, &used)) {
+            case DEC_OK:
+                return used;
+            case DEC_END:
+                ctx->ended = 1;
+                return n;
+            case DEC_ERROR:
+                ctx->error = 1;
+                return -1;
+        }
+        ctx->retry_len = 2*n;
+    }
+
+    /* Buffer the input until the block is complete */
+    if((ctx->error = out_reserve(&ctx->in, n))) return -1;
+    for(size_t i = 0; i < n; ++i) *(ctx->in.buf+ctx->in.len+i) = *(in+i);
+    ctx->in.len += n;
+    if(advance(ctx)) return -1;
+
+    return n;
+}
+
+/*
+ * Compress the input buffered by a context.
+ */
+int
+huff_flush(HUFF_CTX *ctx) {
+    if(ctx->mode != HUFF_COMPRESS || ctx->finished) return 1;
+    ctx->flushing = 1;
+    return advance(ctx);
+}
+
+/*
+ * Signal the end of the input of a context.
+ */
+int
+huff_finish(HUFF_CTX *ctx) {
+    ctx->finished = 1;
+    return advance(ctx);
+}
+
+/*
+ * Take output from a context.
+ */
+ssize_t
+huff_pull(HUFF_CTX *ctx, unsigned char *out, size_t cap) {
+    size_t done = 0;
+
+    while(done < cap && ctx->npending) {
+        size_t k = ctx->npending < cap - done ? ctx->npending : cap - done;
+        for(size_t i = 0; i < k; ++i) *(out+done+i) = *(ctx->pending+i);
+        ctx->pending += k;
+        ctx->npending -= k;
+        done += k;
+        if(!ctx->npending && advance(ctx)) break;
+    }
+
+    return (!done && ctx->error) ? -1 : (ssize_t)done;
+}
+
+/*
+ * Get the largest compressed size of n bytes.
+ */
+size_t
+huff_compress_bound(HUFF_CTX *ctx, size_t n) {
+    size_t nblocks = n / ctx->params.block_size + 1;
+
+    /* Blocks that would grow are stored */
+    return n + nblocks * STORED_HEADER_SIZE
+           + (ctx->params.index ? INDEX_HEADER_SIZE + nblocks*INDEX_ENTRY_SIZE
+                                  + INDEX_FOOTER_SIZE : 0);
+}
+
+/*
+ * @brief Runs a whole stream held in a buffer through a context.
+ *
+ * @return The size of the output, or -1 on error or if it does not fit
+*/
+static ssize_t
+run_buf(HUFF_CTX *ctx, const unsigned char *in, size_t n, unsigned char *out,
+        size_t cap) {
+    size_t done = 0;
+    ssize_t k;
+
+    huff_ctx_reset(ctx);
+    while(n) {
+        if((k = huff_push(ctx, in, n)) < 0) return -1;
+        in += k;
+        n -= k;
+        if((k = huff_pull(ctx, out+done, cap-done)) < 0) return -1;
+        done += k;
+        if(ctx->npending) return -1; // Output does not fit
+    }
+    if(huff_finish(ctx)) return -1;
+    if((k = huff_pull(ctx, out+done, cap-done)) < 0) return -1;
+    done += k;
+
+    return (ctx->npending || ctx->error) ? -1 : (ssize_t)done;
+}
+
+/*
+ * Compress a buffer as a complete stream.
+ */
+ssize_t
+huff_compress_buf(HUFF_CTX *ctx, const unsigned char *in, size_t n,
+                  unsigned char *out, size_t cap) {
+    if(ctx->mode != HUFF_COMPRESS) return -1;
+    return run_buf(ctx, in, n, out, cap);
+}
+
+/*
+ * Decompress a complete stream held in a buffer.
+ */
+ssize_t
+huff_decompress_buf(HUFF_CTX *ctx, const unsigned char *in, size_t n,
+                    unsigned char *out, size_t cap) {
+    if(ctx->mode != HUFF_DECOMPRESS) return -1;
+    return run_buf(ctx, in, n, out, cap);
+}
@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "block.h"
+#include "io.h"
+#include "debug.h"
+
+/*
+ * Number of bytes before the read position that the standard input INBUF
+ * keeps across a refill, so that a reader can give back what it read ahead.
+ */
+#define LOOKBACK    8
+
+/*
+ * Standard input: either mapped, or read into in_buf.
+ */
+static unsigned char in_buf[LOOKBACK + IO_BUF_SIZE];
+static INBUF stdin_in;
+static int in_ready;            // Set once stdin_in is set up
+static unsigned char *in_map;   // Mapping of standard input, or NULL
+static size_t in_map_len;       // Length of the mapping
+static off_t in_start;          // File offset of stdin_in.buf when mapped
+
+/*
+ * Output buffer.
+ */
+static unsigned char out_buf[IO_BUF_SIZE];
+static size_t out_len;
+
+static int io_failed;           // Set when a read or write fails
+
+/*
+ * @brief Refills the standard input buffer.
+ * @details The last LOOKBACK bytes read are moved to the front of the
+ * buffer, followed by as much new input as one read() returns.
+ *
+ * @param in Standard input INBUF
+ * @return 0 on success, 1 at EOF or on error
+*/
+static int
+fill_stdin(INBUF *in) {
+    size_t keep = in->len < LOOKBACK ? in->len : LOOKBACK;
+    ssize_t n;
+
+    for(size_t i = 0; i < keep; ++i) *(in_buf+i) = *(in_buf+in->len-keep+i);
+    in->pos = keep;
+    in->len = keep;
+
+    while((n = read(STDIN_FILENO, in_buf+keep, IO_BUF_SIZE)) < 0 && errno == EINTR);
+    if(n < 0) io_failed = 1;
+    if(n <= 0) return 1;
+    in->len += n;
+
+    return 0;
+}
+
+/*
+ * Get the INBUF reading standard input.
+ */
+INBUF *
+io_stdin() {
+    struct stat st;
+
+    if(in_ready) return &stdin_in;
+    in_ready = 1;
+
+    stdin_in.buf = in_buf;
+    stdin_in.fill = fill_stdin;
+
+    /* Map a regular file from its current offset */
+    in_start = lseek(STDIN_FILENO, 0, SEEK_CUR);
+    if(in_start < 0 || fstat(STDIN_FILENO, &st) || !S_ISREG(st.st_mode)
+       || st.st_size <= in_start)
+        return &stdin_in;
+    in_map_len = st.st_size;
+    in_map = mmap(NULL, in_map_len, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0);
+    if(in_map == MAP_FAILED) {
+        in_map = NULL;
+        return &stdin_in;
+    }
+    madvise(in_map, in_map_len, MADV_SEQUENTIAL);
+
+    stdin_in.buf = in_map + in_start;
+    stdin_in.len = in_map_len - in_start;
+    stdin_in.fill = NULL;
+
+    return &stdin_in;
+}
+
+/*
+ * Read bytes from standard input.
+ */
+size_t
+io_read(unsigned char *dst, size_t n) {
+    INBUF *in = io_stdin();
+    size_t done = 0;
+
+    while(done < n) {
+        if(in->pos == in->len && (in->fill == NULL || in->fill(in))) break;
+        size_t k = in->len - in->pos;
+        if(k > n - done) k = n - done;
+        const unsigned char *src = in->buf + in->pos;
+        for(size_t i = 0; i < k; ++i) *(dst+done+i) = *(src+i);
+        in->pos += k;
+        done += k;
+    }
+
+    return done;
+}
+
+/*
+ * Write all of a buffer to a file, at an offset if one is given.
+ */
+int
+write_full(int fd, const unsigned char *buf, size_t n, off_t offset) {
+    while(n) {
+        ssize_t w = (offset < 0) ? write(fd, buf, n) : pwrite(fd, buf, n, offset);
+        if(w < 0 && errno == EINTR) continue;
+        if(w <= 0) return 1;
+        buf += w;
+        n -= w;
+        if(offset >= 0) offset += w;
+    }
+
+    return 0;
+}
+
+/*
+ * Read all of a buffer from a file at an offset.
+ */
+int
+read_full(int fd, unsigned char *buf, size_t n, off_t offset) {
+    while(n) {
+        ssize_t r = pread(fd, buf, n, offset);
+        if(r < 0 && errno == EINTR) continue;
+        if(r <= 0) return 1;
+        buf += r;
+        n -= r;
+        offset += r;
+    }
+
+    return 0;
+}
+
+/*
+ * Write the contents of the output buffer to standard output.
+ */
+int
+io_flush() {
+    if(out_len && write_full(STDOUT_FILENO, out_buf, out_len, -1)) io_failed = 1;
+    out_len = 0;
+
+    return io_failed;
+}
+
+/*
+ * Write bytes to standard output through the output buffer.
+ */
+int
+io_write(const unsigned char *buf, size_t n) {
+    /* Large writes go straight out */
+    if(n >= IO_BUF_SIZE) {
+        if(io_flush()) return 1;
+        if(write_full(STDOUT_FILENO, buf, n, -1)) io_failed = 1;
+        return io_failed;
+    }
+
+    if(out_len + n > IO_BUF_SIZE && io_flush()) return 1;
+    for(size_t i = 0; i < n; ++i) *(out_buf+out_len+i) = *(buf+i);
+    out_len += n;
+
+    return 0;
+}
+
+/*
+ * Check whether reading standard input or writing standard output failed.
+ */
+int
+io_error() {
+    return io_failed;
+}
+
+/*
+ * Release standard input, leaving its file offset after the bytes that
+ * were used.
+ */
+void
+io_close() {
+    if(in_map) {
+        lseek(STDIN_FILENO, in_start + stdin_in.pos, SEEK_SET);
+        munmap(in_map, in_map_len);
+        in_map = NULL;
+        in_ready = 0;
+    }
+}
@@ -0,0 +1,109 @@
+#include <stdlib.h>
+#include "const.h"
+#include "block.h"
+#include "lz.h"
+#include "debug.h"
+
+#define LZ_HASH_SIZE    (1 << LZ_HASH_BITS)
+#define LZ_WINDOW_MASK  (LZ_WINDOW - 1)
+
+/*
+ * @brief Hashes the LZ_MIN_MATCH bytes at a position.
+ *
+ * @param p The bytes
+ * @return Index in the chain heads
+*/
+static inline unsigned
+lz_hash(const unsigned char *p) {
+    uint32_t v = *p | (*(p+1) << 8) | (*(p+2) << 16) | ((uint32_t)*(p+3) << 24);
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/*
+ * @brief Adds a position to its hash chain.
+ *
+ * @param b Block being parsed
+ * @param i Position, with LZ_MIN_MATCH bytes of data from it
+*/
+static inline void
+lz_insert(BLOCK *b, unsigned i) {
+    unsigned h = lz_hash(b->data+i);
+    *(b->chain + (i & LZ_WINDOW_MASK)) = *(b->head+h);
+    *(b->head+h) = i;
+}
+
+/*
+ * @brief Finds the longest match at a position among the positions of
+ * its hash chain.
+ *
+ * @param b Block being parsed, with the positions before i inserted
+ * @param i Position, with LZ_MIN_MATCH bytes of data from it
+ * @param dist Set to the distance of the match
+ * @return Length of the match, less than LZ_MIN_MATCH if there is none
+*/
+static unsigned
+lz_longest(BLOCK *b, unsigned i, unsigned *dist) {
+    const unsigned char *data = b->data;
+    const unsigned max = (b->size - i < LZ_MAX_MATCH) ? b->size - i : LZ_MAX_MATCH;
+    int32_t cand = *(b->head + lz_hash(data+i));
+    unsigned best = 0;
+
+    for(int depth = 0; cand >= 0 && i - cand < LZ_WINDOW && depth < LZ_MAX_CHAIN; ++depth) {
+        /* A longer match must at least differ from the best one at its end */
+        if(*(data+cand+best) == *(data+i+best)) {
+            unsigned len = 0;
+            while(len < max && *(data+cand+len) == *(data+i+len)) len++;
+            if(len > best) {
+                best = len;
+                *dist = i - cand;
+                if(best == max) break;
+            }
+        }
+        cand = *(b->chain + (cand & LZ_WINDOW_MASK));
+    }
+
+    return best;
+}
+
+/*
+ * Parse the data of a block into tokens.
+ */
+int
+lz_parse(BLOCK *b) {
+    unsigned i = 0, len, dist;
+
+    /* The matcher's tables are allocated with the first block parsed */
+    if(b->head == NULL && (b->head = malloc(LZ_HASH_SIZE * sizeof(int32_t))) == NULL)
+        return 1;
+    if(b->chain == NULL && (b->chain = malloc(LZ_WINDOW * sizeof(int32_t))) == NULL)
+        return 1;
+
+    /* At most one token per byte */
+    if(b->size > b->tokens_cap) {
+        uint32_t *t = realloc(b->tokens, b->size * sizeof(uint32_t));
+        if(t == NULL) return 1;
+        b->tokens = t;
+        b->tokens_cap = b->size;
+    }
+    for(int h = 0; h < LZ_HASH_SIZE; ++h) *(b->head+h) = -1;
+
+    b->ntokens = 0;
+    while(i < b->size) {
+        len = 0;
+        if(b->size - i >= LZ_MIN_MATCH) {
+            len = lz_longest(b, i, &dist);
+            lz_insert(b, i);
+        }
+        if(len < LZ_MIN_MATCH) {
+            *(b->tokens + b->ntokens++) = *(b->data + i++);
+            continue;
+        }
+
+        /* The positions inside the match are candidates for later ones */
+        *(b->tokens + b->ntokens++) = LZ_MATCH(len, dist);
+        for(unsigned j = i+1; j < i+len && b->size - j >= LZ_MIN_MATCH; ++j) lz_insert(b, j);
+        i += len;
+    }
+
+    return 0;
+}
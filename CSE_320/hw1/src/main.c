@@ -1,6 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "const.h"
+#include "options.h"
+#include "extract.h"
+#include "tables.h"
 #include "debug.h"
 
 int main(int argc, char **argv) {
@@ -8,16 +11,26 @@ int main(int argc, char **argv) {
     
     /* Validate program arguments */
     if(validargs(argc, argv)) {
-        USAGE(*argv, EXIT_FAILURE);
+        HUFF_USAGE(*argv, EXIT_FAILURE);
     }
     
+    /* Load the custom code table */
+    if(global_table_path && table_load(global_table_path)) {
+        fprintf(stderr, "%s: cannot load code table %s\n", *argv, global_table_path);
+        return EXIT_FAILURE;
+    }
+
     /* Perform Operation based on global_options (set by validargs()) */
     if(global_options & 1) { 
-        USAGE(*argv, EXIT_SUCCESS); /* PRINT UTILITY USAGE */
+        HUFF_USAGE(*argv, EXIT_SUCCESS); /* PRINT UTILITY USAGE */
     } else if(global_options & 2) {
         return compress();          /* COMPRESS STDIN DATA */
     } else if (global_options & 4) {
+        if(global_options & (1 << G_OP_R))
+            return extract(global_range_offset, global_range_len); /* EXTRACT RANGE */
         return decompress();        /* DECOMPRESS STDIN DATA */
+    } else if(global_options & (1 << G_OP_T)) {
+        return train();             /* TRAIN A CODE TABLE */
     }
 
     return EXIT_SUCCESS;
@@ -0,0 +1,426 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "const.h"
+#include "huff.h"
+#include "block.h"
+#include "container.h"
+#include "options.h"
+#include "parallel.h"
+#include "io.h"
+#include "adapt.h"
+#include "debug.h"
+
+/* Number of blocks that can be in flight for every worker thread */
+#define SLOTS_PER_THREAD 2
+
+/* States of a slot */
+#define SLOT_FREE   0   // Compressed block has been written (or never used)
+#define SLOT_READ   1   // Raw block is waiting to be compressed
+#define SLOT_DONE   2   // Compressed block is waiting to be written
+
+/*
+ * A slot holds one block on its way from the reader, through a worker,
+ * to the writer. Block number "seq" always uses slot seq % nslots.
+ */
+typedef struct slot {
+    BLOCK *block;   // Block state owned by the slot
+    int state;      // SLOT_FREE, SLOT_READ or SLOT_DONE
+} SLOT;
+
+/*
+ * State shared by the reader/writer (the calling thread) and the workers.
+ */
+typedef struct pool {
+    SLOT *slots;                // Ring of slots
+    int nslots;                 // Number of slots
+    unsigned long next_read;    // Number of blocks read so far
+    unsigned long next_work;    // Number of blocks handed to workers so far
+    int eof;                    // Set when no more blocks will be read
+    int error;                  // Set when a worker failed
+    BLOCK_INDEX *idx;           // Block index being built, or NULL
+    pthread_mutex_t mutex;      // Protects everything above
+    pthread_cond_t work_cond;   // Signalled when a block is read, or at EOF
+    pthread_cond_t done_cond;   // Signalled when a block is compressed
+} POOL;
+
+/*
+ * Raw input waiting to be cut into blocks when sizing blocks adaptively.
+ */
+typedef struct stage {
+    unsigned char *buf;     // Buffered raw input
+    size_t pos;             // Index of the next byte
+    size_t len;             // Number of bytes in the buffer
+    size_t cap;             // Size of the buffer
+    int eof;                // Set once standard input is exhausted
+} STAGE;
+
+/*
+ * @brief Reads the next adaptively sized block from standard input.
+ *
+ * @param st The STAGE buffering standard input
+ * @param window Window size of adaptive block sizing
+ * @param dst Buffer of MAX_ADAPTIVE_BLOCK bytes receiving the block
+ * @return Size of the block, 0 at EOF
+*/
+static size_t
+read_adaptive(STAGE *st, unsigned window, unsigned char *dst) {
+    size_t len, n;
+
+    while(!(len = adapt_split(st->buf+st->pos, st->len-st->pos, window, st->eof))) {
+        if(st->eof) return 0;
+
+        /* Move the buffered input to the front, then fill the buffer */
+        st->len -= st->pos;
+        for(size_t i = 0; i < st->len; ++i) *(st->buf+i) = *(st->buf+st->pos+i);
+        st->pos = 0;
+        n = io_read(st->buf+st->len, st->cap-st->len);
+        if(n < st->cap-st->len) st->eof = 1;
+        st->len += n;
+    }
+
+    for(size_t i = 0; i < len; ++i) *(dst+i) = *(st->buf+st->pos+i);
+    st->pos += len;
+
+    return len;
+}
+
+/*
+ * @brief Worker thread: compresses blocks in the order they were read
+ * until the reader reaches EOF.
+ *
+ * @param arg The POOL
+ * @return NULL
+*/
+static void *
+worker(void *arg) {
+    POOL *p = arg;
+    SLOT *s;
+    int err;
+
+    for(;;) {
+        /* Critical Section Start */
+        pthread_mutex_lock(&p->mutex);
+        while(p->next_work == p->next_read && !p->eof)
+            pthread_cond_wait(&p->work_cond, &p->mutex);
+        if(p->next_work == p->next_read) {
+            pthread_mutex_unlock(&p->mutex);
+            return NULL; // No more blocks
+        }
+        s = p->slots + (p->next_work++ % p->nslots);
+        pthread_mutex_unlock(&p->mutex);
+        /* Critical Section End */
+
+        err = compress_data(s->block);
+
+        /* Critical Section Start */
+        pthread_mutex_lock(&p->mutex);
+        s->state = SLOT_DONE;
+        if(err) p->error = 1;
+        pthread_cond_broadcast(&p->done_cond);
+        pthread_mutex_unlock(&p->mutex);
+        /* Critical Section End */
+    }
+}
+
+/*
+ * @brief Waits for a block to be compressed and writes it to standard output.
+ *
+ * @param p The POOL
+ * @param seq Number of the block
+ * @return 0 on success, 1 if a worker failed
+*/
+static int
+write_block(POOL *p, unsigned long seq) {
+    SLOT *s = p->slots + (seq % p->nslots);
+
+    /* Critical Section Start */
+    pthread_mutex_lock(&p->mutex);
+    while(s->state != SLOT_DONE && !p->error)
+        pthread_cond_wait(&p->done_cond, &p->mutex);
+    int err = p->error;
+    pthread_mutex_unlock(&p->mutex);
+    /* Critical Section End */
+
+    if(err) return 1;
+
+    if(io_write(s->block->out.buf, s->block->out.len)) return 1;
+    s->state = SLOT_FREE;
+    if(p->idx && index_add(p->idx, s->block->size, s->block->out.len)) return 1;
+
+    return 0;
+}
+
+/*
+ * Reads raw data from standard input and writes compressed data to
+ * standard output, compressing blocks in parallel.
+ */
+int
+compress_parallel(int nthreads, BLOCK_INDEX *idx) {
+    const unsigned bsz = ((unsigned)global_options >> G_OP_BS) + 1; // Block size
+    const int adaptive = (global_options >> G_OP_A) & 1;
+    STAGE st = {0};         // Input buffer of adaptive block sizing
+    POOL pool = {0};
+    pthread_t *tids;
+    int nstarted = 0;       // Number of worker threads started
+    int ret = 0;
+    unsigned long next_write = 0; // Number of blocks written so far
+
+    pool.idx = idx;
+    pool.nslots = nthreads * SLOTS_PER_THREAD;
+    pool.slots = calloc(pool.nslots, sizeof(SLOT));
+    tids = calloc(nthreads, sizeof(pthread_t));
+    if(pool.slots == NULL || tids == NULL) {
+        free(pool.slots);
+        free(tids);
+        return 1;
+    }
+    if(adaptive) {
+        st.cap = MAX_ADAPTIVE_BLOCK + bsz;
+        if((st.buf = malloc(st.cap)) == NULL) {
+            ret = 1;
+            goto cleanup;
+        }
+    }
+    for(int i = 0; i < pool.nslots; ++i) {
+        BLOCK *b = (pool.slots+i)->block = block_init();
+        if(b == NULL) {
+            ret = 1;
+            goto cleanup;
+        }
+        b->max_len = global_max_code_len;
+        b->interleave = (global_options >> G_OP_M) & 1;
+        b->use_static = global_use_static;
+        b->rle = global_rle;
+        b->lz = global_lz;
+        b->ans = global_ans;
+        b->sync_every = global_sync_every;
+        b->sample = global_sample;
+        if(adaptive) {
+            /* Room for the largest block */
+            unsigned char *data = realloc(b->data, MAX_ADAPTIVE_BLOCK);
+            if(data == NULL) {
+                ret = 1;
+                goto cleanup;
+            }
+            b->data = data;
+        }
+    }
+
+    pthread_mutex_init(&pool.mutex, NULL);
+    pthread_cond_init(&pool.work_cond, NULL);
+    pthread_cond_init(&pool.done_cond, NULL);
+
+    /* Start the workers */
+    for(; nstarted < nthreads; ++nstarted) {
+        if(pthread_create(tids+nstarted, NULL, worker, &pool)) break;
+    }
+    if(!nstarted) ret = 1;
+
+    /* Read blocks, writing out the oldest one whenever the ring is full */
+    while(!ret) {
+        if(pool.next_read - next_write == pool.nslots) {
+            if(write_block(&pool, next_write++)) {
+                ret = 1;
+                break;
+            }
+        }
+
+        SLOT *s = pool.slots + (pool.next_read % pool.nslots);
+        size_t n = adaptive ? read_adaptive(&st, bsz, s->block->data)
+                            : io_read(s->block->data, bsz);
+        if(!n) break; // End of File
+        s->block->size = n;
+
+        /* Critical Section Start */
+        pthread_mutex_lock(&pool.mutex);
+        s->state = SLOT_READ;
+        pool.next_read++;
+        pthread_cond_signal(&pool.work_cond);
+        pthread_mutex_unlock(&pool.mutex);
+        /* Critical Section End */
+
+        if(!adaptive && n < bsz) break; // End of File
+    }
+
+    /* No more blocks */
+    pthread_mutex_lock(&pool.mutex);
+    pool.eof = 1;
+    pthread_cond_broadcast(&pool.work_cond);
+    pthread_mutex_unlock(&pool.mutex);
+
+    /* Write the remaining blocks in order */
+    while(!ret && next_write < pool.next_read) {
+        if(write_block(&pool, next_write++)) ret = 1;
+    }
+
+    for(int i = 0; i < nstarted; ++i) pthread_join(*(tids+i), NULL);
+
+    pthread_mutex_destroy(&pool.mutex);
+    pthread_cond_destroy(&pool.work_cond);
+    pthread_cond_destroy(&pool.done_cond);
+
+cleanup:
+    for(int i = 0; i < pool.nslots; ++i) {
+        if((pool.slots+i)->block) block_fini((pool.slots+i)->block);
+    }
+    free(pool.slots);
+    free(tids);
+    free(st.buf);
+
+    /* Check for IO error */
+    if(io_error()) return 1;
+
+    return ret;
+}
+
+/*
+ * State shared by the workers of a parallel decompression.
+ */
+typedef struct dpool {
+    BLOCK_INDEX *idx;           // Block index of the input
+    int in_fd;                  // Compressed input
+    int out_fd;                 // Decompressed output
+    off_t out_base;             // Offset of the output in out_fd
+    int positioned;             // Set if blocks are written with pwrite()
+    size_t next_block;          // Number of blocks handed to workers so far
+    size_t next_write;          // Number of blocks written so far (without pwrite())
+    int error;                  // Set when a worker failed
+    pthread_mutex_t mutex;      // Protects next_block, next_write and error
+    pthread_cond_t write_cond;  // Signalled when a block has been written
+} DPOOL;
+
+/*
+ * @brief Records a failure and wakes up the workers waiting to write.
+ *
+ * @param p The DPOOL
+*/
+static void
+dpool_fail(DPOOL *p) {
+    pthread_mutex_lock(&p->mutex);
+    p->error = 1;
+    pthread_cond_broadcast(&p->write_cond);
+    pthread_mutex_unlock(&p->mutex);
+}
+
+/*
+ * @brief Worker thread: decompresses blocks until none are left.
+ * @details Each block is read from its offset in the input, decompressed,
+ * and written at its offset in the output with pwrite(). When the output
+ * is not seekable, the worker instead waits for its turn and writes the
+ * blocks in order.
+ *
+ * @param arg The DPOOL
+ * @return NULL
+*/
+static void *
+dworker(void *arg) {
+    DPOOL *p = arg;
+    BLOCK *b = block_init();
+    unsigned char *cbuf = NULL; // Compressed block
+    size_t ccap = 0, clen;
+    size_t i;
+
+    if(b == NULL) {
+        dpool_fail(p);
+        return NULL;
+    }
+
+    for(;;) {
+        /* Critical Section Start */
+        pthread_mutex_lock(&p->mutex);
+        if(p->error || p->next_block == p->idx->count) {
+            pthread_mutex_unlock(&p->mutex);
+            break;
+        }
+        i = p->next_block++;
+        pthread_mutex_unlock(&p->mutex);
+        /* Critical Section End */
+
+        INDEX_ENTRY *e = p->idx->entries+i;
+        if(index_read_block(p->idx, p->in_fd, i, &cbuf, &ccap, &clen)) {
+            dpool_fail(p);
+            break;
+        }
+        INBUF in = { cbuf, 0, clen, NULL };
+        if(decompress_data(b, &in) || b->out.len != e->raw_len) {
+            dpool_fail(p);
+            break;
+        }
+
+        if(p->positioned) {
+            if(write_full(p->out_fd, b->out.buf, b->out.len, p->out_base + e->raw_offset)) {
+                dpool_fail(p);
+                break;
+            }
+            continue;
+        }
+
+        /* Wait for the previous blocks to be written */
+        pthread_mutex_lock(&p->mutex);
+        while(p->next_write != i && !p->error)
+            pthread_cond_wait(&p->write_cond, &p->mutex);
+        int err = p->error;
+        pthread_mutex_unlock(&p->mutex);
+        if(err || write_full(p->out_fd, b->out.buf, b->out.len, -1)) {
+            dpool_fail(p);
+            break;
+        }
+
+        pthread_mutex_lock(&p->mutex);
+        p->next_write++;
+        pthread_cond_broadcast(&p->write_cond);
+        pthread_mutex_unlock(&p->mutex);
+    }
+
+    free(cbuf);
+    block_fini(b);
+    return NULL;
+}
+
+/*
+ * Decompresses a seekable compressed input in parallel using its block
+ * index, writing the decompressed data to standard output.
+ */
+int
+decompress_parallel(int nthreads, BLOCK_INDEX *idx) {
+    DPOOL pool = {0};
+    pthread_t *tids;
+    struct stat st;
+    int nstarted = 0;
+    int flags;
+
+    pool.idx = idx;
+    pool.in_fd = fileno(stdin);
+    pool.out_fd = fileno(stdout);
+    if(io_flush()) return 1;
+
+    /* Positioned writes need a regular file not opened for appending */
+    flags = fcntl(pool.out_fd, F_GETFL);
+    pool.out_base = lseek(pool.out_fd, 0, SEEK_CUR);
+    pool.positioned = !fstat(pool.out_fd, &st) && S_ISREG(st.st_mode)
+                      && flags >= 0 && !(flags & O_APPEND) && pool.out_base >= 0;
+
+    if((tids = calloc(nthreads, sizeof(pthread_t))) == NULL) return 1;
+    pthread_mutex_init(&pool.mutex, NULL);
+    pthread_cond_init(&pool.write_cond, NULL);
+
+    for(; nstarted < nthreads; ++nstarted) {
+        if(pthread_create(tids+nstarted, NULL, dworker, &pool)) break;
+    }
+    if(!nstarted) pool.error = 1;
+    for(int i = 0; i < nstarted; ++i) pthread_join(*(tids+i), NULL);
+
+    pthread_mutex_destroy(&pool.mutex);
+    pthread_cond_destroy(&pool.write_cond);
+    free(tids);
+
+    /* Leave the output offset after the data, as write() would have */
+    if(pool.positioned && !pool.error)
+        lseek(pool.out_fd, pool.out_base + idx->raw_size, SEEK_SET);
+
+    return pool.error;
+}
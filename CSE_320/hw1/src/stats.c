@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include "block.h"
+#include "huff_ctx.h"
+#include "options.h"
+#include "stats.h"
+
+/*
+ * @brief Gets the name of a block type in the statistics.
+ *
+ * @param type First byte of the block
+ * @return Name of the type
+*/
+static const char *
+type_name(int type) {
+    static const char *names[] = {
+        "canonical", "stored", "interleaved", "static", "repeat", "rle", "lz",
+        "ans", "sync", "sampled"
+    };
+
+    if(type <= 2) return "tree";
+    if(type >= BLOCK_CANONICAL && type <= BLOCK_SAMPLED) return *(names + type - BLOCK_CANONICAL);
+    return "unknown";
+}
+
+/*
+ * @brief Writes the statistics of a block as a JSON line; the stats hook
+ * of the contexts opened with stats_open().
+ *
+ * @param st Statistics of the block
+ * @param arg The statistics file
+*/
+static void
+print_stats(const HUFF_STATS *st, void *arg) {
+    fprintf(arg, "{\"block\": %lu, \"mode\": \"%s\", \"type\": \"%s\", \"sync_points\": %u, "
+            "\"raw_size\": %zu, \"compressed_size\": %zu, \"symbols\": %d, "
+            "\"entropy\": %.4f, \"bits_per_symbol\": %.4f, \"max_code_len\": %d, "
+            "\"desc_size\": %zu, \"phase_ns\": {\"histogram\": %llu, \"tree_build\": %llu, "
+            "\"tree_emit\": %llu, \"encode\": %llu, \"decode\": %llu}}\n",
+            st->block, st->mode == HUFF_COMPRESS ? "compress" : "decompress",
+            type_name(st->type), st->sync_points, st->raw_size, st->comp_size, st->symbols,
+            st->entropy, st->bits_per_symbol, st->max_code_len, st->desc_size,
+            (unsigned long long)st->hist_ns, (unsigned long long)st->tree_ns,
+            (unsigned long long)st->emit_ns, (unsigned long long)st->encode_ns,
+            (unsigned long long)st->decode_ns);
+}
+
+/*
+ * Set the stats hook of the parameters of a context when -v is given.
+ */
+int
+stats_open(HUFF_PARAMS *params) {
+    if(!global_stats_path) return 0;
+
+    params->stats = print_stats;
+    if(*global_stats_path == '-' && !*(global_stats_path+1)) params->stats_arg = stderr;
+    else params->stats_arg = fopen(global_stats_path, "w");
+
+    return params->stats_arg == NULL;
+}
+
+/*
+ * Close the statistics file opened by stats_open().
+ */
+int
+stats_close(HUFF_PARAMS *params) {
+    FILE *f = params->stats_arg;
+
+    if(f == NULL) return 0;
+    if(f == stderr) return fflush(f) != 0;
+    return fclose(f) != 0;
+}
@@ -0,0 +1,137 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include "block.h"
+#include "huff_ctx.h"
+#include "io.h"
+#include "stream.h"
+
+/*
+ * Run standard input through a context to standard output.
+ */
+int
+run_ctx(HUFF_CTX *ctx) {
+    INBUF *in = io_stdin();
+    unsigned char *obuf = malloc(IO_BUF_SIZE); // Output pulled from the context
+    ssize_t k;
+    int ret = 0;
+
+    if(obuf == NULL) return 1;
+
+    for(;;) {
+        /* Push the input */
+        if(in->pos == in->len && (in->fill == NULL || in->fill(in))) break;
+        if((k = huff_push(ctx, in->buf + in->pos, in->len - in->pos)) < 0) {
+            ret = 1;
+            break;
+        }
+        in->pos += k;
+
+        /* Pull the output */
+        while((k = huff_pull(ctx, obuf, IO_BUF_SIZE)) > 0 && !io_write(obuf, k));
+        if(k) {
+            ret = 1;
+            break;
+        }
+    }
+
+    if(!ret && huff_finish(ctx)) ret = 1;
+    while(!ret && (k = huff_pull(ctx, obuf, IO_BUF_SIZE))) {
+        if(k < 0 || io_write(obuf, k)) ret = 1;
+    }
+    free(obuf);
+
+    if(io_flush()) ret = 1;
+    io_close();
+
+    return ret;
+}
+
+/*
+ * @brief Moves the output of a context to standard output.
+ *
+ * @param ctx The context
+ * @param obuf Buffer of IO_BUF_SIZE bytes
+ * @return 0 on success, 1 on error
+*/
+static int
+drain_ctx(HUFF_CTX *ctx, unsigned char *obuf) {
+    ssize_t k;
+
+    while((k = huff_pull(ctx, obuf, IO_BUF_SIZE)) > 0) {
+        if(io_write(obuf, k)) return 1;
+    }
+
+    return k < 0;
+}
+
+/*
+ * Compress standard input as it arrives, cutting a block short when no
+ * input arrives for a while.
+ */
+int
+run_stream(HUFF_CTX *ctx, int timeout) {
+    struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+    const int flags = fcntl(STDIN_FILENO, F_GETFL);
+    unsigned char *ibuf = malloc(IO_BUF_SIZE);  // Input read
+    unsigned char *obuf = malloc(IO_BUF_SIZE);  // Output pulled from the context
+    int buffered = 0;   // Set while input waits in the context for a block
+    ssize_t n, k;
+    int ret = 0;
+
+    if(ibuf == NULL || obuf == NULL || flags < 0
+       || fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK) < 0) {
+        free(ibuf);
+        free(obuf);
+        return 1;
+    }
+
+    for(;;) {
+        int r = poll(&pfd, 1, buffered ? timeout : -1);
+        if(r < 0 && errno == EINTR) continue;
+        if(r < 0) {
+            ret = 1;
+            break;
+        }
+
+        /* Idle: cut the block */
+        if(!r) {
+            buffered = 0;
+            if(huff_flush(ctx) || drain_ctx(ctx, obuf) || io_flush()) {
+                ret = 1;
+                break;
+            }
+            continue;
+        }
+
+        if((n = read(STDIN_FILENO, ibuf, IO_BUF_SIZE)) < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
+            ret = 1;
+            break;
+        }
+        if(!n) break;
+
+        /* Push the input, taking the blocks that complete */
+        for(unsigned char *p = ibuf; n; p += k, n -= k) {
+            if((k = huff_push(ctx, p, n)) < 0 || drain_ctx(ctx, obuf)) {
+                ret = 1;
+                break;
+            }
+        }
+        if(ret || io_flush()) {
+            ret = 1;
+            break;
+        }
+        buffered = 1;
+    }
+
+    fcntl(STDIN_FILENO, F_SETFL, flags);
+    if(!ret && (huff_finish(ctx) || drain_ctx(ctx, obuf))) ret = 1;
+    free(ibuf);
+    free(obuf);
+    if(io_flush()) ret = 1;
+
+    return ret;
+}
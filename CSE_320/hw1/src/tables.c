@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "const.h"
+#include "block.h"
+#include "tables.h"
+#include "io.h"
+#include "debug.h"
+
+/*
+ * Built-in tables, made with "huff -t":
+ *     text    rsrc/gettysburg.txt, the CSE_320 README and the hw4 recipes
+ *     GEDCOM  the GEDCOM files of the hw2 tests
+ *     binary  the x86-64 object files of this program (gcc -O0)
+ */
+
+/* Built-in table TABLE_TEXT */
+static const unsigned char text_table[MAX_SYMBOLS] = {
+    13, 12, 12, 12, 12, 12, 12, 12, 12,  8,  5, 12, 12, 10, 12, 12,  // 0x00
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,  // 0x10
+     3, 11, 11,  9, 12, 12, 10, 11,  8,  8,  9, 12,  7,  6,  7, 10,  // 0x20
+    11, 11, 10, 11, 11, 11, 12, 12, 12, 12,  8, 10, 12, 12, 10, 12,  // 0x30
+    12, 12, 10,  9, 10, 10, 10, 10,  9,  8, 11, 12,  9,  9, 10,  9,  // 0x40
+     9, 12, 10,  8,  9, 10, 11,  9, 10, 12, 12, 12, 11, 12, 12,  8,  // 0x50
+    12,  4,  7,  5,  5,  4,  6,  5,  5,  5,  9,  7,  5,  6,  4,  4,  // 0x60
+     6, 11,  4,  5,  4,  6,  7,  7, 10,  7, 12, 10, 10, 10, 12, 12,  // 0x70
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,  // 0x80
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,  // 0x90
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,  // 0xA0
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,  // 0xB0
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,  // 0xC0
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,  // 0xD0
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,  // 0xE0
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,  // 0xF0
+    13                                                              // END
+};
+
+/* Built-in table TABLE_GEDCOM */
+static const unsigned char gedcom_table[MAX_SYMBOLS] = {
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15,  4, 15, 15, 15, 15, 15,  // 0x00
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,  // 0x10
+     2, 12, 15, 15, 15, 15, 15, 14, 12, 12, 15, 15,  8, 11, 10,  7,  // 0x20
+     6,  4,  5,  7,  7,  7,  7,  7,  7,  7, 14, 15, 15, 15, 13, 15,  // 0x30
+     4,  5,  7,  6,  6,  5,  5, 10,  7,  5, 10, 10,  7,  5,  6,  9,  // 0x40
+     8, 13,  7,  6,  6,  8, 10,  8,  8, 11, 15, 15, 15, 15, 15,  9,  // 0x50
+    15,  6,  9,  8,  7,  6,  8,  8,  8,  7, 14,  9,  7,  8,  6,  6,  // 0x60
+    10, 13,  6,  7,  7,  8, 10,  9, 11,  9, 11, 15, 15, 15, 15, 15,  // 0x70
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,  // 0x80
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,  // 0x90
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,  // 0xA0
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,  // 0xB0
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,  // 0xC0
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,  // 0xD0
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,  // 0xE0
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,  // 0xF0
+    15                                                              // END
+};
+
+/* Built-in table TABLE_BINARY */
+static const unsigned char binary_table[MAX_SYMBOLS] = {
+     1,  6,  7,  8,  7,  8,  9,  8,  8, 10,  9, 11,  8,  9,  9,  7,  // 0x00
+     7, 10, 10, 11, 10, 11, 12, 12, 10, 12, 12, 11,  9, 12, 12, 11,  // 0x10
+     7, 12, 13, 12, 12, 11, 13, 13, 10, 10, 11, 11, 11, 11,  9, 12,  // 0x20
+     9, 10, 10, 12, 11, 12, 12, 12, 10, 10, 11, 10, 11, 11, 12, 12,  // 0x30
+     8,  9, 12,  9, 12,  5, 11, 11,  4, 12, 12, 12, 11, 10, 12, 12,  // 0x40
+     8, 11, 12, 12, 12,  8, 12, 13, 11, 12, 13, 12, 11, 11, 13,  8,  // 0x50
+    11,  8,  9,  8,  9,  8,  9, 11, 10,  9, 13, 11,  9,  9,  9,  8,  // 0x60
+     9, 13,  8,  8,  7,  8, 12, 11, 10, 11, 12, 13, 11,  8, 10, 12,  // 0x70
+     9, 11, 12,  7, 11,  8, 10, 14, 10,  6, 13,  5, 12,  8, 12, 13,  // 0x80
+     9, 13, 13, 14, 13, 11, 14, 14,  9, 13, 13, 12, 13, 14, 15, 14,  // 0x90
+    11, 13, 15, 13, 12, 13, 14, 13, 12, 15, 13, 13, 12, 13, 14, 12,  // 0xA0
+    10, 12, 13, 13, 12, 12,  9, 11,  8, 12, 11, 13, 12, 12, 11, 12,  // 0xB0
+     7,  9,  8, 10, 12, 12, 10,  7,  8, 10, 11, 14, 12, 13, 11, 13,  // 0xC0
+     8, 12, 11, 11, 11, 13, 10, 11,  8, 13, 14, 14, 10, 13, 14, 14,  // 0xD0
+     8, 14, 11, 13, 10, 10, 12, 13,  7,  9, 12,  9,  9, 13, 13, 11,  // 0xE0
+     8, 11, 10, 11,  9, 12, 12, 12,  7, 12, 12, 11,  8, 11,  9,  5,  // 0xF0
+    15                                                              // END
+};
+
+/* Custom table, loaded by table_load() */
+static unsigned char custom_table[MAX_SYMBOLS];
+static int custom_loaded;
+
+/*
+ * Get the code lengths of a static table.
+ */
+const unsigned char *
+table_lengths(int id) {
+    switch(id) {
+        case TABLE_TEXT:
+            return text_table;
+        case TABLE_GEDCOM:
+            return gedcom_table;
+        case TABLE_BINARY:
+            return binary_table;
+        case TABLE_CUSTOM:
+            return custom_loaded ? custom_table : NULL;
+    }
+
+    return NULL;
+}
+
+/*
+ * @brief Checks that code lengths make a table.
+ * @details Every symbol needs a code of 1 to TABLE_MAX_LEN bits, and the
+ * codes must be complete for canonical_codes().
+ *
+ * @param len Code length of every symbol
+ * @return 0 if the lengths make a table, 1 otherwise
+*/
+static int
+check_table(const unsigned char *len) {
+    uint32_t kraft = 0; // Sum of 2^(TABLE_MAX_LEN - length)
+
+    for(int s = 0; s < MAX_SYMBOLS; ++s) {
+        if(*(len+s) < 1 || *(len+s) > TABLE_MAX_LEN) return 1;
+        kraft += 1 << (TABLE_MAX_LEN - *(len+s));
+    }
+
+    return kraft != (1 << TABLE_MAX_LEN);
+}
+
+/*
+ * Load the custom table from a table file.
+ */
+int
+table_load(const char *path) {
+    unsigned char buf[TABLE_FILE_SIZE];
+    FILE *f = fopen(path, "rb");
+    size_t n;
+
+    if(f == NULL) return 1;
+    n = fread(buf, 1, TABLE_FILE_SIZE, f);
+    /* Exactly one table */
+    if(n != TABLE_FILE_SIZE || fgetc(f) != EOF) {
+        fclose(f);
+        return 1;
+    }
+    fclose(f);
+
+    for(int i = 0; i < 4; ++i) {
+        if(*(buf+i) != *(TABLE_MAGIC+i)) return 1;
+    }
+    if(check_table(buf+4)) return 1;
+
+    for(int s = 0; s < MAX_SYMBOLS; ++s) *(custom_table+s) = *(buf+4+s);
+    custom_loaded = 1;
+
+    return 0;
+}
+
+/*
+ * Reads a sample from standard input and writes its table file to
+ * standard output.
+ */
+int
+train() {
+    uint64_t count[256] = {0};  // Occurrences of every byte value
+    uint32_t weight[256];       // Scaled down counts
+    uint32_t hist[256];
+    unsigned char out[TABLE_FILE_SIZE];
+    unsigned char *buf = malloc(IO_BUF_SIZE);
+    uint64_t max = 0;
+    size_t n;
+    int shift = 0;
+
+    if(buf == NULL) return 1;
+    do {
+        n = io_read(buf, IO_BUF_SIZE);
+        histogram(buf, n, hist);
+        for(int s = 0; s < 256; ++s) *(count+s) += *(hist+s);
+    } while(n == IO_BUF_SIZE);
+    free(buf);
+    if(io_error()) return 1;
+
+    /* Keep the weights, plus one so that every byte value gets a code, in 24 bits */
+    for(int s = 0; s < 256; ++s) {
+        if(*(count+s) > max) max = *(count+s);
+    }
+    while((max >> shift) >= (1 << 24)) shift++;
+    for(int s = 0; s < 256; ++s) *(weight+s) = (*(count+s) >> shift) + 1;
+
+    for(int i = 0; i < 4; ++i) *(out+i) = *(TABLE_MAGIC+i);
+    if(code_lengths(weight, TABLE_MAX_LEN, out+4)) return 1;
+
+    if(io_write(out, TABLE_FILE_SIZE)) return 1;
+    return io_flush();
+}
@@ -2,22 +2,52 @@
 #include <stdlib.h>
 #include "const.h"
 #include "huff.h"
+#include "block.h"
+#include "options.h"
 #include "debug.h"
 
-/* global_options shift amounts */
-#define G_OP_H  0    
-#define G_OP_C  1  
-#define G_OP_D  2   
-#define G_OP_BS 16
-
 /* Max size of flag String length */
 #define MAX_FLAG_LEN 2
 
 #define DEFAULT_BLOCK_SIZE  0xFFFF 
 
+/* Code length limit given with -l */
+int global_max_code_len;
+
+/* Sync point interval given with -y */
+unsigned global_sync_every;
+
+/* Idle timeout given with -w */
+int global_flush_ms;
+
+/* Static tables selected with -s and -k */
+int global_use_static;
+const char *global_table_path;
+
+/* Run symbols selected with -e, LZ77 matches with -z, tANS with -f,
+   sampled histograms with -q */
+int global_rle;
+int global_lz;
+int global_ans;
+int global_sample;
+
+/* Repeated codes selected with -u */
+int global_reuse;
+
+/* Archive selected with -p, member given with -x */
+int global_archive;
+const char *global_member;
+
+/* Statistics file given with -v */
+const char *global_stats_path;
+
+/* Range given with -r */
+uint64_t global_range_offset;
+uint64_t global_range_len;
+
 /* Min and Max number of command line arguments */
 #define MIN_ARGS    2
-#define MAX_ARGS    4
+#define MAX_ARGS    25
 
 /*
  * @brief Calculate length of a String
@@ -40,67 +70,256 @@ strlength(const char *str) {
 
 /*
  * @brief Convert from String to Integer
- * @details The function converts the Block Size String to an int.
+ * @details Verifies the String is a non-empty String of digits from 0-9
+ * and converts it to an int.
  * 
- * @param argv The argument strings passed to the program from the CLI.
- * @return Block Size
+ * @param str The String to convert
+ * @param num Set to the converted value
+ * @return 0 if conversion succeeds and 1 if the String is not a number.
 */ 
 static int 
-get_b_size(char **argv) {
-    int bsize = 0, len;
-    
-    /* Get block size string length */
-    len = strlength(*(argv+3));
+get_num(const char *str, int *num) {
+    int len = strlength(str);
+
+    /* Reject empty and overlong Strings */
+    if(!len || len > 9) return 1;
 
     /* Convert String to Integer */
+    *num = 0;
     for(int i = 0; i < len; ++i) {
-        bsize = bsize * 10 + (*(*(argv+3)+i) - '0');
+        /* Test for digit (0-9) */
+        if(*(str+i) < '0' || *(str+i) > '9') return 1;
+        *num = *num * 10 + (*(str+i) - '0');
     }
 
-    return bsize;
+    return 0;
 }
 
 /*
- * @brief Evaluate Block size argument
- * @details Verifies the "-b" flag is present and that the Block Size argument is
- * a valid String of digits from 0-9. Converts the Block Size argument
- * to integer and verifies that number to be within range (1024 - 65536).
+ * @brief Convert a String of the form OFFSET:LENGTH to two Integers
+ * @details Both numbers are Strings of up to 19 digits from 0-9.
+ *
+ * @param str The String to convert
+ * @param offset Set to OFFSET
+ * @param len Set to LENGTH
+ * @return 0 if conversion succeeds and 1 if the String is not a range.
+*/
+static int
+get_range(const char *str, uint64_t *offset, uint64_t *len) {
+    uint64_t *num = offset; // Number being converted
+    int ndigits = 0;        // Number of digits in num
+
+    *offset = *len = 0;
+    for(; *str; ++str) {
+        if(*str == ':' && num == offset && ndigits) {
+            num = len;
+            ndigits = 0;
+            continue;
+        }
+        /* Test for digit (0-9) */
+        if(*str < '0' || *str > '9' || ++ndigits > 19) return 1;
+        *num = *num * 10 + (*str - '0');
+    }
+
+    return (num != len || !ndigits);
+}
+
+/*
+ * @brief Compare two Strings
+ *
+ * @param a First String
+ * @param b Second String
+ * @return 1 if the Strings are equal, 0 otherwise
+*/
+static int
+streq(const char *a, const char *b) {
+    for(; *a && *a == *b; ++a, ++b);
+    return *a == *b;
+}
+
+/*
+ * @brief Evaluate the optional flags after -c or -d
+ * @details Each optional flag may appear at most once. Flags taking a
+ * number are followed by it:
+ *     -b  Block Size, within range (1024 - 65536)      (-c only)
+ *     -a  Size blocks adaptively                       (-c only)
+ *     -m  Interleave the streams of every block        (-c only)
+ *     -s  Use the built-in static tables               (-c only)
+ *     -k  Load a static table file                     (-c implies -s)
+ *     -e  Code runs with run symbols                   (-c only, not with -m)
+ *     -z  Code repeated strings as LZ77 matches        (-c only, not with -m)
+ *     -f  Code blocks with tANS where smaller          (-c only, not with -m)
+ *     -q  Build the code from a sample of the block    (-c only, not with -m,
+ *                                                       -e, -z, -f or -y)
+ *     -j  Number of threads, within range (1 - 255)
+ *     -i  Append a block index                         (-c only)
+ *     -u  Repeat the code of the previous block        (-c only, not with -m,
+ *                                                       -i, or -j above 1 but
+ *                                                       with -p)
+ *     -l  Code length limit, within range (9 - 31)     (-c only)
+ *     -y  Sync point interval, (1024 - 4194304)        (-c only, not with -m)
+ *     -r  Range of raw bytes, as OFFSET:LENGTH         (-d only, not with -j)
+ *     -p  Pack the files listed on standard input      (-c only, not with -w)
+ *     -x  Name of the archive member to extract        (-d only, not with -r)
+ *     -v  Block statistics file, "-" for stderr        (also --stats; not with
+ *                                                       -j above 1, -p, -x or -r)
+ * The Block Size is set to the default when "-b" is not given.
  *
  * @param argc The number of arguments passed to the program from the CLI.
  * @param argv The argument strings passed to the program from the CLI.
+ * @param mode 'c' when compressing, 'd' when decompressing
  * @return 0 if validation succeeds and 1 if validation fails.
  * @modifies global_options variable
 */
 static int 
-checkb(int argc, char **argv) {
-    int bsize;
+checkopts(int argc, char **argv, char mode) {
+    int bsize = DEFAULT_BLOCK_SIZE + 1; // Block Size
+    int nthreads = 0;                   // Number of threads
+    int seen = 0;                       // Bitmap of the flags seen so far
+    int num;
 
-    /* Verify String is "-b" */
-    if(strlength(*(argv+2)) == MAX_FLAG_LEN 
-       && *(*(argv+2)) == '-' && *(*(argv+2)+1) == 'b') {
+    for(int i = 2; i < argc; ++i) {
+        const char *flag = *(argv+i);
+        if(streq(flag, "--stats")) flag = "-v";
+        if(strlength(flag) != MAX_FLAG_LEN || *flag != '-') return 1;
 
-        /* Test for digit (0-9) */
-        const char *s = *(argv+3);
-        for(; *s; ++s) {
-            if(*s >= '0' && *s <= '9') {
-                continue;    
-            } else {
+        char f = *(flag+1);
+        switch(f) {
+            case 'b':
+                if(mode != 'c') return 1;
+                if(i+1 >= argc || get_num(*(argv+ ++i), &num)) return 1;
+                /* Test Block Size Boundaries */
+                if(num < MIN_BLOCK_SIZE || num > MAX_BLOCK_SIZE) return 1;
+                bsize = num;
+                break;
+            case 'a':
+                if(mode != 'c') return 1;
+                global_options |= (1 << G_OP_A);
+                break;
+            case 'm':
+                if(mode != 'c') return 1;
+                global_options |= (1 << G_OP_M);
+                break;
+            case 'u':
+                if(mode != 'c') return 1;
+                global_reuse = 1;
+                break;
+            case 's':
+                if(mode != 'c') return 1;
+                global_use_static = 1;
+                break;
+            case 'e':
+                if(mode != 'c') return 1;
+                global_rle = 1;
+                break;
+            case 'z':
+                if(mode != 'c') return 1;
+                global_lz = 1;
+                break;
+            case 'f':
+                if(mode != 'c') return 1;
+                global_ans = 1;
+                break;
+            case 'q':
+                if(mode != 'c') return 1;
+                global_sample = 1;
+                break;
+            case 'k':
+                if(i+1 >= argc) return 1;
+                global_table_path = *(argv+ ++i);
+                if(mode == 'c') global_use_static = 1;
+                break;
+            case 'j':
+                if(i+1 >= argc || get_num(*(argv+ ++i), &num)) return 1;
+                /* Test Thread Count Boundaries */
+                if(num < MIN_THREADS || num > MAX_THREADS) return 1;
+                nthreads = num;
+                break;
+            case 'i':
+                if(mode != 'c') return 1;
+                global_options |= (1 << G_OP_I);
+                break;
+            case 'l':
+                if(mode != 'c') return 1;
+                if(i+1 >= argc || get_num(*(argv+ ++i), &num)) return 1;
+                /* Test Code Length Limit Boundaries */
+                if(num < MIN_CODE_LIMIT || num > MAX_CODE_LEN) return 1;
+                global_max_code_len = num;
+                break;
+            case 'y':
+                if(mode != 'c') return 1;
+                if(i+1 >= argc || get_num(*(argv+ ++i), &num)) return 1;
+                /* Test Sync Point Interval Boundaries */
+                if(num < MIN_SYNC_EVERY || num > MAX_SYNC_EVERY) return 1;
+                global_sync_every = num;
+                break;
+            case 'w':
+                if(mode != 'c') return 1;
+                if(i+1 >= argc || get_num(*(argv+ ++i), &num)) return 1;
+                /* Test Idle Timeout Boundaries */
+                if(num < MIN_FLUSH_MS || num > MAX_FLUSH_MS) return 1;
+                global_flush_ms = num;
+                break;
+            case 'r':
+                if(mode != 'd') return 1;
+                if(i+1 >= argc || get_range(*(argv+ ++i), &global_range_offset,
+                                            &global_range_len)) return 1;
+                global_options |= (1 << G_OP_R);
+                break;
+            case 'p':
+                if(mode != 'c') return 1;
+                global_archive = 1;
+                break;
+            case 'x':
+                if(mode != 'd' || i+1 >= argc) return 1;
+                global_member = *(argv+ ++i);
+                break;
+            case 'v':
+                if(i+1 >= argc) return 1;
+                global_stats_path = *(argv+ ++i);
+                break;
+            default:
                 return 1;
-            }
-        }
-    
-        /* Convert from String to Integer */
-        bsize = get_b_size(argv);
-        
-        /* Test Block Size Boundaries */
-        if(bsize >= MIN_BLOCK_SIZE && bsize <= MAX_BLOCK_SIZE) {
-            /* Set block size in global_options */
-            global_options |= ((bsize - 1) << G_OP_BS);
-            return 0;
         }
+
+        /* Each flag at most once */
+        if(seen & (1 << (f - 'a'))) return 1;
+        seen |= 1 << (f - 'a');
     }
 
-    return 1;
+    /* Interleaved streams code one symbol per byte */
+    if(global_rle && (global_options & (1 << G_OP_M))) return 1;
+    if(global_lz && (global_options & (1 << G_OP_M))) return 1;
+    if(global_ans && (global_options & (1 << G_OP_M))) return 1;
+    if(global_sync_every && (global_options & (1 << G_OP_M))) return 1;
+    if(global_reuse && (global_options & (1 << G_OP_M))) return 1;
+
+    /* A sampled code has escapes for one symbol per byte, without streams
+       or sync points to split it */
+    if(global_sample && ((global_options & (1 << G_OP_M)) || global_rle || global_lz
+                         || global_ans || global_sync_every)) return 1;
+
+    /* Ranges are extracted, and streams compressed, by a single thread */
+    if(nthreads && (global_options & (1 << G_OP_R))) return 1;
+    if(nthreads > 1 && global_flush_ms) return 1;
+
+    /* A repeated code depends on the block before, which only a single
+       thread has at hand; blocks of an indexed stream decode on their own */
+    if(global_reuse && ((nthreads > 1 && !global_archive)
+                        || (global_options & (1 << G_OP_I)))) return 1;
+
+    /* Archives are compressed file by file, and members extracted whole */
+    if(global_archive && global_flush_ms) return 1;
+    if(global_member && (global_options & (1 << G_OP_R))) return 1;
+
+    /* Statistics are taken by a single context */
+    if(global_stats_path && (nthreads > 1 || global_archive || global_member
+                             || (global_options & (1 << G_OP_R)))) return 1;
+
+    /* Set block size and thread count in global_options */
+    global_options |= ((bsize - 1) << G_OP_BS);
+    global_options |= (nthreads << G_OP_J);
+    return 0;
 }
 
 /*
@@ -132,22 +351,17 @@ validargs(int argc, char **argv) {
                 case 'c': // --------------------------- COMPRESS --------------------------- //
                     /* Set global_options to compress */
                     global_options |= (1 << G_OP_C); 
-                    if(argc == MIN_ARGS) { // If optional flag "-b" not provided
-                        /* Set default block size */
-                        global_options |= (DEFAULT_BLOCK_SIZE << G_OP_BS);
-                        return EXIT_SUCCESS;
-                    } else if(argc == MAX_ARGS) {
-                        /* Test for "-b" and validate block size */
-                        return checkb(argc, argv); 
-                    }   
-                    break;
+                    /* Validate optional flags */
+                    return checkopts(argc, argv, 'c');
+                case 't': // --------------------------- TRAIN --------------------------- //
+                    /* Set global_options to train a table, which takes no flags */
+                    global_options |= (1 << G_OP_T);
+                    return argc != MIN_ARGS;
                 case 'd': // --------------------------- DECOMPRESS --------------------------- //
-                    if(argc > MIN_ARGS) break; // No arguments after "-d" flag allowed
-                    /* Set default block size */
-                    global_options |= (DEFAULT_BLOCK_SIZE << G_OP_BS);
                     /* Set global_options to decompress */
                     global_options |= (1 << G_OP_D);
-                    return EXIT_SUCCESS;
+                    /* Validate optional flags, setting the default block size */
+                    return checkopts(argc, argv, 'd');
             }
         }
     }
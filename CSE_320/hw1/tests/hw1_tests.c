@@ -1,6 +1,8 @@
 #include <criterion/criterion.h>
 #include <criterion/logging.h>
 #include "const.h"
+#include "options.h"
+#include "huff_ctx.h"
 
 Test(basecode_tests_suite, validargs_help_test) {
     int argc = 2;
@@ -52,3 +54,566 @@ Test(basecode_tests_suite, help_system_test) {
                  "Program exited with %d instead of EXIT_SUCCESS",
 		 return_code);
 }
+
+Test(basecode_tests_suite, decompress_system_test) {
+    char *cmd = "bin/huff -d < rsrc/gettysburg.out | cmp -s - rsrc/gettysburg.txt";
+
+    int return_code = WEXITSTATUS(system(cmd));
+
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Decompressed output differs from rsrc/gettysburg.txt");
+}
+
+Test(basecode_tests_suite, decompress_long_codes_system_test) {
+    // Symbol i occurs 2^i times, giving codes longer than the decode table
+    char *cmd = "awk 'BEGIN { for(i = 0; i < 18; i++) for(j = 0; j < 2^i; j++) "
+                "printf \"%c\", 65 + i }' > /tmp/hw1_skewed.txt && "
+                "bin/huff -c < /tmp/hw1_skewed.txt | bin/huff -d | cmp -s - /tmp/hw1_skewed.txt";
+
+    int return_code = WEXITSTATUS(system(cmd));
+
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Round trip of skewed data differs from the input");
+}
+
+Test(basecode_tests_suite, compress_binary_system_test) {
+    // Random data contains the symbols 0x00 and 0xFF
+    char *cmd = "head -c 200000 /dev/urandom > /tmp/hw1_random.bin && "
+                "bin/huff -c -b 4096 < /tmp/hw1_random.bin | bin/huff -d | cmp -s - /tmp/hw1_random.bin";
+
+    int return_code = WEXITSTATUS(system(cmd));
+
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Round trip of binary data differs from the input");
+}
+
+Test(basecode_tests_suite, validargs_threads_test) {
+    int argc = 6;
+    char *argv[] = {"bin/huff", "-c", "-j", "8", "-b", "2048", NULL};
+    int ret = validargs(argc, argv);
+    int exp_ret = 0;
+    int opt = global_options;
+    int exp_threads = 8;
+    int threads = (opt >> 8) & 0xff;
+    int exp_size = 2048;
+    int size = ((opt >> 16) & 0xffff) + 1;
+    cr_assert_eq(ret, exp_ret, "Invalid return for valid args.  Got: %d | Expected: %d",
+		 ret, exp_ret);
+    cr_assert_eq(exp_threads, threads, "Thread count not properly set. Got: %d | Expected: %d",
+		 threads, exp_threads);
+    cr_assert_eq(exp_size, size, "Block size not properly set. Got: %d | Expected: %d",
+		 size, exp_size);
+}
+
+Test(basecode_tests_suite, validargs_exclusive_test) {
+    // Flags that cannot be combined are rejected
+    char *cmd = "for o in '-q -m' '-q -e' '-q -z' '-q -f' '-q -y 1024' "
+                "'-m -e' '-m -z' '-m -f' '-m -y 1024' '-m -u'; do "
+                "bin/huff -c $o < /dev/null > /dev/null 2>&1 && exit 1; "
+                "done; exit 0";
+
+    int return_code = WEXITSTATUS(system(cmd));
+
+    cr_assert_eq(return_code, EXIT_SUCCESS, "Exclusive flags accepted together");
+}
+
+Test(basecode_tests_suite, compress_parallel_system_test) {
+    // Output of -j must be byte-identical to the serial output
+    char *cmd = "head -c 300000 /dev/urandom > /tmp/hw1_parallel.bin && "
+                "cat rsrc/gettysburg.txt >> /tmp/hw1_parallel.bin && "
+                "bin/huff -c -b 1024 < /tmp/hw1_parallel.bin > /tmp/hw1_serial.huf && "
+                "bin/huff -c -b 1024 -j 4 < /tmp/hw1_parallel.bin | cmp -s - /tmp/hw1_serial.huf";
+
+    int return_code = WEXITSTATUS(system(cmd));
+
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Parallel compression output differs from serial output");
+}
+
+Test(basecode_tests_suite, compress_parallel_coded_system_test) {
+    // Compressible blocks, under every option, are the same with -j; -u
+    // repeats codes, so it takes a single thread
+    char *cmd = "seq 1 60000 > /tmp/hw1_coded.txt && "
+                "for i in $(seq 1 40); do cat rsrc/gettysburg.txt; done >> /tmp/hw1_coded.txt && "
+                "for o in '' -s -e -z '-y 1024' '-l 10' -a -f -q; do "
+                "bin/huff -c -b 1024 $o < /tmp/hw1_coded.txt > /tmp/hw1_coded.huf && "
+                "bin/huff -c -b 1024 -j 4 $o < /tmp/hw1_coded.txt | cmp -s - /tmp/hw1_coded.huf || exit 1; "
+                "done && "
+                "bin/huff -c -b 1024 -u < /tmp/hw1_coded.txt > /tmp/hw1_coded.huf && "
+                "test \"$(od -An -tx1 /tmp/hw1_coded.huf | grep -c ' 84')\" -gt 0 && "
+                "bin/huff -d < /tmp/hw1_coded.huf | cmp -s - /tmp/hw1_coded.txt && "
+                "! bin/huff -c -u -j 2 < /dev/null 2> /dev/null";
+
+    int return_code = WEXITSTATUS(system(cmd));
+
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Parallel compression output differs from serial output");
+}
+
+Test(basecode_tests_suite, decompress_parallel_system_test) {
+    // Parallel decompression uses the block index and pwrite()
+    char *cmd = "head -c 100000 /dev/urandom > /tmp/hw1_index.bin && "
+                "cat rsrc/gettysburg.txt rsrc/gettysburg.txt >> /tmp/hw1_index.bin && "
+                "bin/huff -c -b 1024 -i < /tmp/hw1_index.bin > /tmp/hw1_index.huf && "
+                "bin/huff -d -j 4 < /tmp/hw1_index.huf > /tmp/hw1_index.out && "
+                "cmp -s /tmp/hw1_index.out /tmp/hw1_index.bin && "
+                "bin/huff -d < /tmp/hw1_index.huf | cmp -s - /tmp/hw1_index.bin";
+
+    int return_code = WEXITSTATUS(system(cmd));
+
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Decompression of a stream with a block index differs from the input");
+}
+
+Test(basecode_tests_suite, validargs_range_test) {
+    int argc = 4;
+    char *argv[] = {"bin/huff", "-d", "-r", "5000000000:1234", NULL};
+    int ret = validargs(argc, argv);
+    int exp_ret = 0;
+    cr_assert_eq(ret, exp_ret, "Invalid return for valid args.  Got: %d | Expected: %d",
+		 ret, exp_ret);
+    cr_assert(global_options & 0x10, "Range mode bit wasn't set. Got: %x", global_options);
+    cr_assert_eq(global_range_offset, 5000000000ULL, "Range offset not properly set.");
+    cr_assert_eq(global_range_len, 1234, "Range length not properly set.");
+}
+
+Test(basecode_tests_suite, extract_range_system_test) {
+    // Range spanning a block boundary, and a range past the end of the data
+    char *cmd = "head -c 50000 /dev/urandom > /tmp/hw1_range.bin && "
+                "bin/huff -c -b 4096 -i < /tmp/hw1_range.bin > /tmp/hw1_range.huf && "
+                "bin/huff -d -r 8000:10000 < /tmp/hw1_range.huf > /tmp/hw1_range.out && "
+                "tail -c +8001 /tmp/hw1_range.bin | head -c 10000 | cmp -s - /tmp/hw1_range.out && "
+                "bin/huff -d -r 49990:100 < /tmp/hw1_range.huf > /tmp/hw1_range.out && "
+                "tail -c 10 /tmp/hw1_range.bin | cmp -s - /tmp/hw1_range.out";
+
+    int return_code = WEXITSTATUS(system(cmd));
+
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Extracted range differs from the input");
+}
+
+Test(basecode_tests_suite, compress_canonical_system_test) {
+    // Small text blocks are sent as canonical code lengths (first byte 0x80)
+    char *cmd = "bin/huff -c < rsrc/gettysburg.txt > /tmp/hw1_canonical.huf && "
+                "test \"$(od -An -tx1 -N1 /tmp/hw1_canonical.huf)\" = \" 80\" && "
+                "bin/huff -d < /tmp/hw1_canonical.huf | cmp -s - rsrc/gettysburg.txt";
+
+    int return_code = WEXITSTATUS(system(cmd));
+
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Canonical block missing or decompressed output differs");
+}
+
+Test(basecode_tests_suite, compress_length_limit_system_test) {
+    // Symbol weights 2^i would need codes up to 18 bits without the limit
+    char *cmd = "awk 'BEGIN { for(i = 0; i < 18; i++) for(j = 0; j < 2^i; j++) "
+                "printf(\"%c\", 65+i) }' > /tmp/hw1_limit.txt && "
+                "bin/huff -c -l 11 < /tmp/hw1_limit.txt > /tmp/hw1_limit.huf && "
+                "bin/huff -d < /tmp/hw1_limit.huf | cmp -s - /tmp/hw1_limit.txt && "
+                "! bin/huff -c -l 8 < /tmp/hw1_limit.txt > /dev/null 2>&1";
+
+    int return_code = WEXITSTATUS(system(cmd));
+
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Length-limited compression failed or output differs");
+}
+
+Test(basecode_tests_suite, compress_small_blocks_system_test) {
+    // Many small blocks, each with its own tree
+    char *cmd = "for i in 1 2 3 4 5 6 7 8; do cat rsrc/gettysburg.txt; done > /tmp/hw1_small.txt && "
+                "bin/huff -c -b 1024 < /tmp/hw1_small.txt > /tmp/hw1_small.huf && "
+                "bin/huff -d < /tmp/hw1_small.huf | cmp -s - /tmp/hw1_small.txt";
+
+    int return_code = WEXITSTATUS(system(cmd));
+
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Decompressed output differs from the input");
+}
+
+Test(basecode_tests_suite, compress_runs_system_test) {
+    // Long runs of a single byte value, and a block of just one byte
+    char *cmd = "head -c 200001 /dev/zero > /tmp/hw1_runs.bin && "
+                "bin/huff -c < /tmp/hw1_runs.bin > /tmp/hw1_runs.huf && "
+                "bin/huff -d < /tmp/hw1_runs.huf | cmp -s - /tmp/hw1_runs.bin";
+
+    int return_code = WEXITSTATUS(system(cmd));
+
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Decompressed output differs from the input");
+}
+
+Test(basecode_tests_suite, pipe_input_system_test) {
+    // A mapped regular file and a pipe must give the same output
+    char *cmd = "head -c 3000000 /dev/urandom | od -An -tx1 > /tmp/hw1_pipe.txt && "
+                "bin/huff -c < /tmp/hw1_pipe.txt > /tmp/hw1_pipe.huf && "
+                "cat /tmp/hw1_pipe.txt | bin/huff -c | cmp -s - /tmp/hw1_pipe.huf && "
+                "cat /tmp/hw1_pipe.huf | bin/huff -d | cmp -s - /tmp/hw1_pipe.txt";
+
+    int return_code = WEXITSTATUS(system(cmd));
+
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Output differs between pipe and file input");
+}
+
+Test(basecode_tests_suite, ctx_buffer_test) {
+    // Two streams coded at once, one of them pushed a few bytes at a time
+    size_t n = 150000;
+    unsigned char *raw = malloc(n), *raw2 = malloc(n);
+    for(size_t i = 0; i < n; ++i) raw[i] = (i * i) % 61 + (i % 7 == 0 ? 200 : 0);
+    HUFF_PARAMS params = { .block_size = 4096, .index = 1 };
+    HUFF_CTX *c1 = huff_ctx_init(HUFF_COMPRESS, &params);
+    HUFF_CTX *c2 = huff_ctx_init(HUFF_COMPRESS, NULL);
+    HUFF_CTX *d = huff_ctx_init(HUFF_DECOMPRESS, NULL);
+    cr_assert(c1 && c2 && d, "Contexts not created");
+
+    size_t cap = huff_compress_bound(c1, n);
+    unsigned char *comp = malloc(cap), *comp2 = malloc(cap);
+    ssize_t clen = huff_compress_buf(c1, raw, n, comp, cap);
+    ssize_t clen2 = huff_compress_buf(c2, raw, n, comp2, cap);
+    cr_assert(clen > 0 && clen2 > 0 && clen < n, "Compression failed");
+
+    ssize_t rlen = huff_decompress_buf(d, comp2, clen2, raw2, n);
+    cr_assert_eq(rlen, n, "Decompressed size differs: %zd", rlen);
+    for(size_t i = 0; i < n; ++i) cr_assert_eq(raw[i], raw2[i], "Byte %zu differs", i);
+
+    huff_ctx_reset(d);
+    size_t in = 0, out = 0;
+    while(in < clen) {
+        size_t k = clen - in < 5 ? clen - in : 5;
+        ssize_t r = huff_push(d, comp+in, k);
+        cr_assert(r >= 0, "Push failed");
+        in += r;
+        while((r = huff_pull(d, raw2+out, n-out)) > 0) out += r;
+        cr_assert(r == 0, "Pull failed");
+    }
+    cr_assert_eq(huff_finish(d), 0, "Finish failed");
+    ssize_t r;
+    while((r = huff_pull(d, raw2+out, n-out)) > 0) out += r;
+    cr_assert_eq(out, n, "Streamed size differs: %zu", out);
+    for(size_t i = 0; i < n; ++i) cr_assert_eq(raw[i], raw2[i], "Byte %zu differs", i);
+
+    cr_assert_eq(huff_decompress_buf(d, comp2, clen2 - 100, raw2, n), -1,
+                 "Truncated stream accepted");
+
+    huff_ctx_fini(c1);
+    huff_ctx_fini(c2);
+    huff_ctx_fini(d);
+    free(raw);
+    free(raw2);
+    free(comp);
+    free(comp2);
+}
+
+Test(basecode_tests_suite, ctx_params_test) {
+    // Out of range and ignored parameters are rejected, as by validargs()
+    HUFF_PARAMS bad[] = {
+        { .sync_every = 1 },
+        { .sync_every = MAX_SYNC_EVERY + 1 },
+        { .interleave = 1, .rle = 1 },
+        { .interleave = 1, .lz = 1 },
+        { .interleave = 1, .ans = 1 },
+        { .interleave = 1, .sample = 1 },
+        { .interleave = 1, .reuse = 1 },
+        { .interleave = 1, .sync_every = 1024 },
+        { .sample = 1, .rle = 1 },
+        { .sample = 1, .sync_every = 1024 },
+        { .reuse = 1, .index = 1 },
+    };
+    for(size_t i = 0; i < sizeof(bad) / sizeof(*bad); ++i) {
+        cr_assert_null(huff_ctx_init(HUFF_COMPRESS, bad+i), "Parameters %zu accepted", i);
+    }
+
+    HUFF_PARAMS good = { .sync_every = 1024, .rle = 1, .lz = 1, .ans = 1, .reuse = 1 };
+    HUFF_CTX *c = huff_ctx_init(HUFF_COMPRESS, &good);
+    cr_assert_not_null(c, "Valid parameters rejected");
+    huff_ctx_fini(c);
+}
+
+Test(basecode_tests_suite, ctx_sync_bound_test) {
+    // Nearly incompressible blocks with sync points fit the bound, stored
+    size_t n = 256 << 10;
+    unsigned char *raw = malloc(n), *raw2 = malloc(n);
+    uint32_t x = 2463534242u;
+    for(size_t i = 0; i < n; ++i) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        raw[i] = x % 250;
+    }
+    HUFF_PARAMS params = { .block_size = 65536, .sync_every = 1024 };
+    HUFF_CTX *c = huff_ctx_init(HUFF_COMPRESS, &params);
+    HUFF_CTX *d = huff_ctx_init(HUFF_DECOMPRESS, NULL);
+    cr_assert(c && d, "Contexts not created");
+
+    size_t cap = huff_compress_bound(c, n);
+    unsigned char *comp = malloc(cap);
+    ssize_t clen = huff_compress_buf(c, raw, n, comp, cap);
+    cr_assert(clen > 0, "Compression into %zu bytes failed", cap);
+    cr_assert(clen <= n + (n / 65536) * 5 + 1, "Blocks larger than stored: %zd", clen);
+
+    ssize_t rlen = huff_decompress_buf(d, comp, clen, raw2, n);
+    cr_assert_eq(rlen, n, "Decompressed size differs: %zd", rlen);
+    for(size_t i = 0; i < n; ++i) cr_assert_eq(raw[i], raw2[i], "Byte %zu differs", i);
+
+    huff_ctx_fini(c);
+    huff_ctx_fini(d);
+    free(raw);
+    free(raw2);
+    free(comp);
+}
+
+Test(basecode_tests_suite, compress_stored_system_test) {
+    // Random data is stored raw: 4 blocks of 65536 bytes, 5 bytes of header each
+    char *cmd = "head -c 262144 /dev/urandom > /tmp/hw1_stored.bin && "
+                "bin/huff -c < /tmp/hw1_stored.bin > /tmp/hw1_stored.huf && "
+                "test $(wc -c < /tmp/hw1_stored.huf) -eq 262164 && "
+                "test \"$(od -An -tx1 -N1 /tmp/hw1_stored.huf)\" = \" 81\" && "
+                "bin/huff -d < /tmp/hw1_stored.huf | cmp -s - /tmp/hw1_stored.bin";
+
+    int return_code = WEXITSTATUS(system(cmd));
+
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Random data not stored or decompressed output differs");
+}
+
+Test(basecode_tests_suite, compress_adaptive_system_test) {
+    // The random windows form one stored block of 8192 bytes and the zeros
+    // a single block of 1 bit per byte, instead of 1000 blocks of 1024 bytes
+    char *cmd = "(head -c 8192 /dev/urandom && head -c 1000000 /dev/zero) > /tmp/hw1_adapt.bin && "
+                "bin/huff -c -a -b 1024 < /tmp/hw1_adapt.bin > /tmp/hw1_adapt.huf && "
+                "test \"$(od -An -tx1 -N5 /tmp/hw1_adapt.huf)\" = \" 81 00 00 20 00\" && "
+                "test $(wc -c < /tmp/hw1_adapt.huf) -lt 140000 && "
+                "bin/huff -d < /tmp/hw1_adapt.huf | cmp -s - /tmp/hw1_adapt.bin";
+
+    int return_code = WEXITSTATUS(system(cmd));
+
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Adaptive blocks not merged or decompressed output differs");
+}
+
+Test(basecode_tests_suite, compress_interleaved_system_test) {
+    // Long enough for the streams to be decoded side by side, then one at a time
+    char *cmd = "for i in 1 2 3 4 5 6 7 8 9 10; do cat rsrc/gettysburg.txt; done > /tmp/hw1_streams.txt && "
+                "bin/huff -c -m < /tmp/hw1_streams.txt > /tmp/hw1_streams.huf && "
+                "test \"$(od -An -tx1 -N1 /tmp/hw1_streams.huf)\" = \" 82\" && "
+                "bin/huff -d < /tmp/hw1_streams.huf | cmp -s - /tmp/hw1_streams.txt && "
+                "cat /tmp/hw1_streams.huf | bin/huff -d | cmp -s - /tmp/hw1_streams.txt";
+
+    int return_code = WEXITSTATUS(system(cmd));
+
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Block not interleaved or decompressed output differs");
+}
+
+Test(basecode_tests_suite, compress_rle_system_test) {
+    // Text padded with long runs of zeros codes smaller with run symbols
+    char *cmd = "for i in 1 2 3 4 5 6 7 8; do cat rsrc/gettysburg.txt; head -c 3000 /dev/zero; done > /tmp/hw1_runs.bin && "
+                "bin/huff -c < /tmp/hw1_runs.bin > /tmp/hw1_runs_plain.huf && "
+                "bin/huff -c -e < /tmp/hw1_runs.bin > /tmp/hw1_runs.huf && "
+                "test \"$(od -An -tx1 -N1 /tmp/hw1_runs.huf)\" = \" 85\" && "
+                "test $(wc -c < /tmp/hw1_runs.huf) -lt $(wc -c < /tmp/hw1_runs_plain.huf) && "
+                "bin/huff -d < /tmp/hw1_runs.huf | cmp -s - /tmp/hw1_runs.bin && "
+                "cat /tmp/hw1_runs.huf | bin/huff -d | cmp -s - /tmp/hw1_runs.bin";
+
+    int return_code = WEXITSTATUS(system(cmd));
+
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Runs not coded or decompressed output differs");
+}
+
+Test(basecode_tests_suite, compress_lz_system_test) {
+    // Repeated text codes as matches in a fraction of its order-0 size
+    char *cmd = "for i in 1 2 3 4 5 6 7 8 9 10; do cat rsrc/gettysburg.txt; done > /tmp/hw1_lz.txt && "
+                "bin/huff -c < /tmp/hw1_lz.txt > /tmp/hw1_lz_plain.huf && "
+                "bin/huff -c -z < /tmp/hw1_lz.txt > /tmp/hw1_lz.huf && "
+                "test \"$(od -An -tx1 -N1 /tmp/hw1_lz.huf)\" = \" 86\" && "
+                "test $(( $(wc -c < /tmp/hw1_lz.huf) * 4 )) -lt $(wc -c < /tmp/hw1_lz_plain.huf) && "
+                "bin/huff -d < /tmp/hw1_lz.huf | cmp -s - /tmp/hw1_lz.txt && "
+                "cat /tmp/hw1_lz.huf | bin/huff -d | cmp -s - /tmp/hw1_lz.txt";
+
+    int return_code = WEXITSTATUS(system(cmd));
+
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Matches not coded or decompressed output differs");
+}
+
+Test(basecode_tests_suite, compress_ans_system_test) {
+    // Three byte values, one of them most of the text, take a fraction of
+    // a bit each with tANS, and no less than a bit with a Huffman code
+    char *cmd = "for i in 1 2 3 4 5 6 7 8 9 10; do cat rsrc/gettysburg.txt; done | tr -c 'e ' 'x' > /tmp/hw1_ans.txt && "
+                "bin/huff -c < /tmp/hw1_ans.txt > /tmp/hw1_ans_plain.huf && "
+                "bin/huff -c -f < /tmp/hw1_ans.txt > /tmp/hw1_ans.huf && "
+                "test \"$(od -An -tx1 -N1 /tmp/hw1_ans.huf)\" = \" 87\" && "
+                "test $(wc -c < /tmp/hw1_ans.huf) -lt $(wc -c < /tmp/hw1_ans_plain.huf) && "
+                "bin/huff -d < /tmp/hw1_ans.huf | cmp -s - /tmp/hw1_ans.txt && "
+                "cat /tmp/hw1_ans.huf | bin/huff -d | cmp -s - /tmp/hw1_ans.txt";
+
+    int return_code = WEXITSTATUS(system(cmd));
+
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "tANS not used or decompressed output differs");
+}
+
+Test(basecode_tests_suite, compress_sync_system_test) {
+    // A block with sync points decodes the same with one thread or several
+    char *cmd = "for i in 1 2 3 4 5 6 7 8 9 10; do cat rsrc/gettysburg.txt; done > /tmp/hw1_sync.txt && "
+                "bin/huff -c -y 1024 < /tmp/hw1_sync.txt > /tmp/hw1_sync.huf && "
+                "test \"$(od -An -tx1 -N1 /tmp/hw1_sync.huf)\" = \" 88\" && "
+                "bin/huff -d < /tmp/hw1_sync.huf | cmp -s - /tmp/hw1_sync.txt && "
+                "bin/huff -d -j 4 < /tmp/hw1_sync.huf | cmp -s - /tmp/hw1_sync.txt && "
+                "cat /tmp/hw1_sync.huf | bin/huff -d -j 3 | cmp -s - /tmp/hw1_sync.txt";
+
+    int return_code = WEXITSTATUS(system(cmd));
+
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Sync points not recorded or decompressed output differs");
+}
+
+Test(basecode_tests_suite, compress_stream_system_test) {
+    // A quiet input has its first block out long before it ends
+    char *cmd = "rm -f /tmp/hw1_stream.huf && "
+                "(cat rsrc/gettysburg.txt; sleep 2; cat rsrc/gettysburg.txt) | "
+                "bin/huff -c -w 50 > /tmp/hw1_stream.huf & "
+                "sleep 1 && test -s /tmp/hw1_stream.huf && wait && "
+                "bin/huff -d < /tmp/hw1_stream.huf | cmp -s - /tmp/hw1_stream.txt";
+
+    int return_code = WEXITSTATUS(system("cat rsrc/gettysburg.txt rsrc/gettysburg.txt > /tmp/hw1_stream.txt"));
+    return_code |= WEXITSTATUS(system(cmd));
+
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Block not flushed when idle or decompressed output differs");
+}
+
+Test(basecode_tests_suite, compress_sampled_system_test) {
+    // Byte values that the sample of a block misses are escaped
+    char *cmd = "for i in $(seq 1 20); do cat rsrc/gettysburg.txt; done > /tmp/hw1_sampled.txt && "
+                "printf '\\001\\002\\003' >> /tmp/hw1_sampled.txt && "
+                "bin/huff -c -q < /tmp/hw1_sampled.txt > /tmp/hw1_sampled.huf && "
+                "test \"$(od -An -tx1 -N1 /tmp/hw1_sampled.huf)\" = \" 89\" && "
+                "bin/huff -d < /tmp/hw1_sampled.huf | cmp -s - /tmp/hw1_sampled.txt && "
+                "cat /tmp/hw1_sampled.huf | bin/huff -d | cmp -s - /tmp/hw1_sampled.txt";
+
+    int return_code = WEXITSTATUS(system(cmd));
+
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Block not sampled or decompressed output differs");
+}
+
+Test(basecode_tests_suite, compress_archive_system_test) {
+    // Every member is extracted alone, the same with any number of threads
+    char *cmd = "printf 'rsrc/gettysburg.txt\\nrsrc/gettysburg.out\\n' > /tmp/hw1_archive.lst && "
+                "bin/huff -c -p -j 2 < /tmp/hw1_archive.lst > /tmp/hw1_archive.hfa && "
+                "bin/huff -c -p < /tmp/hw1_archive.lst | cmp -s - /tmp/hw1_archive.hfa && "
+                "bin/huff -d -x rsrc/gettysburg.txt < /tmp/hw1_archive.hfa | cmp -s - rsrc/gettysburg.txt && "
+                "bin/huff -d -x rsrc/gettysburg.out < /tmp/hw1_archive.hfa | cmp -s - rsrc/gettysburg.out && "
+                "! bin/huff -d -x rsrc/missing < /tmp/hw1_archive.hfa";
+
+    int return_code = WEXITSTATUS(system(cmd));
+
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Archive differs or member not extracted");
+}
+
+Test(basecode_tests_suite, compress_stats_system_test) {
+    // One JSON line of statistics for each of the 29 blocks, both ways
+    char *cmd = "for i in $(seq 1 20); do cat rsrc/gettysburg.txt; done > /tmp/hw1_stats.txt && "
+                "bin/huff -c -b 1024 --stats /tmp/hw1_stats.c.json < /tmp/hw1_stats.txt > /tmp/hw1_stats.huf && "
+                "bin/huff -c -b 1024 < /tmp/hw1_stats.txt | cmp -s - /tmp/hw1_stats.huf && "
+                "test $(grep -c '^{\"block\": [0-9]*, \"mode\": \"compress\"' /tmp/hw1_stats.c.json) -eq 29 && "
+                "bin/huff -d -v - < /tmp/hw1_stats.huf 2> /tmp/hw1_stats.d.json | cmp -s - /tmp/hw1_stats.txt && "
+                "test $(grep -c '\"raw_size\": 1024, .*\"decode\": [1-9]' /tmp/hw1_stats.d.json) -eq 28";
+
+    int return_code = WEXITSTATUS(system(cmd));
+
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Statistics missing or output differs");
+}
+
+Test(basecode_tests_suite, compress_static_table_system_test) {
+    // A short message is coded with the built-in text table, then with a
+    // table trained on it, which is needed to decompress it
+    char *cmd = "head -c 300 rsrc/gettysburg.txt > /tmp/hw1_static.txt && "
+                "bin/huff -c -s < /tmp/hw1_static.txt > /tmp/hw1_static.huf && "
+                "test \"$(od -An -tx1 -N2 /tmp/hw1_static.huf)\" = \" 83 00\" && "
+                "bin/huff -d < /tmp/hw1_static.huf | cmp -s - /tmp/hw1_static.txt && "
+                "for i in 1 2 3 4 5 6 7 8 9 10; do cat /tmp/hw1_static.txt; done | bin/huff -t > /tmp/hw1_static.tab && "
+                "bin/huff -c -k /tmp/hw1_static.tab < /tmp/hw1_static.txt > /tmp/hw1_static.huf && "
+                "test \"$(od -An -tx1 -N2 /tmp/hw1_static.huf)\" = \" 83 03\" && "
+                "! bin/huff -d < /tmp/hw1_static.huf > /dev/null && "
+                "bin/huff -d -k /tmp/hw1_static.tab < /tmp/hw1_static.huf | cmp -s - /tmp/hw1_static.txt";
+
+    int return_code = WEXITSTATUS(system(cmd));
+
+    cr_assert_eq(return_code, EXIT_SUCCESS,
+                 "Static table not used or decompressed output differs");
+}
+
+Test(basecode_tests_suite, ctx_repeat_test) {
+    // The second of two equal blocks repeats the code of the first
+    unsigned char raw[2048], comp[4096], raw2[2048];
+    for(int i = 0; i < 1024; ++i) raw[i] = raw[i+1024] = 'a' + (i * 7) % 13;
+    HUFF_PARAMS params = { .block_size = 1024, .reuse = 1 };
+    HUFF_CTX *c = huff_ctx_init(HUFF_COMPRESS, &params);
+    HUFF_CTX *d = huff_ctx_init(HUFF_DECOMPRESS, NULL);
+    cr_assert(c && d, "Contexts not created");
+
+    cr_assert_eq(huff_push(c, raw, 1024), 1024, "First block not consumed");
+    ssize_t len1 = huff_pull(c, comp, sizeof(comp));
+    cr_assert_eq(huff_push(c, raw+1024, 1024), 1024, "Second block not consumed");
+    ssize_t len2 = huff_pull(c, comp+len1, sizeof(comp)-len1);
+    cr_assert(len1 > 0 && len2 > 0 && len2 < len1, "Block sizes %zd, %zd", len1, len2);
+    cr_assert_eq(comp[len1], 0x84, "Second block does not repeat the code");
+    cr_assert_eq(huff_finish(c), 0, "Finish failed");
+
+    ssize_t rlen = huff_decompress_buf(d, comp, len1+len2, raw2, sizeof(raw2));
+    cr_assert_eq(rlen, 2048, "Decompressed size differs: %zd", rlen);
+    for(int i = 0; i < 2048; ++i) cr_assert_eq(raw[i], raw2[i], "Byte %d differs", i);
+    cr_assert_eq(huff_decompress_buf(d, comp+len1, len2, raw2, sizeof(raw2)), -1,
+                 "Repeated code accepted without a previous block");
+
+    huff_ctx_fini(c);
+    huff_ctx_fini(d);
+}
+
+static void
+count_repeats(const HUFF_STATS *st, void *arg) {
+    int *count = arg;
+    count[0]++;
+    if(st->type == 0x84) count[1]++;
+}
+
+Test(basecode_tests_suite, ctx_repeat_skewed_test) {
+    // Rare byte values missing from some blocks do not stop the code from
+    // being repeated
+    size_t n = 200 << 10;
+    unsigned char *raw = malloc(n), *raw2 = malloc(n);
+    uint32_t x = 2463534242u;
+    for(size_t i = 0; i < n; ++i) {
+        int s = 0;
+        do {
+            x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        } while(x % 10 && ++s < 63);
+        raw[i] = s;
+    }
+    int count[2] = {0, 0};  // Blocks, repeat blocks
+    HUFF_PARAMS params = { .block_size = 1024, .reuse = 1, .stats = count_repeats,
+                           .stats_arg = count };
+    HUFF_CTX *c = huff_ctx_init(HUFF_COMPRESS, &params);
+    HUFF_CTX *d = huff_ctx_init(HUFF_DECOMPRESS, NULL);
+    cr_assert(c && d, "Contexts not created");
+
+    size_t cap = huff_compress_bound(c, n);
+    unsigned char *comp = malloc(cap);
+    ssize_t clen = huff_compress_buf(c, raw, n, comp, cap);
+    cr_assert(clen > 0, "Compression failed");
+    cr_assert(count[1] * 10 > count[0] * 9, "Only %d of %d blocks repeat the code",
+              count[1], count[0]);
+
+    ssize_t rlen = huff_decompress_buf(d, comp, clen, raw2, n);
+    cr_assert_eq(rlen, n, "Decompressed size differs: %zd", rlen);
+    for(size_t i = 0; i < n; ++i) cr_assert_eq(raw[i], raw2[i], "Byte %zu differs", i);
+
+    huff_ctx_fini(c);
+    huff_ctx_fini(d);
+    free(raw);
+    free(raw2);
+    free(comp);
+}